@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host client library
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "hsCapture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace hs {
+
+static const char capMagic[4] = { 'H', 'S', 'C', 'P' };
+
+/* -------------------------------------------------------------------------- */
+/* | Capture																| */
+/* -------------------------------------------------------------------------- */
+void Capture::add(uint8_t type, uint32_t timeUs, const uint8_t *data, size_t len)
+{
+	// longer ones are split, keeping their time
+	do {
+		size_t n = (len > 0xFFFF) ? 0xFFFF : len;
+		Record r;
+		r.type = type;
+		r.timeUs = timeUs;
+		r.data.assign(data, data + n);
+		mRecords.push_back(r);
+		data += n;
+		len -= n;
+	} while(len > 0);
+}
+
+std::vector<const Capture::Record *> Capture::select(uint8_t type) const
+{
+	std::vector<const Record *> out;
+	for(size_t i = 0; i < mRecords.size(); i++) {
+		if(mRecords[i].type == type) out.push_back(&mRecords[i]);
+	}
+	return out;
+}
+
+bool Capture::load(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if(!f) return false;
+	
+	uint8_t hdr[7];
+	bool ok = (fread(hdr, 1, 5, f) == 5) && !memcmp(hdr, capMagic, 4) && (hdr[4] == CAP_VERSION);
+	mRecords.clear();
+	while(ok && (fread(hdr, 1, 7, f) == 7)) {
+		Record r;
+		r.type = hdr[0];
+		r.timeUs = hdr[1] | (hdr[2] << 8) | (hdr[3] << 16) | ((uint32_t)hdr[4] << 24);
+		r.data.resize(hdr[5] | (hdr[6] << 8));
+		ok = r.data.empty() || (fread(&r.data[0], 1, r.data.size(), f) == r.data.size());
+		if(ok) mRecords.push_back(r);
+	}
+	ok = ok && !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+bool Capture::save(const char *path) const
+{
+	FILE *f = fopen(path, "wb");
+	if(!f) return false;
+	
+	uint8_t hdr[7];
+	bool ok = (fwrite(capMagic, 1, 4, f) == 4) && (fputc(CAP_VERSION, f) != EOF);
+	for(size_t i = 0; ok && i < mRecords.size(); i++) {
+		const Record &r = mRecords[i];
+		hdr[0] = r.type;
+		for(uint8_t j = 0; j < 4; j++) hdr[1 + j] = (uint8_t)(r.timeUs >> (8 * j));
+		hdr[5] = (uint8_t)r.data.size();
+		hdr[6] = (uint8_t)(r.data.size() >> 8);
+		ok = (fwrite(hdr, 1, 7, f) == 7) &&
+			 (r.data.empty() || (fwrite(&r.data[0], 1, r.data.size(), f) == r.data.size()));
+	}
+	ok = (fclose(f) == 0) && ok;
+	return ok;
+}
+
+} // namespace hs
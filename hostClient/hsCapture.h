@@ -0,0 +1,81 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host client library
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Capture of a session with the master, replayed by simulation/tools/hsReplay:
+// the bytes the host sent, as the master's serial parser receives them, with
+// their time, and the reference output of the master for them, i.e. the
+// piezo sets it wrote to the slaves over i2c and the shift register images
+// the slaves latched.
+//
+// File: "HSCP" version(1), then the records in time order, little endian:
+//   type(1) time(4, us since the start of the capture) len(2) data(len)
+// cap_rx:		bytes sent to the master
+// cap_i2c:		i2c write of a piezo set (i2cCmd_regSet / regImage) or of the
+//				general call commit: address, then the bytes written
+// cap_latch:	image latched by a slave: slave number, then its shift
+//				registers (closest to the output end first)
+// The host records cap_rx only (hs::Client::Options::capture, or any program
+// writing the bytes it sends), hsReplay --record adds the other records.
+
+#ifndef _HSCAPTURE_H
+#define _HSCAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace hs {
+
+const uint8_t CAP_VERSION = 1;
+
+enum CaptureType {
+	cap_rx = 1,
+	cap_i2c,
+	cap_latch
+};
+
+class Capture {
+public:
+	struct Record {
+		uint8_t type;					// CaptureType
+		uint32_t timeUs;
+		std::vector<uint8_t> data;
+	};
+
+	void clear(void) { mRecords.clear(); }
+	void add(uint8_t type, uint32_t timeUs, const uint8_t *data, size_t len);
+	// Records of one type, in order
+	std::vector<const Record *> select(uint8_t type) const;
+
+	bool load(const char *path);
+	bool save(const char *path) const;
+
+	const std::vector<Record> &records(void) const { return mRecords; }
+
+private:
+	std::vector<Record> mRecords;
+};
+
+} // namespace hs
+
+#endif
@@ -0,0 +1,304 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host client library
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "hsClient.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace hs {
+
+/* -------------------------------------------------------------------------- */
+/* | SerialPort																| */
+/* -------------------------------------------------------------------------- */
+static speed_t baudConstant(unsigned long baud)
+{
+	switch(baud) {
+		case 9600:		return B9600;
+		case 19200:		return B19200;
+		case 38400:		return B38400;
+		case 57600:		return B57600;
+		case 115200:	return B115200;
+		case 230400:	return B230400;
+#ifdef B460800
+		case 460800:	return B460800;
+#endif
+#ifdef B921600
+		case 921600:	return B921600;
+#endif
+		default:		return B0;
+	}
+}
+
+bool SerialPort::open(const char *path, unsigned long baud)
+{
+	speed_t speed = baudConstant(baud);
+	if(speed == B0) return false;
+	
+	close();
+	mFd = ::open(path, O_RDWR | O_NOCTTY);
+	if(mFd < 0) return false;
+	
+	struct termios t;
+	if(tcgetattr(mFd, &t) != 0) {
+		close();
+		return false;
+	}
+	cfmakeraw(&t);
+	t.c_cflag |= CLOCAL | CREAD;
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 0;
+	cfsetispeed(&t, speed);
+	cfsetospeed(&t, speed);
+	if(tcsetattr(mFd, TCSANOW, &t) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void SerialPort::close(void)
+{
+	if(mFd >= 0) ::close(mFd);
+	mFd = -1;
+}
+
+bool SerialPort::write(const uint8_t *data, size_t len)
+{
+	while(len > 0) {
+		ssize_t n = ::write(mFd, data, len);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+int SerialPort::read(uint8_t *data, size_t len, uint32_t timeoutUs)
+{
+	struct pollfd p = { mFd, POLLIN, 0 };
+	int r = ::poll(&p, 1, (int)((timeoutUs + 999) / 1000));
+	if(r < 0) return (errno == EINTR) ? 0 : -1;
+	if(r == 0) return 0;
+	ssize_t n = ::read(mFd, data, len);
+	if(n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	return (int)n;
+}
+
+uint64_t SerialPort::nowUs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* -------------------------------------------------------------------------- */
+/* | Client																	| */
+/* -------------------------------------------------------------------------- */
+Client::Client(Transport &link, const Options &o)
+	: mLink(link), mOpt(o), mStats(), mNext(0), mRestart(true), mUnsent(0), mProgress(0),
+	  mCaptureStart(0)
+{
+	if(mOpt.window == 0) mOpt.window = 1;
+	if(mOpt.window > WINDOW_MAX) mOpt.window = WINDOW_MAX;
+	if(mOpt.batch == 0) mOpt.batch = 1;
+}
+
+void Client::begin(void)
+{
+	mFlight.clear();
+	mUnsent = 0;
+	mRestart = true;
+	mReply.clear();
+	mCaptureStart = mLink.nowUs();
+}
+
+bool Client::sendPairs(const uint8_t (*pairs)[2], uint8_t n, int32_t time)
+{
+	if(n > COORD_MAX) return false;
+	return queue(n, &pairs[0][0], 2 * n, time);
+}
+
+bool Client::sendBitmap(const uint8_t *bitmap, uint8_t len, int32_t time)
+{
+	return queue(SCMD_BITMAP, bitmap, len, time);
+}
+
+bool Client::sendAllOff(int32_t time)
+{
+	return queue(SCMD_STOP, NULL, 0, time);
+}
+
+// Build the frame (START SEQ seq [TIMED time] marker body STOP) once room is
+// left in the window. A full window waits for room for a whole batch, so
+// that the next frames are written together again.
+bool Client::queue(uint8_t marker, const uint8_t *body, uint8_t len, int32_t time)
+{
+	uint64_t deadline = mLink.nowUs() + 20 * (uint64_t)mOpt.timeoutUs;
+	if(mFlight.size() >= mOpt.window) {
+		size_t room = (mOpt.batch < mOpt.window) ? mOpt.batch : mOpt.window;
+		while(mFlight.size() > mOpt.window - room) {
+			if(!poll(mOpt.timeoutUs) || mLink.nowUs() > deadline) return false;
+		}
+	}
+	
+	Frame f;
+	f.seq = mNext;
+	f.timed = (time >= 0);
+	f.bytes.push_back(SCMD_START);
+	f.bytes.push_back(SCMD_SEQ);
+	f.bytes.push_back(mRestart ? (mNext | SEQ_RESTART) : mNext);
+	if(f.timed) {
+		f.bytes.push_back(SCMD_TIMED);
+		f.bytes.push_back((uint8_t)time);
+		f.bytes.push_back((uint8_t)(time >> 8));
+	}
+	f.bytes.push_back(marker);
+	if(marker != SCMD_STOP) {
+		f.bytes.insert(f.bytes.end(), body, body + len);
+		f.bytes.push_back(SCMD_STOP);
+	}
+	mFlight.push_back(f);
+	mUnsent += 1;
+	mNext = (mNext + 1) & SEQ_MASK;
+	mRestart = false;
+	mStats.frames += 1;
+	
+	return writeOut(false);
+}
+
+// Write the frames not sent yet in one go: at once while none is in flight,
+// else once a batch is gathered (or the window is full)
+bool Client::writeOut(bool force)
+{
+	if(mUnsent == 0) return true;
+	if(!force && (mUnsent < mFlight.size()) && (mUnsent < mOpt.batch) && (mFlight.size() < mOpt.window)) {
+		return true;
+	}
+	std::vector<uint8_t> out;
+	for(size_t i = mFlight.size() - mUnsent; i < mFlight.size(); i++) {
+		out.insert(out.end(), mFlight[i].bytes.begin(), mFlight[i].bytes.end());
+	}
+	mUnsent = 0;
+	mProgress = mLink.nowUs();
+	mStats.writes += 1;
+	if(mOpt.capture) mOpt.capture->add(cap_rx, (uint32_t)(mProgress - mCaptureStart), &out[0], out.size());
+	return mLink.write(&out[0], out.size());
+}
+
+bool Client::poll(uint32_t timeoutUs)
+{
+	if(!writeOut(false)) return false;
+	
+	uint8_t buf[256];
+	int n = mLink.read(buf, sizeof(buf), timeoutUs);
+	if(n < 0) return false;
+	for(int i = 0; i < n; i++) {
+		if(buf[i] == SERR_CRLF) {
+			if(!mReply.empty()) reply(&mReply[0], mReply.size());
+			mReply.clear();
+		} else if(mReply.size() < 64) {
+			mReply.push_back(buf[i]);
+		}
+	}
+	
+	// Nothing acknowledged for too long: the frames or the answer got lost
+	if(!mFlight.empty() && (mUnsent < mFlight.size()) &&
+	   (mLink.nowUs() - mProgress > mOpt.timeoutUs)) {
+		mStats.timeouts += 1;
+		resendFrom(mFlight.front().seq);
+	}
+	return writeOut(false);
+}
+
+bool Client::flush(uint32_t timeoutUs)
+{
+	uint64_t deadline = mLink.nowUs() + timeoutUs;
+	if(!writeOut(true)) return false;
+	while(!mFlight.empty()) {
+		if(mLink.nowUs() > deadline) return false;
+		if(!poll(1000)) return false;
+	}
+	return true;
+}
+
+// One reply, without its SERR_CRLF. Untracked ones (SERR_NOERROR, reports)
+// are ignored.
+void Client::reply(const uint8_t *r, size_t len)
+{
+	if(len == 1 && r[0] == SERR_SETTINGS) {
+		mStats.settingsErrors += 1;
+		return;
+	}
+	if(len != 2 || r[1] > SEQ_MASK) return;
+	switch(r[0]) {
+		case SERR_ACK:
+		acknowledge(r[1]);
+		break;
+		case SERR_MISMATCH:
+		mStats.naks += 1;
+		acknowledge(r[1]);
+		resendFrom(r[1]);
+		break;
+		// the master applied the valid pairs and goes on with the next
+		// frame: sending it again would not help, SERR_ACK releases it
+		case SERR_COORD:
+		mStats.coordErrors += 1;
+		break;
+	}
+}
+
+// Every frame before sequence number expected is accepted
+void Client::acknowledge(uint8_t expected)
+{
+	if(mFlight.empty()) return;
+	size_t n = (expected - mFlight.front().seq) & SEQ_MASK;
+	if(n > mFlight.size() - mUnsent) return;		// stale or unknown
+	for(size_t i = 0; i < n; i++) {
+		mFlight.pop_front();
+		mStats.acked += 1;
+	}
+	if(n > 0) mProgress = mLink.nowUs();
+}
+
+// Send the frames again from sequence number seq on (go-back-n)
+void Client::resendFrom(uint8_t seq)
+{
+	size_t written = mFlight.size() - mUnsent;
+	for(size_t i = 0; i < written; i++) {
+		if(mFlight[i].seq != seq) continue;
+		mStats.resent += written - i;
+		mUnsent = mFlight.size() - i;
+		writeOut(true);
+		return;
+	}
+}
+
+} // namespace hs
@@ -0,0 +1,165 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host client library
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Host side of the HSoundplane serial protocol: sequenced frames
+// (SCMD_START SCMD_SEQ seq [SCMD_TIMED time(2)] n ... SCMD_STOP), up to a
+// window of them in flight, written at once while the link is idle, else in
+// batches gathered until the acknowledgements come, acknowledged by the master
+// with SERR_ACK (next sequence number expected). Frames are sent again from
+// the one the master asks for (SERR_MISMATCH seq: lost or corrupted on the
+// way) or, without answer, after a timeout (go-back-n). A frame with a bad
+// coordinate (SERR_COORD seq) is counted, not sent again: the master applied
+// its valid pairs. Replies to report commands are not parsed: only frames and
+// setting commands go through the client.
+
+#ifndef _HSCLIENT_H
+#define _HSCLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "hsCapture.h"
+
+namespace hs {
+
+/* -------------------------------------------------------------------------- */
+/* | protocol																| */
+/* -------------------------------------------------------------------------- */
+// Mirrors masterSettings.h
+const uint8_t SCMD_START = 253;
+const uint8_t SCMD_STOP = 255;
+const uint8_t SCMD_BITMAP = 254;
+const uint8_t SCMD_TIMED = 252;
+const uint8_t SCMD_SEQ = 251;
+const uint8_t SERR_NOERROR = 0;
+const uint8_t SERR_MISMATCH = 1;
+const uint8_t SERR_COORD = 2;
+const uint8_t SERR_SETTINGS = 3;
+const uint8_t SERR_ACK = 4;
+const uint8_t SERR_CRLF = 255;
+const uint8_t SEQ_MASK = 0x7F;
+const uint8_t SEQ_RESTART = 0x80;
+const uint8_t COORD_MAX = 16;			// HS_COORD_MAX
+const uint8_t WINDOW_MAX = 63;			// less than half the sequence numbers
+
+/* -------------------------------------------------------------------------- */
+/* | Transport																| */
+/* -------------------------------------------------------------------------- */
+// Byte link to the master: a serial port, or a stand-in for tests
+class Transport {
+public:
+	virtual ~Transport() {}
+	virtual bool write(const uint8_t *data, size_t len) = 0;
+	// bytes received, waiting at most timeoutUs for the first one (0 -> none, < 0 -> error)
+	virtual int read(uint8_t *data, size_t len, uint32_t timeoutUs) = 0;
+	virtual uint64_t nowUs(void) = 0;
+};
+
+// POSIX serial port (or pty), raw 8N1
+class SerialPort : public Transport {
+public:
+	SerialPort() : mFd(-1) {}
+	~SerialPort() { close(); }
+	bool open(const char *path, unsigned long baud = 230400);
+	void close(void);
+	bool write(const uint8_t *data, size_t len);
+	int read(uint8_t *data, size_t len, uint32_t timeoutUs);
+	uint64_t nowUs(void);
+
+private:
+	int mFd;
+};
+
+/* -------------------------------------------------------------------------- */
+/* | Client																	| */
+/* -------------------------------------------------------------------------- */
+class Client {
+public:
+	struct Options {
+		uint8_t window;					// frames in flight, at most (1 -> stop-and-wait)
+		uint8_t batch;					// frames gathered while others are in flight
+		uint32_t timeoutUs;				// send again if nothing was acknowledged meanwhile
+		Capture *capture;				// records every write (cap_rx), from begin()
+		Options() : window(8), batch(4), timeoutUs(50000), capture(NULL) {}
+	};
+	struct Stats {
+		uint32_t frames;				// frames queued
+		uint32_t acked;
+		uint32_t resent;				// frames sent again
+		uint32_t naks;					// SERR_MISMATCH seq received
+		uint32_t coordErrors;			// SERR_COORD seq received (frames not sent again)
+		uint32_t settingsErrors;		// SERR_SETTINGS received
+		uint32_t timeouts;
+		uint32_t writes;				// transport writes
+	};
+
+	Client(Transport &link, const Options &o = Options());
+
+	// Restart the sequence numbers: the next frame is accepted whatever the
+	// master expected
+	void begin(void);
+
+	// Queue a frame, waiting for room in the window. pairs: n (col, row) or
+	// setting commands (n <= COORD_MAX); bitmap: HS_BITMAP_BYTES bytes.
+	// time: SCMD_TIMED frame clock units, or -1 for an untimed frame.
+	bool sendPairs(const uint8_t (*pairs)[2], uint8_t n, int32_t time = -1);
+	bool sendBitmap(const uint8_t *bitmap, uint8_t len, int32_t time = -1);
+	bool sendAllOff(int32_t time = -1);
+
+	// Write the batch, read the replies, send again what needs it
+	bool poll(uint32_t timeoutUs = 0);
+	// ...until every frame is acknowledged (false on timeout or link error)
+	bool flush(uint32_t timeoutUs = 1000000);
+
+	uint8_t inFlight(void) const { return (uint8_t)mFlight.size(); }
+	const Stats &stats(void) const { return mStats; }
+
+private:
+	struct Frame {
+		uint8_t seq;
+		bool timed;
+		std::vector<uint8_t> bytes;
+	};
+
+	bool queue(uint8_t marker, const uint8_t *body, uint8_t len, int32_t time);
+	bool writeOut(bool force);
+	void reply(const uint8_t *r, size_t len);
+	void acknowledge(uint8_t expected);
+	void resendFrom(uint8_t seq);
+
+	Transport &mLink;
+	Options mOpt;
+	Stats mStats;
+	uint8_t mNext;						// sequence number of the next frame
+	bool mRestart;						// next frame restarts the count
+	std::deque<Frame> mFlight;			// sent (or batched), not acknowledged yet
+	size_t mUnsent;						// frames of mFlight not written yet (the last ones)
+	uint64_t mProgress;					// nowUs() of the last acknowledgement or send
+	uint64_t mCaptureStart;				// nowUs() of begin()
+	std::vector<uint8_t> mReply;		// reply being received (up to SERR_CRLF)
+};
+
+} // namespace hs
+
+#endif
@@ -67,7 +67,8 @@
 #define GO						(1 << 0)
 
 // Register 0x03 to 0x0A (Waveform sequencer)
-// ...TBD
+// IDs (1 to 127) of the RAM waveforms played in turn on GO, a 0 ends the sequence
+#define WAV_FRM_ID_MAX			127
 
 // Register 0x0B (FIFO)
 #define FIFODATA_7				(1 << 7)
@@ -79,6 +80,10 @@
 #define FIFODATA_1				(1 << 1)
 #define FIFODATA_0				(1 << 0)
 
+// FIFO playback (digital mode, starts with the first byte written)
+#define DRV2667_FIFO_SIZE		100			// bytes
+#define DRV2667_FIFO_RATE		8000		// samples (signed bytes) per second
+
 // Register 0xFF (Page)
 #define PAGE_7					(1 << 7)
 #define PAGE_6					(1 << 6)
@@ -89,4 +94,15 @@
 #define PAGE_1					(1 << 1)
 #define PAGE_0					(1 << 0)
 
+// Waveform RAM (pages 1 to 8). The page register stays at 0xFF on every page,
+// so waveforms are only placed at 0x00 to 0xFE. Linear RAM address: bits 10:8
+// -> page - 1, bits 7:0 -> register.
+#define DRV2667_RAM_PAGE		1			// first RAM page (holds the header)
+#define DRV2667_RAM_PAGES		8
+#define WAV_HDR_BYTES			5			// header: size (0x00), then per waveform ID:
+											// start hi, start lo, stop hi, stop lo, repeat
+#define WAV_HDR_SYNTH			(1 << 7)	// start hi: synthesizer mode
+#define WAV_SYN_BYTES			4			// synthesizer entry: amplitude, frequency
+											// (7.8125 Hz steps), cycles, envelope
+
 #endif
@@ -0,0 +1,165 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane library
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of 
+//  this software and associated documentation files (the "Software"), to deal in 
+//  the Software without restriction, including without limitation the rights to use, 
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+//  Software, and to permit persons to whom the Software is furnished to do so, 
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all 
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _HSTRACE_H
+#define _HSTRACE_H
+
+#include "hsTraceEvents.h"
+
+// Deferred binary trace. The hot paths (ISRs included) only store a fixed
+// size event in a ring, loop() sends the events in its idle time: as binary
+// records for the host decoder (simulation/tools/hsTraceDecode), or as text.
+// The firmware defines HS_TRACE_SIZE before the include, and the ring hsTraceBuf.
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | MACROS																	| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+#ifndef HS_TRACE_SIZE
+#define HS_TRACE_SIZE		16			// events in the ring (power of 2, <= 128)
+#endif
+#define HS_TRACE_MASK		(HS_TRACE_SIZE - 1)
+#define HS_TRACE_TEXT		40			// tx buffer room needed to print an event
+#define HS_TRACE_RESERVE	16			// tx buffer room left to the replies
+
+#if((HS_TRACE_SIZE & HS_TRACE_MASK) != 0) || (HS_TRACE_SIZE > 128)
+#error HS_TRACE_SIZE must be a power of 2 (<= 128)
+#endif
+
+// Producers run in loop() and in ISRs: an event is stored with the
+// interrupts masked for a few cycles, the consumer (loop) needs no lock.
+#if defined(__AVR__)
+#define HS_TRACE_LOCK()		uint8_t hsTraceSreg = SREG; cli()
+#define HS_TRACE_UNLOCK()	SREG = hsTraceSreg
+#else
+#define HS_TRACE_LOCK()		noInterrupts()
+#define HS_TRACE_UNLOCK()	interrupts()
+#endif
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | VARIABLES																| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+struct hsTraceEvent {
+	uint8_t id;							// hsTraceId
+	uint8_t a;
+	uint16_t b;
+	uint32_t t;							// micros()
+};
+struct hsTraceRing {
+	volatile uint8_t head;				// next event to store (producers)
+	volatile uint8_t tail;				// next event to send (consumer)
+	volatile uint8_t lost;				// events dropped on a full ring
+	bool on;							// events are recorded
+	struct hsTraceEvent ev[HS_TRACE_SIZE];
+};
+
+#define HS_TRACE_NAMES(id, name, fmt)	name,
+const char hsTraceNames[][HS_TRACE_NAME] PROGMEM = { HS_TRACE_EVENTS(HS_TRACE_NAMES) };
+#undef HS_TRACE_NAMES
+
+extern struct hsTraceRing hsTraceBuf;
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | FUNCTIONS																| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Store an event (dropped and counted if the ring is full). The count goes
+// into the ring as a trc_lost event ahead of the next stored one, so that
+// the events stay in order.
+inline void hsTrace(uint8_t id, uint8_t a, uint16_t b)
+{
+	if(!hsTraceBuf.on) return;
+	uint32_t t = micros();
+	
+	HS_TRACE_LOCK();
+	uint8_t h = hsTraceBuf.head;
+	uint8_t room = HS_TRACE_SIZE - (uint8_t)(h - hsTraceBuf.tail);
+	if(room > ((hsTraceBuf.lost > 0) ? 1 : 0)) {
+		struct hsTraceEvent *e;
+		if(hsTraceBuf.lost > 0) {
+			e = &hsTraceBuf.ev[h & HS_TRACE_MASK];
+			e->id = trc_lost;
+			e->a = hsTraceBuf.lost;
+			e->b = 0;
+			e->t = t;
+			hsTraceBuf.lost = 0;
+			h++;
+		}
+		e = &hsTraceBuf.ev[h & HS_TRACE_MASK];
+		e->id = id;
+		e->a = a;
+		e->b = b;
+		e->t = t;
+		hsTraceBuf.head = h + 1;
+	} else if(hsTraceBuf.lost < 0xFF) {
+		hsTraceBuf.lost += 1;
+	}
+	HS_TRACE_UNLOCK();
+}
+
+// Start / stop recording, the pending events are dropped
+inline void hsTraceEnable(bool on)
+{
+	HS_TRACE_LOCK();
+	hsTraceBuf.on = on;
+	hsTraceBuf.tail = hsTraceBuf.head;
+	hsTraceBuf.lost = 0;
+	HS_TRACE_UNLOCK();
+}
+
+// Send the pending events while the serial tx buffer has room for them
+// (never blocks): binary records, or "@t name a b" lines
+inline void hsTraceDrain(bool text)
+{
+	uint8_t room = text ? HS_TRACE_TEXT : (HS_TRACE_RECORD + HS_TRACE_RESERVE);
+	
+	while(Serial.availableForWrite() >= room) {
+		if(hsTraceBuf.tail == hsTraceBuf.head) return;
+		struct hsTraceEvent e = hsTraceBuf.ev[hsTraceBuf.tail & HS_TRACE_MASK];
+		hsTraceBuf.tail += 1;
+		
+		if(text) {
+			Serial.print("@"); Serial.print(e.t, DEC); Serial.print(" ");
+			for(uint8_t i = 0; i < HS_TRACE_NAME; i++) {
+				char c = pgm_read_byte(&hsTraceNames[e.id][i]);
+				if(c == 0) break;
+				Serial.print(c);
+			}
+			Serial.print(" "); Serial.print(e.a, DEC);
+			Serial.print(" "); Serial.println(e.b, DEC);
+		} else {
+			uint8_t rec[HS_TRACE_RECORD] = { HS_TRACE_MARK, e.id, e.a, (uint8_t)e.b, (uint8_t)(e.b >> 8),
+											 (uint8_t)e.t, (uint8_t)(e.t >> 8), (uint8_t)(e.t >> 16),
+											 (uint8_t)(e.t >> 24), 255 };
+			Serial.write(rec, HS_TRACE_RECORD);
+		}
+	}
+}
+
+#endif
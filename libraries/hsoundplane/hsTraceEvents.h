@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane library
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of 
+//  this software and associated documentation files (the "Software"), to deal in 
+//  the Software without restriction, including without limitation the rights to use, 
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+//  Software, and to permit persons to whom the Software is furnished to do so, 
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all 
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _HSTRACEEVENTS_H
+#define _HSTRACEEVENTS_H
+
+// Events of the binary trace (hsTrace.h). Shared with the host decoder, so
+// nothing but plain macros here.
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | MACROS																	| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Serial record: HS_TRACE_MARK id a b(2) t(4) SERR_CRLF, little endian, t in
+// micros() of the board that traced the event
+#define HS_TRACE_MARK		205			// first byte of a trace record
+#define HS_TRACE_RECORD		10			// bytes of a trace record
+#define HS_TRACE_NAME		10			// longest event name + 1
+
+// E(id, name, format): the format takes a then b (one or two %u / %x)
+#define HS_TRACE_EVENTS(E)																\
+	E(trc_lost,		"lost",		"ring full, %u events lost")							\
+	/* master */																		\
+	E(trc_frame,	"frame",	"frame of %u pairs (bitmap: bytes), (superseding << 8 | type) 0x%04x")\
+	E(trc_timed,	"timed",	"timed frame queued (%u waiting), due in %u clock units")\
+	E(trc_cmd,		"cmd",		"command %u, argument %u")								\
+	E(trc_cmdErr,	"cmdErr",	"bad command %u, argument %u")							\
+	E(trc_resync,	"resync",	"bad frame dropped at step %u (hunt, length, body), %u resyncs")\
+	E(trc_coord,	"coord",	"slave %u <- piezo %u")									\
+	E(trc_coordErr,	"coordErr",	"bad coordinate (%u, %u)")								\
+	E(trc_slaveCmd,	"slaveCmd",	"slave %u: (command << 8 | drivers) 0x%04x")			\
+	E(trc_drvReset,	"drvReset",	"slave %u: drivers reset 0x%02x")						\
+	E(trc_drvOn,	"drvOn",	"slave %u: drivers (woken << 8 | configured) 0x%04x")	\
+	E(trc_drvOff,	"drvOff",	"slave %u: drivers standing by 0x%02x")					\
+	E(trc_switch,	"switch",	"i2c switch 0x%02x: (error << 8 | channels) 0x%04x")	\
+	E(trc_drvReg,	"drvReg",	"driver register 0x%02x: (error << 8 | value) 0x%04x")	\
+	E(trc_wave,		"wave",		"waveform %u: (slave << 8 | drivers) 0x%04x")			\
+	E(trc_upload,	"upload",	"waveform %u uploaded: (drivers << 8 | bytes) 0x%04x")	\
+	E(trc_send,		"send",		"slave %u: %u piezo indexes")							\
+	E(trc_image,	"image",	"slave %u: register image (staged %u)")					\
+	E(trc_skip,		"skip",		"slave %u: piezo set unchanged")						\
+	E(trc_written,	"written",	"slave %u: write done, status %u")						\
+	E(trc_notified,	"notified",	"slave 0x%02x: setup notification %u")					\
+	E(trc_slave,	"slave",	"slave %u: state %u (missing, found, reset, ready)")	\
+	/* slave */																			\
+	E(trc_rx,		"rx",		"received command 0x%02x, %u bytes")					\
+	E(trc_rxErr,	"rxErr",	"command 0x%02x: bad piezo / length %u")				\
+	E(trc_notify,	"notify",	"setup notification %u")								\
+	E(trc_request,	"request",	"request served, page 0x%02x")							\
+	E(trc_latch,	"latch",	"set ready (staged %u), %u cycles after reception")
+
+#define HS_TRACE_ID(id, name, fmt)		id,
+enum hsTraceId { HS_TRACE_EVENTS(HS_TRACE_ID) HS_TRACE_IDS };
+#undef HS_TRACE_ID
+
+#endif
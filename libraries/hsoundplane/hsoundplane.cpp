@@ -25,12 +25,42 @@
 //  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
 //  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <SPI.h>
-#include <Wire.h>
-#include "HSoundplane.h"
+#include "hsoundplane.h"
 
 
 struct HSdata HSd;
 
+// Coordinate to piezo mapping table, generated at compile time
+#define HS_MAP_ROW(c) {																	\
+	hsMapEntry(c, 0), hsMapEntry(c, 1), hsMapEntry(c, 2), hsMapEntry(c, 3),				\
+	hsMapEntry(c, 4), hsMapEntry(c, 5), hsMapEntry(c, 6), hsMapEntry(c, 7),				\
+	hsMapEntry(c, 8), hsMapEntry(c, 9), hsMapEntry(c, 10), hsMapEntry(c, 11),			\
+	hsMapEntry(c, 12), hsMapEntry(c, 13), hsMapEntry(c, 14), hsMapEntry(c, 15) }
+
+static_assert(HS_MAP_ROWS == 16, "HS_MAP_ROW() expands 16 rows");
+
+const uint16_t hsPiezoMap[HS_MAP_COLS][HS_MAP_ROWS] PROGMEM = {
+	HS_MAP_ROW(0), HS_MAP_ROW(1), HS_MAP_ROW(2), HS_MAP_ROW(3),
+	HS_MAP_ROW(4), HS_MAP_ROW(5), HS_MAP_ROW(6), HS_MAP_ROW(7),
+	HS_MAP_ROW(8), HS_MAP_ROW(9), HS_MAP_ROW(10), HS_MAP_ROW(11),
+	HS_MAP_ROW(12), HS_MAP_ROW(13), HS_MAP_ROW(14), HS_MAP_ROW(15),
+	HS_MAP_ROW(16), HS_MAP_ROW(17), HS_MAP_ROW(18), HS_MAP_ROW(19),
+	HS_MAP_ROW(20), HS_MAP_ROW(21), HS_MAP_ROW(22), HS_MAP_ROW(23),
+	HS_MAP_ROW(24), HS_MAP_ROW(25), HS_MAP_ROW(26), HS_MAP_ROW(27),
+	HS_MAP_ROW(28), HS_MAP_ROW(29), HS_MAP_ROW(30), HS_MAP_ROW(31)
+#if(HS_MAP_COLS > 32)
+	,
+	HS_MAP_ROW(32), HS_MAP_ROW(33), HS_MAP_ROW(34), HS_MAP_ROW(35),
+	HS_MAP_ROW(36), HS_MAP_ROW(37), HS_MAP_ROW(38), HS_MAP_ROW(39),
+	HS_MAP_ROW(40), HS_MAP_ROW(41), HS_MAP_ROW(42), HS_MAP_ROW(43),
+	HS_MAP_ROW(44), HS_MAP_ROW(45), HS_MAP_ROW(46), HS_MAP_ROW(47),
+	HS_MAP_ROW(48), HS_MAP_ROW(49), HS_MAP_ROW(50), HS_MAP_ROW(51),
+	HS_MAP_ROW(52), HS_MAP_ROW(53), HS_MAP_ROW(54), HS_MAP_ROW(55),
+	HS_MAP_ROW(56), HS_MAP_ROW(57), HS_MAP_ROW(58), HS_MAP_ROW(59),
+	HS_MAP_ROW(60), HS_MAP_ROW(61), HS_MAP_ROW(62), HS_MAP_ROW(63)
+#endif
+};
+
 // Initialize all HSoundplane data...
 void HSInit(void) {
 	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
@@ -43,6 +73,27 @@ void HSInit(void) {
 		HSd.drvBm[i] = 0;
 		HSd.drvOldBm[i] = 0;
 		
+		// Shadow of the committed piezo set (invalid until first sent)
+		for(uint8_t j = 0; j < HS_PIEZO_BYTES; j++) {
+			HSd.piezoShadow[i][j] = 0;
+		}
+		HSd.piezoShadowValid[i] = false;
+		
+		// Piezo set of the bitmap frames
+		for(uint8_t j = 0; j < HS_PIEZO_BYTES; j++) {
+			HSd.piezoBm[i][j] = 0;
+		}
+		
+		// Driver register shadows (unknown until written), waveforms
+		for(uint8_t j = 0; j < HS_DPS; j++) {
+			HSd.drvReg1[i][j] = DRV_REG_UNKNOWN;
+			HSd.drvReg2[i][j] = DRV_REG_UNKNOWN;
+			HSd.drvSeq[i][j] = DRV_REG_UNKNOWN;
+			HSd.drvWaves[i][j] = 0;
+			HSd.waveReq[i][j] = DRV_WAVE_NONE;
+		}
+		HSd.i2cSwitchOpen[i] = 0;			// all channels closed at power-up
+		
 		// 
 		HSd.i2cSlaveAvailable[i] = false;
 		HSd.i2cSlaveSetup[i] = false;
@@ -55,4 +106,8 @@ void HSInit(void) {
 		}
 		HSd.indexCnt[i] = 0;
 	}
-}
\ No newline at end of file
+	for(uint8_t j = 0; j <= HS_BITMAP_BYTES; j++) {
+		HSd.inputBitmap[j] = 0;
+	}
+	HSd.refreshCnt = 0;
+}
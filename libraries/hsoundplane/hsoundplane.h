@@ -36,25 +36,54 @@
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 // HSoundplane characteristics
-#define HS_SLAVE_NUMBER		4			// number of slaves to drive (1 - 4)
+#ifndef HS_COORD_MAX
 #define HS_COORD_MAX		16			// maximal amount of simultaneous coordinate pairs
-#define HS_CPS				8			// number of columns per slave (usually 8)
+#endif
+#define HS_CPS				8			// usual number of columns per slave
 #define HS_DPS				8			// number of drv2667 per slave (usually 8)
 #define HS_PIEZO_MAX		72			// absolute maximum available piezos on a slave
+#define HS_PIEZO_BYTES		((HS_PIEZO_MAX + 7) / 8)	// bytes of a piezo bitmap
 #define HS_9RAW_MODE		0			//
 #define HS_COL_OFFSET		1
-#define HS_COL_NUMBER		30
 
 // I2C addresses
 #define I2C_MASTER_ADDRESS	0x40		// i2c master address
-#define I2C_SLAVE_ADDR1		0x50		// i2c slave1 address
-#define I2C_SLAVE_ADDR2		0x51		// i2c slave2 address
-#define I2C_SLAVE_ADDR3		0x52		// i2c slave3 address
-#define I2C_SLAVE_ADDR4		0x53 		// i2c slave4 address
-#define I2C_SWITCH_ADDR1	0x70		// i2c switch1 address (range: 0x70 - 0x77)
-#define I2C_SWITCH_ADDR2	0x71		// i2c switch2 address
-#define I2C_SWITCH_ADDR3	0x72		// i2c switch3 address
-#define I2C_SWITCH_ADDR4	0x73		// i2c switch4 address
+#define I2C_SLAVE_ADDR_BASE	0x50		// i2c address of slave 1, slave n at base + n - 1
+#define I2C_SWITCH_ADDR_BASE	0x70	// i2c switch address of slave 1 (range: 0x70 - 0x77)
+#define I2C_SLAVE_MAX		8			// slaves with a distinct switch address
+#define I2C_GENERAL_CALL	0x00		// i2c general call (all slaves at once)
+#define I2C_CMD_STAGED		0x80		// flag on i2cCmd_regSet/regImage: hold the new
+										// piezo set until i2cCmd_commit
+#define I2C_LATCH_NONE		0xFFFF		// commit not latched (or not read yet)
+#define I2C_COMMIT_SLOTS	8			// commit -> latch times kept by the slaves, slot =
+										// commit number % I2C_COMMIT_SLOTS
+#define I2C_STATS_COMMITS	7			// statistic of i2cCmd_stats: the commit -> latch times
+										// [us](2 each), by slot
+#define I2C_POLL_LENGTH		4			// reply of a request: own address, worst receive ->
+										// latch [cycles](2), notified since power-up(1)
+#define I2C_SWITCH_UNKNOWN	0x100		// channels of an i2c switch after a failed write
+#define I2C_STATS_RESET		0x80		// flag on the i2cCmd_stats page: clear the counter
+
+// Latency statistics
+#define HS_LAT_BUCKETS		16			// histogram buckets: 0, then [2^(n-1), 2^n), the
+										// last one collecting everything above 2^14
+#define HS_LAT_PAGE			16			// bytes of a statistics page (i2cCmd_stats)
+#define HS_LAT_PAGES		((sizeof(struct hsLatency) + HS_LAT_PAGE - 1) / HS_LAT_PAGE)
+
+// Topology
+// --------
+// One HS_SLAVE(i2c address, i2c switch address, haptic columns) per slave, in
+// their order along the surface. Every per slave array is sized to this table
+// at compile time, the slaves actually answering are registered at startup.
+// A bigger surface only needs a longer table (and HS_MAP_COLS = 64 beyond 32
+// columns).
+#ifndef HS_TOPOLOGY
+#define HS_TOPOLOGY																\
+	HS_SLAVE(I2C_SLAVE_ADDR_BASE + 0, I2C_SWITCH_ADDR_BASE + 0, HS_CPS)			\
+	HS_SLAVE(I2C_SLAVE_ADDR_BASE + 1, I2C_SWITCH_ADDR_BASE + 1, HS_CPS)			\
+	HS_SLAVE(I2C_SLAVE_ADDR_BASE + 2, I2C_SWITCH_ADDR_BASE + 2, HS_CPS)			\
+	HS_SLAVE(I2C_SLAVE_ADDR_BASE + 3, I2C_SWITCH_ADDR_BASE + 3, HS_CPS)
+#endif
 
 // Pinout of the arduino nano on the driver board
 #define LED1_PIN			3			// LED1 -> device started up
@@ -74,6 +103,9 @@
 #define SW_ADDR_1			A2			// i2c switch hardware address bit1
 #define SW_ADDR_2			A3			// i2c switch hardware address bit2
 
+#define DRV_REG_UNKNOWN		0xFF		// register shadow value forcing the next write
+#define DRV_WAVE_NONE		0xFF		// no waveform requested on a driver
+
 #define LED_ON				LOW			// macro to set if LEDs are switched on HIGH or LOW
 #define LED_OFF				HIGH		// and never forget it after that
 
@@ -87,8 +119,25 @@
 // -------------------
 // Commands from master to slave with first byte (below) defining command type
 enum i2cCommand {
-	i2cCmd_regSet,
-	i2cCmd_notify
+	i2cCmd_regSet,			// list of piezo indexes to switch on (1 byte each)
+	i2cCmd_notify,			// setup notification (1 byte: 1 -> OK, 0 -> NOT OK)
+	i2cCmd_regImage,		// shift registers image (HS_PIEZO_BYTES, active low,
+							// byte n -> piezos 8n..8n+7)
+	i2cCmd_stats,			// select the reply of the next request (1 byte: statistic
+							// << 4 | page, I2C_STATS_RESET -> clear the statistic)
+	i2cCmd_commit = 0x08	// general call: latch the staged piezo sets (1 byte: commit
+							// number). Even: a general call byte with its LSB set is
+							// a hardware general call, 0x04 and 0x06 are reserved by
+							// the i2c specification, 0x00 is forbidden
+};
+static_assert(((i2cCmd_commit & 1) == 0) && (i2cCmd_commit != 0x00) && (i2cCmd_commit != 0x04) &&
+	(i2cCmd_commit != 0x06), "i2cCmd_commit must be an even, unreserved general call byte");
+
+// Statistics kept by the slaves (i2cCmd_stats)
+enum hsSlaveStat {
+	hsStat_latch,			// receive -> latch, staged sets: -> ready to latch [cycles]
+	hsStat_commit,			// commit -> latch [us]
+	HS_SLAVE_STATS
 };
 
 /* -------------------------------------------------------------------------- */
@@ -96,21 +145,120 @@ enum i2cCommand {
 /* | VARIABLES																| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-// Array of eight piezo columns (8 x 9) single addressed. To combine: bitwise AND (&)
-// NOTE: works also with 5 piezos connected per raw (master jumps over empty contacts)
-const uint32_t piezoArray1[32] = {
-	0xFFFFFFFE, 0xFFFFFFFD, 0xFFFFFFFB, 0xFFFFFFF7, 0xFFFFFFEF, 0xFFFFFFDF, 0xFFFFFFBF, 0xFFFFFF7F, 0xFFFFFEFF,	// row 1
-	0XFFFFFDFF, 0XFFFFFBFF, 0XFFFFF7FF, 0XFFFFEFFF, 0XFFFFDFFF, 0XFFFFBFFF, 0XFFFF7FFF, 0XFFFEFFFF, 0XFFFDFFFF,	// row 2
-	0XFFFBFFFF, 0XFFF7FFFF, 0XFFEFFFFF, 0XFFDFFFFF, 0XFFBFFFFF, 0XFF7FFFFF, 0XFEFFFFFF, 0XFDFFFFFF, 0XFBFFFFFF,	// row 3
-	0XF7FFFFFF, 0xEFFFFFFF, 0xDFFFFFFF, 0xBFFFFFFF, 0x7FFFFFFF};												// row 4 (5/9)
-const uint32_t piezoArray2[32] = {
-	0xFFFFFFFE, 0xFFFFFFFD, 0xFFFFFFFB, 0xFFFFFFF7,																// raw 4 (4/9)
-	0xFFFFFFEF, 0xFFFFFFDF, 0xFFFFFFBF, 0xFFFFFF7F, 0xFFFFFEFF, 0XFFFFFDFF, 0XFFFFFBFF, 0XFFFFF7FF, 0XFFFFEFFF,	// raw 5
-	0XFFFFDFFF, 0XFFFFBFFF, 0XFFFF7FFF, 0XFFFEFFFF, 0XFFFDFFFF, 0XFFFBFFFF, 0XFFF7FFFF, 0XFFEFFFFF, 0XFFDFFFFF, // raw 6
-	0XFFBFFFFF, 0XFF7FFFFF, 0XFEFFFFFF, 0XFDFFFFFF, 0XFBFFFFFF, 0XF7FFFFFF, 0xEFFFFFFF, 0xDFFFFFFF, 0xBFFFFFFF, // raw 7
-	0x7FFFFFFF};																								// raw 8 (1/9)
-const uint32_t piezoArray3[8] = {
-	0xFFFFFFFE, 0xFFFFFFFD, 0xFFFFFFFB, 0xFFFFFFF7, 0xFFFFFFEF, 0xFFFFFFDF, 0xFFFFFFBF, 0xFFFFFF7F};			// row 8 (8/9)
+// Topology tables
+// ---------------
+// hsTopology is read at run time (flash), hsTopoCols, hsTopoAddr and
+// hsTopoSwitch only at compile time.
+#define HS_SLAVE(addr, sw, cols)	{ (addr), (sw), (cols) },
+const uint8_t hsTopology[][3] PROGMEM = { HS_TOPOLOGY };
+#undef HS_SLAVE
+#define HS_SLAVE(addr, sw, cols)	(cols),
+constexpr uint8_t hsTopoCols[] = { HS_TOPOLOGY };
+#undef HS_SLAVE
+#define HS_SLAVE(addr, sw, cols)	(addr),
+constexpr uint8_t hsTopoAddr[] = { HS_TOPOLOGY };
+#undef HS_SLAVE
+#define HS_SLAVE(addr, sw, cols)	(sw),
+constexpr uint8_t hsTopoSwitch[] = { HS_TOPOLOGY };
+#undef HS_SLAVE
+
+#define HS_SLAVE_NUMBER		(sizeof(hsTopology) / sizeof(hsTopology[0]))	// number of slaves
+
+// Haptic columns of slaves sn and up, slave of a haptic column and column on it
+constexpr uint16_t hsColTotal(uint8_t sn = 0) {
+	return (sn >= HS_SLAVE_NUMBER) ? 0 : hsTopoCols[sn] + hsColTotal(sn + 1);
+}
+constexpr uint8_t hsColSlave(uint16_t col, uint8_t sn = 0) {
+	return (sn >= HS_SLAVE_NUMBER) ? sn : (col < hsTopoCols[sn]) ? sn : hsColSlave(col - hsTopoCols[sn], sn + 1);
+}
+constexpr uint8_t hsColDrv(uint16_t col, uint8_t sn = 0) {
+	return (sn >= HS_SLAVE_NUMBER) ? 0 : (col < hsTopoCols[sn]) ? col : hsColDrv(col - hsTopoCols[sn], sn + 1);
+}
+// i2c address and i2c switch address of slave n (1 - HS_SLAVE_NUMBER, 0xFF otherwise)
+constexpr uint8_t hsTopoSlaveAddr(uint8_t n) {
+	return ((n >= 1) && (n <= HS_SLAVE_NUMBER)) ? hsTopoAddr[n - 1] : 0xFF;
+}
+constexpr uint8_t hsTopoSwitchAddr(uint8_t n) {
+	return ((n >= 1) && (n <= HS_SLAVE_NUMBER)) ? hsTopoSwitch[n - 1] : 0xFF;
+}
+constexpr bool hsTopoValid(uint8_t sn = 0) {
+	return (sn >= HS_SLAVE_NUMBER) ? true :
+		(hsTopoCols[sn] > 0) && (hsTopoCols[sn] <= HS_DPS) && (hsTopoCols[sn] * 9 <= HS_PIEZO_MAX) && hsTopoValid(sn + 1);
+}
+
+// Last haptic column of the surface (the first and last ones carry audio)
+#define HS_COL_NUMBER		(hsColTotal() - 2)
+
+static_assert((HS_SLAVE_NUMBER > 0) && (HS_SLAVE_NUMBER <= I2C_SLAVE_MAX), "HS_TOPOLOGY: 1 to I2C_SLAVE_MAX slaves");
+static_assert(hsTopoValid(), "HS_TOPOLOGY: the columns of a slave do not fit it");
+
+inline uint8_t hsSlaveAddr(uint8_t sn) { return pgm_read_byte(&hsTopology[sn][0]); }
+inline uint8_t hsSwitchAddr(uint8_t sn) { return pgm_read_byte(&hsTopology[sn][1]); }
+inline uint8_t hsSlaveCols(uint8_t sn) { return pgm_read_byte(&hsTopology[sn][2]); }
+
+// Coordinate to piezo mapping
+// ---------------------------
+// Each host coordinate (column, row) is mapped at compile time to the slave
+// number, the piezo index on that slave (i.e. the bit in the 72-bit shift
+// register image, always 9 per column, unconnected ones being skipped in
+// 5-row mode) and the driver (column of the slave), following the column
+// counts of HS_TOPOLOGY. The table covers
+// HS_MAP_COLS x HS_MAP_ROWS host coordinates, every entry outside of the
+// HSoundplane being HS_MAP_INVALID, and lives in flash.
+#define HS_ROWS				((HS_9RAW_MODE > 0) ? 9 : 5)	// piezos per column
+#ifndef HS_MAP_COLS
+#define HS_MAP_COLS			32			// host columns covered by the table (32 or 64)
+#endif
+#define HS_MAP_ROWS			16			// host rows covered by the table (power of 2)
+#define HS_MAP_INVALID		0xFFFF		// coordinate outside of the HSoundplane
+
+#define HS_MAP_PIEZO(m)		((uint8_t)((m) & 0x7F))			// piezo index on the slave
+#define HS_MAP_DRV(m)		((uint8_t)(((m) >> 8) & 0x07))	// driver number on the slave
+#define HS_MAP_SLAVE(m)		((uint8_t)((m) >> 11))			// slave number
+
+// Haptic column of a host column. Note that coordinate system of the
+// HSoundplane is a bit error generating:
+// - Soundplane input example:		(6, 3)
+// - HSoundplane coordinate:		(7, 3)
+// - Corresponding audio channel:	8
+// This is due to the fact that the 4 haptic slaves are made of 8 channels each,
+// with first (0) and last (31) one are used for audio purpose. That means that
+// the Soundplane columns 0 to 29 correspond to the haptic columns 1 to 30, on
+// audio channels 2 to 31!
+constexpr uint16_t hsMapCol(uint8_t col) {
+	return (uint16_t)col + HS_COL_OFFSET;
+}
+constexpr uint16_t hsMapPiezo(uint8_t col, uint8_t row) {
+	return (hsColDrv(hsMapCol(col)) * 9) + ((HS_9RAW_MODE > 0) ? row : (row * 2));
+}
+constexpr uint16_t hsMapEntry(uint8_t col, uint8_t row) {
+	return ((hsMapCol(col) > HS_COL_NUMBER) || (row >= HS_ROWS)) ? HS_MAP_INVALID :
+		(uint16_t)((hsColSlave(hsMapCol(col)) << 11) | (hsColDrv(hsMapCol(col)) << 8) | hsMapPiezo(col, row));
+}
+
+static_assert((HS_MAP_COLS == 32) || (HS_MAP_COLS == 64), "HS_MAP_COLS: 32 or 64");
+static_assert((HS_COL_NUMBER - HS_COL_OFFSET) < HS_MAP_COLS, "hsPiezoMap too narrow for HS_COL_NUMBER");
+static_assert(HS_ROWS <= HS_MAP_ROWS, "hsPiezoMap too short for HS_9RAW_MODE");
+
+extern const uint16_t hsPiezoMap[HS_MAP_COLS][HS_MAP_ROWS] PROGMEM;
+
+// Full-surface bitmap frames: host column c, row r is bit (c * HS_ROWS + r)
+// of the bitmap, LSB first. A column lands on the 9 piezos of its driver as a
+// whole, spread to the even ones in 5-row mode (hsRowSpread).
+#define HS_BITMAP_COLS		(HS_COL_NUMBER - HS_COL_OFFSET + 1)			// host columns
+#define HS_BITMAP_BYTES		((HS_BITMAP_COLS * HS_ROWS + 7) / 8)		// 19 (5 rows) or 34 (9 rows)
+static_assert(HS_ROWS <= 9, "a bitmap column must fit 2 bytes at any bit offset");
+
+// Single bit masks, to avoid variable shifts on the AVR
+const uint8_t hsBit[8] PROGMEM = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+
+// 5 rows of a bitmap column to the piezos of the driver (rows 0, 2, 4, 6, 8)
+const uint16_t hsRowSpread[32] PROGMEM = {
+	0x000, 0x001, 0x004, 0x005, 0x010, 0x011, 0x014, 0x015,
+	0x040, 0x041, 0x044, 0x045, 0x050, 0x051, 0x054, 0x055,
+	0x100, 0x101, 0x104, 0x105, 0x110, 0x111, 0x114, 0x115,
+	0x140, 0x141, 0x144, 0x145, 0x150, 0x151, 0x154, 0x155
+};
 
 
 typedef struct HSdata {
@@ -127,32 +275,47 @@ typedef struct HSdata {
 	bool drvOffAll[HS_SLAVE_NUMBER];				// drivers OFF (all) command for each slave
 	uint8_t drvOn[HS_SLAVE_NUMBER];					// driver ON command for each slave
 	uint8_t drvOff[HS_SLAVE_NUMBER];				// driver OFF command for each slave
+	uint8_t waveReq[HS_SLAVE_NUMBER][HS_DPS];		// waveform to play on each driver (or DRV_WAVE_NONE)
 	
 	// data arrays...
 	uint8_t inputCoord[HS_COORD_MAX][2];				// input HS coordinates send from computer to master
+	uint8_t inputBitmap[HS_BITMAP_BYTES + 1];			// input bitmap frame (+1 spare byte, always 0)
 	uint8_t outputIndex[HS_SLAVE_NUMBER][HS_COORD_MAX];	// output HS piezo indexes for each slave
 	uint8_t indexCnt[HS_SLAVE_NUMBER];					// piezo index counter for each slave
 	uint8_t drvBm[HS_SLAVE_NUMBER];						// driver bit mask for each slave
 	uint8_t drvOldBm[HS_SLAVE_NUMBER];					// previous driver bit mask
+	uint8_t piezoShadow[HS_SLAVE_NUMBER][HS_PIEZO_BYTES];	// last piezo set committed to each slave (bitmap)
+	uint8_t piezoBm[HS_SLAVE_NUMBER][HS_PIEZO_BYTES];		// piezo set of each slave (bitmap frames)
+	bool piezoShadowValid[HS_SLAVE_NUMBER];				// shadow matches the slave's registers
+	uint16_t refreshCnt;								// frames since the last full refresh
 
-	// i2c variables...
-	int8_t i2cSlaveAddress[HS_SLAVE_NUMBER] = {		// slave i2c addresses array
-		I2C_SLAVE_ADDR1,
-		I2C_SLAVE_ADDR2,
-		I2C_SLAVE_ADDR3,
-		I2C_SLAVE_ADDR4
-	};
-	int8_t i2cSwitchAddress[HS_SLAVE_NUMBER] = {	// i2c switch addresses array
-		I2C_SWITCH_ADDR1,
-		I2C_SWITCH_ADDR2,
-		I2C_SWITCH_ADDR3,
-		I2C_SWITCH_ADDR4
-	};
+	// i2c variables (addresses: hsSlaveAddr() / hsSwitchAddr())...
+	uint8_t drvReg1[HS_SLAVE_NUMBER][HS_DPS];		// shadow of the drv2667 control 1 registers
+	uint8_t drvReg2[HS_SLAVE_NUMBER][HS_DPS];		// shadow of the drv2667 control 2 registers
+	uint8_t drvSeq[HS_SLAVE_NUMBER][HS_DPS];		// shadow of the first sequencer register
+	uint8_t drvWaves[HS_SLAVE_NUMBER][HS_DPS];		// waveforms resident in the drv2667 RAM (bit mask)
+	uint16_t i2cSwitchOpen[HS_SLAVE_NUMBER];		// open channels of each i2c switch (or I2C_SWITCH_UNKNOWN)
 	bool i2cSlaveAvailable[HS_SLAVE_NUMBER];		// slave availability flags
 	uint8_t i2cSlaveSetup[HS_SLAVE_NUMBER];			// slave correctly set up (bit mask for each driver)
 };
 
 
+// Latency statistic of a processing stage: min / max / mean and a log2
+// histogram. Stored as is in the pages of the i2cCmd_stats replies, both
+// sides being little endian.
+struct hsLatency {
+	uint32_t count;									// samples
+	uint32_t sum;									// sum of the samples
+	uint16_t min;
+	uint16_t max;
+	uint16_t hist[HS_LAT_BUCKETS];					// samples per bucket (saturating)
+};
+
+static_assert(sizeof(struct hsLatency) == 12 + 2 * HS_LAT_BUCKETS, "hsLatency must not be padded");
+static_assert((2 * I2C_COMMIT_SLOTS) <= HS_LAT_PAGE, "the commit slots must fit an i2cCmd_stats page");
+static_assert((I2C_STATS_COMMITS >= HS_SLAVE_STATS) && (I2C_STATS_COMMITS < 8), "I2C_STATS_COMMITS: a free statistic number");
+
+
 // extern...
 extern bool debug;
 extern SPISettings settingsA;
@@ -164,4 +327,39 @@ extern SPISettings settingsA;
 /* -------------------------------------------------------------------------- */
 void HSInit(void);
 
+// Latency statistics
+inline void hsLatReset(struct hsLatency *l) {
+	l->count = 0;
+	l->sum = 0;
+	l->min = 0xFFFF;
+	l->max = 0;
+	for(uint8_t i = 0; i < HS_LAT_BUCKETS; i++) l->hist[i] = 0;
+}
+inline void hsLatAdd(struct hsLatency *l, uint32_t v) {
+	uint16_t s = (v < 0xFFFF) ? v : 0xFFFF;
+	uint8_t b = 0;
+	for(uint16_t x = s; (x > 0) && (b < HS_LAT_BUCKETS - 1); x >>= 1) b++;
+	l->count += 1;
+	l->sum += s;
+	if(s < l->min) l->min = s;
+	if(s > l->max) l->max = s;
+	if(l->hist[b] < 0xFFFF) l->hist[b] += 1;
+}
+inline void hsLatMerge(struct hsLatency *l, const struct hsLatency *from) {
+	l->count += from->count;
+	l->sum += from->sum;
+	if(from->min < l->min) l->min = from->min;
+	if(from->max > l->max) l->max = from->max;
+	for(uint8_t i = 0; i < HS_LAT_BUCKETS; i++) {
+		uint32_t n = (uint32_t)l->hist[i] + from->hist[i];
+		l->hist[i] = (n < 0xFFFF) ? n : 0xFFFF;
+	}
+}
+
+// Look up the piezo mapping of a host coordinate (HS_MAP_INVALID if outside)
+inline uint16_t hsPiezoLookup(uint8_t col, uint8_t row) {
+	if((col >= HS_MAP_COLS) || (row >= HS_MAP_ROWS)) return HS_MAP_INVALID;
+	return pgm_read_word(&hsPiezoMap[col][row]);
+}
+
 #endif
@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of HSoundplane library
+//
+//	Works with the following hardware (150415):
+//		- Soundplane piezo-driver v0.95 - R003
+//		- Soundplane piezo-layer v.095 - R006
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of 
+//  this software and associated documentation files (the "Software"), to deal in 
+//  the Software without restriction, including without limitation the rights to use, 
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+//  Software, and to permit persons to whom the Software is furnished to do so, 
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all 
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _DRVWAVES_H
+#define _DRVWAVES_H
+
+#include "hsoundplane.h"
+
+// Waveform library of the drv2667 synthesizer. A waveform is uploaded into
+// the RAM of a driver the first time it is played there, then triggered with
+// a single GO write (see drvPlay()). All waveforms have a fixed header ID
+// (index + 1) and a fixed place in RAM, so they can be made resident in any
+// order and on any subset of the drivers.
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | ENUM																	| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+enum drvWave {
+	wave_click,				// short full scale click
+	wave_tick,				// lighter, higher tick
+	wave_bump,				// low bump with a softer second half
+	wave_buzz,				// 200 ms buzz
+	wave_texture,			// pulse train (rough surface)
+	wave_swell,				// low tone ramping up and down
+	DRV_WAVES
+};
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | VARIABLES																| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Synthesizer entries of all waveforms: amplitude, frequency (7.8125 Hz
+// steps), cycles, envelope (ramp up << 4 | ramp down)
+const uint8_t drvWaveData[] PROGMEM = {
+	0xFF, 32, 2, 0x00,		// wave_click: 250 Hz
+	0x7F, 38, 1, 0x00,		// wave_tick: 297 Hz
+	0xFF, 19, 2, 0x00,		// wave_bump: 148 Hz
+	0x80, 19, 2, 0x00,
+	0xC0, 26, 40, 0x00,		// wave_buzz: 203 Hz
+	0xFF, 32, 1, 0x00,		// wave_texture: 250 Hz on/off, repeated
+	0x00, 32, 1, 0x00,
+	0xFF, 19, 30, 0x55		// wave_swell: 148 Hz
+};
+
+// First byte in drvWaveData, number of synthesizer entries and repeat count
+// (0 -> until the next GO) of each waveform
+const uint8_t drvWaveIndex[DRV_WAVES][3] PROGMEM = {
+	{ 0, 1, 1 },			// wave_click
+	{ 4, 1, 1 },			// wave_tick
+	{ 8, 2, 1 },			// wave_bump
+	{ 16, 1, 1 },			// wave_buzz
+	{ 20, 2, 8 },			// wave_texture
+	{ 28, 1, 1 }			// wave_swell
+};
+
+static_assert(DRV_WAVES <= 8, "drvWaves holds one bit per waveform");
+static_assert(sizeof(drvWaveData) <= 0xFF, "drvWaveIndex offsets are 8 bit");
+static_assert((1 + DRV_WAVES * WAV_HDR_BYTES + sizeof(drvWaveData)) <= 0xFF,
+			  "the waveform library must fit the first RAM page");
+
+#endif
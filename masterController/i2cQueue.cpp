@@ -0,0 +1,286 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of HSoundplane library
+//
+//	Works with the following hardware (150415):
+//		- Soundplane piezo-driver v0.95 - R003
+//		- Soundplane piezo-layer v.095 - R006
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of 
+//  this software and associated documentation files (the "Software"), to deal in 
+//  the Software without restriction, including without limitation the rights to use, 
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+//  Software, and to permit persons to whom the Software is furnished to do so, 
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all 
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <Arduino.h>
+#include "i2cQueue.h"
+
+#if defined(__AVR__)
+#include <avr/interrupt.h>
+#include <util/twi.h>
+#define I2C_QUEUE_WAIT()					// the TWI interrupt updates the status
+#else
+#define I2C_QUEUE_WAIT()	simWaitInterrupt()
+#endif
+
+// Descriptor ring: [qReap, qHead) completed, [qHead, qTail) waiting for the bus
+static struct i2cXfer pool[I2C_QUEUE_SIZE];
+static volatile uint8_t qTail;			// next descriptor to submit
+static volatile uint8_t qHead;			// descriptor on the bus
+static volatile uint8_t qReap;			// oldest descriptor not yet released
+static volatile bool qBusy;
+
+static void portStart(void);
+
+// Called from the interrupt when the transaction on the bus is over
+static void finish(uint8_t status)
+{
+	pool[qHead & I2C_QUEUE_MASK].status = status;
+	qHead++;
+	if(qHead != qTail) portStart();
+	else qBusy = false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | TWI port																| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+#if defined(__AVR__)
+static volatile uint8_t xIndex;			// byte index in the descriptor on the bus
+
+static void portInit(uint32_t clock)
+{
+	// internal pull-ups, no prescaler (as Wire.begin())
+	digitalWrite(SDA, HIGH);
+	digitalWrite(SCL, HIGH);
+	TWSR &= ~(_BV(TWPS0) | _BV(TWPS1));
+	TWBR = ((F_CPU / clock) - 16) / 2;
+	TWCR = _BV(TWEN);
+}
+
+static void portStart(void)
+{
+	xIndex = 0;
+	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWSTA);
+}
+
+static void portStop(void)
+{
+	TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWSTO);
+	while(TWCR & _BV(TWSTO));			// a few us: lets the next START follow
+}
+
+ISR(TWI_vect)
+{
+	struct i2cXfer *x = &pool[qHead & I2C_QUEUE_MASK];
+	
+	switch(TW_STATUS) {
+		case TW_START:
+		case TW_REP_START:
+			TWDR = (x->addr << 1) | ((x->read) ? TW_READ : TW_WRITE);
+			TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+			break;
+		
+		// master transmitter
+		case TW_MT_SLA_ACK:
+		case TW_MT_DATA_ACK:
+			if(xIndex < x->len) {
+				TWDR = x->data[xIndex++];
+				TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+			} else {
+				portStop();
+				finish(I2C_XFER_OK);
+			}
+			break;
+		case TW_MT_SLA_NACK:
+			portStop();
+			finish(I2C_XFER_NACK_ADDR);
+			break;
+		case TW_MT_DATA_NACK:
+			portStop();
+			finish(I2C_XFER_NACK_DATA);
+			break;
+		
+		// master receiver: acknowledge every byte but the last one
+		case TW_MR_DATA_ACK:
+			x->data[xIndex++] = TWDR;
+			// no break
+		case TW_MR_SLA_ACK:
+			TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | (((xIndex + 1) < x->len) ? _BV(TWEA) : 0);
+			break;
+		case TW_MR_DATA_NACK:
+			x->data[xIndex++] = TWDR;
+			portStop();
+			finish(I2C_XFER_OK);
+			break;
+		case TW_MR_SLA_NACK:
+			portStop();
+			finish(I2C_XFER_NACK_ADDR);
+			break;
+		
+		// arbitration lost, bus error
+		default:
+			portStop();
+			finish(I2C_XFER_ERROR);
+			break;
+	}
+}
+#else
+// Host simulation: the simulated bus runs the whole transaction and raises
+// the completion interrupt at its end
+static uint8_t portStatus;
+
+static void portInit(uint32_t clock)
+{
+	simTwiBegin(clock);
+}
+
+static void portDone(void)
+{
+	finish(portStatus);
+}
+
+static void portStart(void)
+{
+	struct i2cXfer *x = &pool[qHead & I2C_QUEUE_MASK];
+	portStatus = simTwiStart(x->addr, x->read, x->data, x->len, portDone);
+}
+#endif
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | i2cQueueBegin															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+void i2cQueueBegin(uint32_t clock)
+{
+	qTail = 0;
+	qHead = 0;
+	qReap = 0;
+	qBusy = false;
+	portInit(clock);
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | i2cQueueAlloc / i2cQueueSubmit											| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Return the next free descriptor, waiting for the bus if the pool is full.
+// Only one descriptor may be allocated at a time: submit it before the next.
+struct i2cXfer *i2cQueueAlloc(void)
+{
+	while((uint8_t)(qTail - qReap) >= I2C_QUEUE_SIZE) {
+		if(i2cQueueService() == 0) I2C_QUEUE_WAIT();
+	}
+	
+	struct i2cXfer *x = &pool[qTail & I2C_QUEUE_MASK];
+	x->read = false;
+	x->len = 0;
+	x->tag = 0;
+	x->done = NULL;
+	x->status = I2C_XFER_PENDING;
+	return x;
+}
+
+// Queue the allocated descriptor, starting the bus if it is idle
+void i2cQueueSubmit(struct i2cXfer *x)
+{
+	(void)x;
+	noInterrupts();
+	qTail++;
+	if(!qBusy) {
+		qBusy = true;
+		portStart();
+	}
+	interrupts();
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | i2cQueueService / i2cQueueIdle											| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Run the completion callbacks of the finished transactions and release their
+// descriptors. Returns the number of released descriptors.
+uint8_t i2cQueueService(void)
+{
+	uint8_t n = 0;
+	
+	while(qReap != qHead) {
+		struct i2cXfer *x = &pool[qReap & I2C_QUEUE_MASK];
+		if(x->done != NULL) x->done(x);
+		qReap++;
+		n++;
+	}
+	return n;
+}
+
+bool i2cQueueIdle(void)
+{
+	return !qBusy;
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | i2cQueueWrite / i2cQueueRead											| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Blocking transactions, executed after the ones already queued.
+// Write returns the transaction status, read the number of bytes received.
+uint8_t i2cQueueWrite(uint8_t addr, const uint8_t *data, uint8_t len)
+{
+	struct i2cXfer *x = i2cQueueAlloc();
+	
+	if(len > I2C_XFER_DATA) len = I2C_XFER_DATA;
+	x->addr = addr;
+	x->len = len;
+	for(uint8_t i = 0; i < len; i++) {
+		x->data[i] = data[i];
+	}
+	i2cQueueSubmit(x);
+	while(x->status == I2C_XFER_PENDING) I2C_QUEUE_WAIT();
+	
+	uint8_t status = x->status;
+	i2cQueueService();
+	return status;
+}
+
+uint8_t i2cQueueRead(uint8_t addr, uint8_t *data, uint8_t len)
+{
+	if(len == 0) return 0;
+	if(len > I2C_XFER_DATA) len = I2C_XFER_DATA;
+	
+	struct i2cXfer *x = i2cQueueAlloc();
+	x->addr = addr;
+	x->read = true;
+	x->len = len;
+	i2cQueueSubmit(x);
+	while(x->status == I2C_XFER_PENDING) I2C_QUEUE_WAIT();
+	
+	if(x->status != I2C_XFER_OK) len = 0;
+	for(uint8_t i = 0; i < len; i++) {
+		data[i] = x->data[i];
+	}
+	i2cQueueService();
+	return len;
+}
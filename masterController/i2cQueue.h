@@ -0,0 +1,87 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of HSoundplane library
+//
+//	Works with the following hardware (150415):
+//		- Soundplane piezo-driver v0.95 - R003
+//		- Soundplane piezo-layer v.095 - R006
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of 
+//  this software and associated documentation files (the "Software"), to deal in 
+//  the Software without restriction, including without limitation the rights to use, 
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the 
+//  Software, and to permit persons to whom the Software is furnished to do so, 
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all 
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _I2CQUEUE_H
+#define _I2CQUEUE_H
+
+#include "hsoundplane.h"
+
+// Interrupt driven i2c master of the master controller. Transactions are
+// described in a fixed pool of descriptors used as a ring: they are submitted,
+// put on the bus by the TWI interrupt and released in the same order.
+// It owns the TWI vector, so the master must not use the Wire library.
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | MACROS																	| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+#define I2C_QUEUE_SIZE		8			// number of descriptors (power of 2)
+#define I2C_QUEUE_MASK		(I2C_QUEUE_SIZE - 1)
+#define I2C_XFER_DATA		(HS_COORD_MAX + 1)	// largest payload: command + index list
+
+// Transaction status (same codes as Wire.endTransmission())
+#define I2C_XFER_OK			0			// success
+#define I2C_XFER_NACK_ADDR	2			// address not acknowledged
+#define I2C_XFER_NACK_DATA	3			// data not acknowledged
+#define I2C_XFER_ERROR		4			// bus error / arbitration lost
+#define I2C_XFER_PENDING	0xFF		// queued or on the bus
+
+#if((I2C_QUEUE_SIZE & I2C_QUEUE_MASK) != 0)
+#error I2C_QUEUE_SIZE must be a power of 2
+#endif
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | VARIABLES																| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+struct i2cXfer {
+	uint8_t addr;						// 7-bit slave address
+	bool read;							// false -> write data, true -> read into data
+	uint8_t len;						// payload length
+	uint8_t data[I2C_XFER_DATA];
+	uint16_t tag;						// free for the completion callback
+	void (*done)(struct i2cXfer *x);	// completion callback (called from loop), or NULL
+	volatile uint8_t status;			// I2C_XFER_xxx
+};
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | FUNCTIONS																| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+void i2cQueueBegin(uint32_t clock);
+struct i2cXfer *i2cQueueAlloc(void);
+void i2cQueueSubmit(struct i2cXfer *x);
+uint8_t i2cQueueService(void);
+bool i2cQueueIdle(void);
+uint8_t i2cQueueWrite(uint8_t addr, const uint8_t *data, uint8_t len);
+uint8_t i2cQueueRead(uint8_t addr, uint8_t *data, uint8_t len);
+#endif
@@ -25,19 +25,14 @@
 //  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
 //  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
-#include <Wire.h>
 #include <SPI.h>
 #include <String.h>
 #include "hsoundplane.h"
+#include "i2cQueue.h"
+#include "drvWaves.h"
 #include "masterSettings.h"
 
 
-bool cmdByteOne = false;
-bool cmdZeroLen = false;
-int8_t cmdLength;
-int8_t cmdIndexCnt;
-
-
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 /* | setup																	| */
@@ -58,14 +53,17 @@ void setup()
 
 	// Initialize HSoundplane variables...
 	HSInit();
-	
-	// Wait a bit to let the slaves starting up...
-	delay(STARTUP_WAIT_MS);
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		slaveSt.state[i] = slave_missing;
+		slaveSt.pollCycles[i] = 0;
+	}
+	drvPw.hold = DRV_POWER_HOLD_MS;
+	drvPw.ahead = true;
 	
 	// Set up communication...
 	Serial.begin(SERIAL_SPEED);
-	Wire.begin(); // Start i2c
-	if(i2cFastMode) Wire.setClock(400000);
+	serialSt.since = millis();
+	i2cQueueBegin((i2cFastMode) ? 400000 : 100000); // Start i2c
 	
 	// Welcome & information message...
 	if(debug) {
@@ -74,45 +72,36 @@ void setup()
 		Serial.print("serial:\n\t- port @ "); Serial.println(SERIAL_SPEED, DEC);
 		Serial.print("i2c:\n\t- port @ "); Serial.println((i2cFastMode) ? "400 kHz" : "100 kHz");
 		Serial.print("slaves:\n\t- quantity: "); Serial.println(HS_SLAVE_NUMBER, DEC);
+		Serial.print("\t- haptic columns: "); Serial.println(HS_COL_NUMBER, DEC);
 		Serial.print("piezos:\n\t- items/column: "); Serial.println((HSd.raw9) ? "9" : "5");
 		Serial.println("**************************************\n");
 	}
 
-	// Register slaves and list the avaiable ones
-	registerSlave();
-	
-	// Perform initialization for each available slave
+	// Close the i2c switches (the master may have been reset with channels open)
 	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
-		delay(INIT_WAIT_MS);	// wait some ms between each slave to avoid collisions
-		
-		bool reset = true;
-		bool on = true;
-		uint8_t gain = 3;
-		uint8_t drvMask = 0xFF;
-		if(HSd.i2cSlaveAvailable[i]) {
-			if(debug) {
-				Serial.print("\nSetting up slave @ 0x"); Serial.print(HSd.i2cSlaveAddress[i], HEX);
-				Serial.println("\n----------------------------------------");
-			}
-			// Set up the drv2667 and notify if succeeded
-			HSd.i2cSlaveSetup[i] = setupSlaveDrv(HSd.i2cSwitchAddress[i], drvMask, reset, on, gain);
-			bool notify = ((HSd.i2cSlaveSetup[i] & drvMask) == drvMask) ? true : false;
-			if(debug) {
-				Serial.print("Slave#"); Serial.print(i, DEC); Serial.println(" set up...");
-				Serial.print("Sent: "); Serial.print(drvMask, BIN);
-				Serial.print(", returned: "); Serial.println(HSd.i2cSlaveSetup[i], BIN);
-				Serial.print("Notification: "); Serial.println(notify, DEC);
-			}
-			notifySlave(HSd.i2cSlaveAddress[i], notify);
-
-			// Toggle sync pin for time measurement
-			syncPinState = !syncPinState;
-			digitalWrite(SYNC_PIN_1, syncPinState);
+		uint8_t none = 0;
+		i2cQueueWrite(hsSwitchAddr(i), &none, 1);
+	}
 
-			// Switch off all relays of selected slave
-			sendToSlave(HSd.i2cSlaveAddress[i], NULL, 0);
+	// Register and set up the slaves as soon as they answer, one step per
+	// slave and round: the first ones are set up while the others boot. The
+	// slaves still missing after STARTUP_WAIT_MS are left to slaveHealth().
+	uint32_t start = millis();
+	while(!slavesReady() && ((millis() - start) < STARTUP_WAIT_MS)) {
+		bool busy = false;
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			if(slaveSt.state[i] != slave_ready) busy |= slaveStep(i);
 		}
+		if(!busy) delay(SLAVE_PROBE_MS);
+	}
+	slaveSt.bootMs = millis();
+	slaveSt.last = millis();
+	if(debug) {
+		Serial.print("Slaves set up in "); Serial.print(slaveSt.bootMs, DEC); Serial.println(" ms");
 	}
+	
+	// Start the latency statistics with the first frame
+	latencyReset();
 }
 
 
@@ -123,151 +112,698 @@ void setup()
 /* -------------------------------------------------------------------------- */
 void loop()
 {
-	byte b;
-	int8_t i2cAddr;
-	
-	// Collect characters on the serial port started by '[' and terminated by ']'.
-	// Then process the received command line
-	if(Serial.available()) {
-		b = Serial.read();
-    
-		// When start character received...
-		// --------------------------------
-		if(b == SCMD_START) {
-		    // reset the command index counter and prepare reading length
-			if(debug) {
-				Serial.println("Start byte received...");
-			}
-			cmdIndexCnt = 0;
-			cmdByteOne = true;
-		}
-		
-		// When stop character received...
-		// -------------------------------
-		else if(b == SCMD_STOP) {
-			if(debug) {
-				Serial.println("Stop byte received...");
-			}
+	struct serialFrame frame;
+	
+	// Release the finished i2c transactions
+	i2cQueueService();
+	
+	// Move everything received on the serial port into the ring buffer, then
+	// process every complete frame found in it
+	serialDrain();
+	while(serialDecode(&frame) != frame_none) {
+		if(frame.timed) frameQueue(&frame);
+		else processFrame(&frame);
+		serialDrain();
+	}
+	
+	// Acknowledge the sequenced frames received up to now
+	serialAckFlush();
+	
+	// Process the timed frames whose time has come
+	frameRelease();
+	
+	// The newest frame goes out once the previous one has left the bus
+	if(framePending && i2cQueueIdle()) {
+		dispatchFrame();
+	}
+	
+	// Keep the FIFO of the streaming drivers filled
+	drvFifoService();
+	
+	// Probe the slaves and set up the lost ones again, between frames
+	slaveHealth();
+	
+	// Put the drivers of the idle columns in standby, between frames
+	drvPowerIdle();
+	
+	// Send the debug events once the frames are out
+	if(hsTraceBuf.on && !framePending) {
+		hsTraceDrain(debug);
+	}
+}
 
-			// Check if stop byte is simultaneously byte one (MSG: "START STOP")
-			if(cmdByteOne) {
-				if(debug) {
-					Serial.println("Start/stop message received");
-				} else {
-					Serial.write(SERR_NOERROR);
-					Serial.write(SERR_CRLF);
-				}
 
-				// Close all relays of all available slaves
-				for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
-					// if(HSd.i2cSlaveAvailable[i]) {	// for each available slave...
-						if(debug) {
-							Serial.print("\nSending piezo off command to slave #"); Serial.println(i, DEC);
-						}
-						sendToSlave(HSd.i2cSlaveAddress[i], NULL, 0);
-					// }
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | serialDrain / serialResync / serialDecode / serialAccept / serialAck	| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+void serialDrain(void)
+{
+	uint8_t n = Serial.available();
+	uint8_t room = SERIAL_RING_SIZE - (uint8_t)(rxHead - rxTail);
+	
+	if(n == 0) return;
+	if(n > room) n = room;
+	for(uint8_t i = 0; i < n; i++) {
+		rxRing[(rxHead++) & SERIAL_RING_MASK] = Serial.read();
+	}
+	rxLast = micros();
+}
+
+// Drop the start byte of a bad frame and look for the next one
+void serialResync(void)
+{
+	rxTail += 1;
+	serialSt.bytes += 1;
+	serialSt.resyncs += 1;
+	// In debug mode, the trace reports it as text from loop()
+	hsTrace(trc_resync, decodeState, serialSt.resyncs);
+	decodeState = dec_hunt;
+	if(!debug) {
+		Serial.write(SERR_MISMATCH);
+		Serial.write(SERR_CRLF);
+	}
+}
+
+// Frames: START n (col row) x n STOP, START STOP (all off), or
+// START BITMAP (HS_BITMAP_BYTES bytes) STOP (full surface), each of them
+// optionally sequenced and / or timed: START [SEQ seq] [TIMED time(2)] n ... STOP.
+// The bytes stay in the ring until the whole frame is validated (length in
+// range, stop byte at the end), then the pairs are copied into HSd.inputCoord,
+// resp. the bitmap into HSd.inputBitmap.
+// Pair values may be anything, a bad frame only costs its own start byte.
+uint8_t serialDecode(struct serialFrame *f)
+{
+	for(;;) {
+		uint8_t avail = rxHead - rxTail;
+		
+		switch(decodeState) {
+			case dec_hunt:
+				while((avail > 0) && (rxRing[rxTail & SERIAL_RING_MASK] != SCMD_START)) {
+					rxTail += 1;
+					avail -= 1;
+					serialSt.bytes += 1;
+					serialSt.skipped += 1;
 				}
-				cmdByteOne = false;			// Reset byte one flag
+				if(avail == 0) return frame_none;
+				latT.start = rxLast;
+				decodeState = dec_length;
+				// no break
+			
+			case dec_length: {
+				if(avail < 2) break;
+				uint8_t n = rxRing[(uint8_t)(rxTail + 1) & SERIAL_RING_MASK];
+				decodeHdr = 0;
+				if(n == SCMD_SEQ) {
+					if(avail < 4) break;
+					decodeHdr = 2;
+					n = rxRing[(uint8_t)(rxTail + 3) & SERIAL_RING_MASK];
+				}
+				if(n == SCMD_TIMED) {
+					if(avail < decodeHdr + 5) break;
+					decodeHdr += 3;
+					n = rxRing[(uint8_t)(rxTail + decodeHdr + 1) & SERIAL_RING_MASK];
+				}
+				if(n == SCMD_STOP) {
+					f->len = 0;
+					f->coord = HSd.inputCoord;
+					if(serialAccept(f, frame_allOff, decodeHdr + 2)) return frame_allOff;
+					continue;
+				}
+				if(n == SCMD_BITMAP) {
+					decodeLen = decodeHdr + HS_BITMAP_BYTES + 3;
+				}
+				else if(n > HS_COORD_MAX) {
+					serialResync();
+					continue;
+				}
+				else {
+					decodeLen = decodeHdr + (2 * n) + 3;
+				}
+				decodeState = dec_body;
 			}
+				// no break
 			
-			// When counted items < entered length, test index counter eveness
-			else if(cmdIndexCnt < cmdLength) {
-				if(debug) {
-					Serial.print("cmdIndexCnt = "); Serial.print(cmdIndexCnt, DEC);
-					Serial.print(", cmdLength = "); Serial.println(cmdLength, DEC);
+			case dec_body: {
+				if(avail < decodeLen) break;
+				if(rxRing[(uint8_t)(rxTail + decodeLen - 1) & SERIAL_RING_MASK] != SCMD_STOP) {
+					serialResync();
+					continue;
 				}
-
-				if((cmdIndexCnt % 2) == 0) {
-					if(debug) {
-						Serial.print("ERROR#"); Serial.print(SERR_MISMATCH);
-						Serial.println("! Counted & entered lengths don't match");
-					} else {
-						Serial.write(SERR_MISMATCH);
-						Serial.write(SERR_CRLF);
+				uint8_t at = rxTail + decodeHdr;
+				f->coord = HSd.inputCoord;
+				if(rxRing[(uint8_t)(at + 1) & SERIAL_RING_MASK] == SCMD_BITMAP) {
+					f->len = HS_BITMAP_BYTES;
+					for(uint8_t i = 0; i < HS_BITMAP_BYTES; i++) {
+						HSd.inputBitmap[i] = rxRing[(uint8_t)(at + 2 + i) & SERIAL_RING_MASK];
 					}
-				} else {
-					HSd.inputCoord[(cmdIndexCnt-1)/2][1] = b;
+					if(serialAccept(f, frame_bitmap, decodeLen)) return frame_bitmap;
+					continue;
 				}
-
-				cmdIndexCnt += 1;
+				f->len = (decodeLen - decodeHdr - 3) / 2;
+				for(uint8_t i = 0; i < f->len; i++) {
+					HSd.inputCoord[i][0] = rxRing[(uint8_t)(at + 2 + (2 * i)) & SERIAL_RING_MASK];
+					HSd.inputCoord[i][1] = rxRing[(uint8_t)(at + 3 + (2 * i)) & SERIAL_RING_MASK];
+				}
+				if(serialAccept(f, frame_coord, decodeLen)) return frame_coord;
+				continue;
 			}
+		}
+		
+		// Incomplete frame: give up on it if the host went silent
+		if((micros() - rxLast) > SERIAL_FRAME_TIMEOUT_US) {
+			serialResync();
+			continue;
+		}
+		return frame_none;
+	}
+}
 
-			// When counted items = entered length, serial entry probably finished
-			else if(cmdIndexCnt == cmdLength) {
-				if(debug) {
-					Serial.print("\r\n\r\n****************************************\r\nNew command: "); 
-					for(uint8_t i = 0; i < (cmdIndexCnt/2); i++) {
-						uint8_t col = ( ((i % 2) == 0) ? (i/2) : ((i-1)/2) );
-						Serial.print(HSd.inputCoord[i][0], DEC); Serial.print(" ");
-						Serial.print(HSd.inputCoord[i][1], DEC); Serial.print(" ");
-						// Serial.print(cmd[i], DEC); Serial.print(" ");
-					}
-					Serial.print(" (l = "); Serial.print(cmdIndexCnt, DEC); Serial.println(")");
-					Serial.print(" Entered length: "); Serial.println(cmdLength, DEC);
-					Serial.print("****************************************\r\n");
-				} else {
-					Serial.write(SERR_NOERROR);
-					Serial.write(SERR_CRLF);
-				}
-				
-				// Toggle sync pin for time measurement
-				syncPinState = !syncPinState;
-				digitalWrite(SYNC_PIN_1, syncPinState);
 
-				distributeCoordinates((cmdLength/2), HSd.inputCoord, HSd.outputIndex);
+// Fill in the header of the frame just decoded and consume its bytes. A
+// sequenced frame is only accepted in order (or restarting the count): the
+// first one out of order is answered with the sequence number expected, the
+// host sending again from there (go-back-n).
+bool serialAccept(struct serialFrame *f, uint8_t type, uint8_t bytes)
+{
+	uint8_t at = rxTail + 2;
+	uint8_t seq = 0;
+	
+	f->type = type;
+	f->start = latT.start;
+	f->seq = SERIAL_SEQ_NONE;
+	if(rxRing[(uint8_t)(rxTail + 1) & SERIAL_RING_MASK] == SCMD_SEQ) {
+		seq = rxRing[(uint8_t)at & SERIAL_RING_MASK];
+		f->seq = seq & SERIAL_SEQ_MASK;
+		at += 2;
+	}
+	f->timed = ((uint8_t)(at - rxTail) < (decodeHdr + 2));		// TIMED header left
+	if(f->timed) {
+		f->time = rxRing[(uint8_t)at & SERIAL_RING_MASK] |
+			(rxRing[(uint8_t)(at + 1) & SERIAL_RING_MASK] << 8);
+	}
+	rxTail += bytes;
+	serialSt.bytes += bytes;
+	serialSt.frames += 1;
+	decodeState = dec_hunt;
+	
+	if(f->seq == SERIAL_SEQ_NONE) return true;
+	if(!(seq & SERIAL_SEQ_RESTART) && (f->seq != seqSt.expected)) {
+		seqSt.rejected += 1;
+		if(!seqSt.nakSent) serialReply(SERR_MISMATCH, seqSt.expected);
+		seqSt.nakSent = true;
+		return false;
+	}
+	seqSt.expected = (f->seq + 1) & SERIAL_SEQ_MASK;
+	seqSt.nakSent = false;
+	return true;
+}
 
-				// Toggle sync pin for time measurement
-				syncPinState = !syncPinState;
-				digitalWrite(SYNC_PIN_1, syncPinState);
+// Acknowledge a frame: at once without sequence number, else together with
+// the next ones (at most SERIAL_ACK_EVERY, see serialAckFlush())
+void serialAck(const struct serialFrame *f)
+{
+	if(f->seq == SERIAL_SEQ_NONE) {
+		if(!debug) {
+			Serial.write(SERR_NOERROR);
+			Serial.write(SERR_CRLF);
+		}
+		return;
+	}
+	seqSt.unacked += 1;
+	if(seqSt.unacked >= SERIAL_ACK_EVERY) serialAckFlush();
+}
 
-				parseCommand();
-				
-				// Toggle sync pin for time measurement
-				syncPinState = !syncPinState;
-				digitalWrite(SYNC_PIN_1, syncPinState);
+// Acknowledge the sequenced frames accepted so far: SERR_ACK next sequence
+// number expected SERR_CRLF
+void serialAckFlush(void)
+{
+	if(seqSt.unacked == 0) return;
+	seqSt.unacked = 0;
+	serialReply(SERR_ACK, seqSt.expected);
+}
 
-			}
-			
-			// When counted items > entered length, notify mismatch error
-			else if(cmdIndexCnt > cmdLength) {
-				if(debug) {
-					Serial.print("ERROR#"); Serial.print(SERR_MISMATCH, DEC);
-					Serial.println("! Incorrect lengths");
-				} else {
-					Serial.write(SERR_MISMATCH);
-					Serial.write(SERR_CRLF);
-				}
-			}
+// Send an error or acknowledgement referring to a sequence number
+void serialReply(uint8_t code, uint8_t seq)
+{
+	if(debug) {
+		Serial.print((code == SERR_ACK) ? "ACK#" : "ERROR#"); Serial.print(code, DEC);
+		Serial.print(", sequence "); Serial.println(seq, DEC);
+	} else {
+		Serial.write(code);
+		Serial.write(seq);
+		Serial.write(SERR_CRLF);
+	}
+}
 
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | processFrame															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+void processFrame(struct serialFrame *f)
+{
+	uint32_t now = micros();
+	
+	// Timed frames were acknowledged by frameQueue(), on reception
+	hsTrace(trc_frame, f->len, (framePending << 8) | f->type);
+	if(f->timed) {
+		LAT_ADD(lat_release, ((int32_t)(now - f->start) > 0) ? (now - f->start) : 0);
+	} else {
+		LAT_ADD(lat_receive, now - f->start);
+		serialAck(f);
+	}
+	
+	// A frame still waiting for the bus is superseded: its coordinates are
+	// dropped, its commands (flags in HSd) are kept and merged with ours.
+	if(framePending) {
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			HSd.indexCnt[i] = 0;
+			HSd.drvBm[i] = 0;
 		}
-		
-		// When cmdByteOne flag is active...
-		// ---------------------------------
-		else if(cmdByteOne) {
-			cmdLength = (2 * b);
-			cmdByteOne = false;
+		serialSt.dropped += 1;
+	}
+	
+	// Toggle sync pin for time measurement
+	syncPinState = !syncPinState;
+	digitalWrite(SYNC_PIN_1, syncPinState);
+
+	// Start/stop message: no coordinate, all relays get closed
+	bitmapPending = (f->type == frame_bitmap);
+	if(f->type == frame_coord) {
+		distributeCoordinates(f, HSd.outputIndex);
+	}
+	else if(f->type == frame_bitmap) {
+		distributeBitmap(HSd.inputBitmap);
+	}
+
+	// Toggle sync pin for time measurement
+	syncPinState = !syncPinState;
+	digitalWrite(SYNC_PIN_1, syncPinState);
+
+	latT.ready = micros();
+	latT.origin = f->start;
+	LAT_ADD(lat_distribute, latT.ready - now);
+
+	framePending = true;
+#if(FRAME_COALESCING == 0)
+	dispatchFrame();
+#endif
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | frameQueue / frameRelease / frameApply / frameSync						| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Keep a timed frame until its time. The host sends ahead so that bursts of
+// the serial link do not reach the piezos: frames due already are counted as
+// underruns and released at once, a full buffer releases its oldest frame.
+void frameQueue(struct serialFrame *f)
+{
+	uint32_t now = micros();
+	LAT_ADD(lat_receive, now - f->start);
+	serialAck(f);
+	
+	if(frameQ.count == FRAME_QUEUE_SIZE) {
+		frameQ.early += 1;
+		frameApply();
+	}
+	
+	// Time of the frame relative to the frame clock, +/- half its range
+	uint16_t clock = (now - frameQ.epoch) >> FRAME_TIME_SHIFT;
+	int16_t ahead = (int16_t)(f->time - clock);
+	struct timedFrame *e = &frameQ.q[(frameQ.head + frameQ.count) % FRAME_QUEUE_SIZE];
+	if(ahead < 0) {
+		frameQ.underruns += 1;
+		e->due = now;
+	} else {
+		e->due = now + ((uint32_t)ahead << FRAME_TIME_SHIFT);
+	}
+	e->type = f->type;
+	e->len = f->len;
+	e->seq = f->seq;
+	if(f->type == frame_bitmap) {
+		for(uint8_t i = 0; i < HS_BITMAP_BYTES; i++) e->data[i] = HSd.inputBitmap[i];
+	} else {
+		for(uint8_t i = 0; i < f->len; i++) {
+			e->data[2 * i] = f->coord[i][0];
+			e->data[(2 * i) + 1] = f->coord[i][1];
 		}
-		
-		// Concatenating currently entered input...
-		// ----------------------------------------
-		else {
-			if(debug) {
-				Serial.print("cmdIndexCnt = "); Serial.print(cmdIndexCnt, DEC);
-				Serial.print(", cmdLength = "); Serial.println(cmdLength, DEC);
+	}
+	frameQ.count += 1;
+	hsTrace(trc_timed, frameQ.count, (ahead < 0) ? 0 : ahead);
+}
+
+// Process the timed frames due, in their order of arrival
+void frameRelease(void)
+{
+	while(frameQ.count > 0) {
+		uint32_t late = micros() - frameQ.q[frameQ.head].due;
+		if((int32_t)late < 0) return;
+		if(late > FRAME_LATE_US) frameQ.late += 1;
+		frameApply();
+	}
+}
+
+// Process the oldest timed frame
+void frameApply(void)
+{
+	struct timedFrame *e = &frameQ.q[frameQ.head];
+	struct serialFrame f;
+	
+	frameQ.head = (frameQ.head + 1) % FRAME_QUEUE_SIZE;
+	frameQ.count -= 1;
+	
+	f.type = e->type;
+	f.len = e->len;
+	f.coord = HSd.inputCoord;
+	f.timed = true;
+	f.seq = e->seq;
+	f.start = e->due;
+	if(e->type == frame_bitmap) {
+		for(uint8_t i = 0; i < HS_BITMAP_BYTES; i++) HSd.inputBitmap[i] = e->data[i];
+	} else {
+		for(uint8_t i = 0; i < e->len; i++) {
+			HSd.inputCoord[i][0] = e->data[2 * i];
+			HSd.inputCoord[i][1] = e->data[(2 * i) + 1];
+		}
+	}
+	processFrame(&f);
+}
+
+// Restart the frame clock at the start byte of the SCMD_SYNC frame (arg 0,
+// the counters too), then send it: SCMD_SYNC frame clock us(4) waiting(1)
+// underruns(2) late(2) early(2) SERR_CRLF, little endian
+void frameSync(uint8_t arg, uint32_t at)
+{
+	if(arg == 0) {
+		frameQ.epoch = at;
+		frameQ.underruns = 0;
+		frameQ.late = 0;
+		frameQ.early = 0;
+	}
+	uint32_t clock = at - frameQ.epoch;
+	
+	if(debug) {
+		Serial.print("\nFrame clock: "); Serial.print(clock, DEC); Serial.println(" us");
+		Serial.print("- waiting: "); Serial.println(frameQ.count, DEC);
+		Serial.print("- underruns: "); Serial.println(frameQ.underruns, DEC);
+		Serial.print("- late: "); Serial.println(frameQ.late, DEC);
+		Serial.print("- early: "); Serial.println(frameQ.early, DEC);
+	} else {
+		uint32_t val[5] = { clock, frameQ.count, frameQ.underruns, frameQ.late, frameQ.early };
+		uint8_t size[5] = { 4, 1, 2, 2, 2 };
+		Serial.write(SCMD_SYNC);
+		for(uint8_t i = 0; i < 5; i++) {
+			for(uint8_t j = 0; j < size[i]; j++) {
+				Serial.write((uint8_t)(val[i] >> (8 * j)));
 			}
-			
-			// cmdIndexCnt is indexed for each byte, while the inputCoord table saves coordinate
-			// pairs of half length
-			uint8_t p = ( ((cmdIndexCnt % 2) == 0) ? (cmdIndexCnt/2) : ((cmdIndexCnt-1)/2) );
-			if( (cmdIndexCnt % 2) == 0) {
-				HSd.inputCoord[p][0] = b;
-			} else {
-				HSd.inputCoord[p][1] = b;
+		}
+		Serial.write(SERR_CRLF);
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | dispatchFrame															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Send the pending frame to the slaves
+void dispatchFrame(void)
+{
+	framePending = false;
+	latT.sent = micros();
+	latT.sentOrigin = latT.origin;
+	LAT_ADD(lat_wait, latT.sent - latT.ready);
+	
+	parseCommand();
+	
+	// Toggle sync pin for time measurement
+	syncPinState = !syncPinState;
+	digitalWrite(SYNC_PIN_1, syncPinState);
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | reportStats															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Send the decoder counters: SCMD_STATS frames(4) bytes(4) resyncs(2)
+// skipped(2) dropped(2) latch skew us(2) slave receive -> latch cycles(2)
+// elapsed ms(4) SERR_CRLF, little endian. The latch skew is the largest of
+// the last I2C_COMMIT_SLOTS commits.
+void reportStats(bool reset)
+{
+	uint16_t skew, cycles;
+	pollSlaves(&skew, &cycles);
+	uint32_t now = millis();
+	uint32_t elapsed = now - serialSt.since;
+	
+	if(debug) {
+		Serial.println("\nSerial decoder statistics:");
+		Serial.print("- frames: "); Serial.println(serialSt.frames, DEC);
+		Serial.print("- bytes: "); Serial.println(serialSt.bytes, DEC);
+		Serial.print("- resyncs: "); Serial.println(serialSt.resyncs, DEC);
+		Serial.print("- skipped bytes: "); Serial.println(serialSt.skipped, DEC);
+		Serial.print("- superseded frames: "); Serial.println(serialSt.dropped, DEC);
+		Serial.print("- latch skew [us]: "); Serial.println(skew, DEC);
+		Serial.print("- slave receive -> latch [cycles]: "); Serial.println(cycles, DEC);
+		Serial.print("- frames/s: "); Serial.println((elapsed > 0) ? ((1000 * serialSt.frames) / elapsed) : 0, DEC);
+	} else {
+		uint32_t val[8] = { serialSt.frames, serialSt.bytes, serialSt.resyncs, serialSt.skipped, serialSt.dropped, skew, cycles, elapsed };
+		uint8_t size[8] = { 4, 4, 2, 2, 2, 2, 2, 4 };
+		Serial.write(SCMD_STATS);
+		for(uint8_t i = 0; i < 8; i++) {
+			for(uint8_t j = 0; j < size[i]; j++) {
+				Serial.write((uint8_t)(val[i] >> (8 * j)));
 			}
+		}
+		Serial.write(SERR_CRLF);
+	}
+	
+	if(reset) {
+		serialSt.frames = 0;
+		serialSt.bytes = 0;
+		serialSt.resyncs = 0;
+		serialSt.skipped = 0;
+		serialSt.dropped = 0;
+		serialSt.since = now;
+		latencyReset();
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | reportTopology															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Send the topology: SCMD_TOPOLOGY slaves(1), then per slave i2c address(1)
+// switch address(1) haptic columns(1) available(1) drivers set up(1) SERR_CRLF
+void reportTopology(void)
+{
+	if(debug) {
+		Serial.print("\nTopology: "); Serial.print(HS_SLAVE_NUMBER, DEC);
+		Serial.print(" slaves, haptic columns "); Serial.print(HS_COL_OFFSET, DEC);
+		Serial.print(" - "); Serial.println(HS_COL_NUMBER, DEC);
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			Serial.print("- slave#"); Serial.print(i, DEC);
+			Serial.print(" @ 0x"); Serial.print(hsSlaveAddr(i), HEX);
+			Serial.print(", switch @ 0x"); Serial.print(hsSwitchAddr(i), HEX);
+			Serial.print(", columns: "); Serial.print(hsSlaveCols(i), DEC);
+			Serial.print(", drivers: "); Serial.println((HSd.i2cSlaveAvailable[i]) ? HSd.i2cSlaveSetup[i] : 0, BIN);
+		}
+	} else {
+		Serial.write(SCMD_TOPOLOGY);
+		Serial.write((uint8_t)HS_SLAVE_NUMBER);
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			Serial.write(hsSlaveAddr(i));
+			Serial.write(hsSwitchAddr(i));
+			Serial.write(hsSlaveCols(i));
+			Serial.write((uint8_t)((HSd.i2cSlaveAvailable[i]) ? 1 : 0));
+			Serial.write(HSd.i2cSlaveSetup[i]);
+		}
+		Serial.write(SERR_CRLF);
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | reportHealth															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Send the startup and recovery times: SCMD_HEALTH power-up -> setup done
+// ms(2), then per slave slaveState(1) recoveries(1) last lost -> ready again
+// ms(2) SERR_CRLF, little endian
+void reportHealth(void)
+{
+	if(debug) {
+		Serial.print("\nStartup: "); Serial.print(slaveSt.bootMs, DEC); Serial.println(" ms");
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			Serial.print("- slave#"); Serial.print(i, DEC);
+			Serial.print((slaveSt.state[i] == slave_ready) ? " ready" : " NOT ready");
+			Serial.print(", recoveries: "); Serial.print(slaveSt.recoveries[i], DEC);
+			Serial.print(", last: "); Serial.print(slaveSt.recoveryMs[i], DEC); Serial.println(" ms");
+		}
+	} else {
+		Serial.write(SCMD_HEALTH);
+		Serial.write((uint8_t)slaveSt.bootMs);
+		Serial.write((uint8_t)(slaveSt.bootMs >> 8));
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			Serial.write(slaveSt.state[i]);
+			Serial.write(slaveSt.recoveries[i]);
+			Serial.write((uint8_t)slaveSt.recoveryMs[i]);
+			Serial.write((uint8_t)(slaveSt.recoveryMs[i] >> 8));
+		}
+		Serial.write(SERR_CRLF);
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | reportLatency / latencyReset / slaveStatRead / slaveStatReset			| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Send a latency statistic: SCMD_LATENCY stage(1) count(4) min(2) max(2)
+// mean(2) histogram(2 x HS_LAT_BUCKETS) SERR_CRLF, little endian. Master
+// stages are in us (LAT_STATS builds, SERR_SETTINGS otherwise), hsStat_latch
+// in slave cycles, hsStat_commit in us.
+void reportLatency(uint8_t arg)
+{
+	uint8_t stage = arg & ~LAT_RESET;
+	struct hsLatency l;
+	bool ok = true;
+	
+	hsLatReset(&l);
+	if(stage < LAT_STAGES) {
+#if(LAT_STATS > 0)
+		l = latStat[stage];
+		if(arg & LAT_RESET) hsLatReset(&latStat[stage]);
+#else
+		ok = false;
+#endif
+	} else if(stage < (lat_slaves + HS_SLAVE_STATS)) {
+		// all slaves merged
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			struct hsLatency sl;
+			if(!slaveStatRead(i, stage - lat_slaves, &sl)) continue;
+			hsLatMerge(&l, &sl);
+			if(arg & LAT_RESET) slaveStatReset(i, stage - lat_slaves);
+		}
+	} else if((stage >= LAT_SLAVE_BASE) && (stage < LAT_SLAVE(HS_SLAVE_NUMBER, 0))) {
+		uint8_t sn = (stage - LAT_SLAVE_BASE) / HS_SLAVE_STATS;
+		uint8_t st = (stage - LAT_SLAVE_BASE) % HS_SLAVE_STATS;
+		ok = slaveStatRead(sn, st, &l);
+		if(ok && (arg & LAT_RESET)) slaveStatReset(sn, st);
+	} else {
+		ok = false;
+	}
+	
+	uint16_t min = (l.count > 0) ? l.min : 0;
+	uint16_t mean = (l.count > 0) ? (l.sum / l.count) : 0;
+	if(debug) {
+		if(!ok) {
+			Serial.print("ERROR#"); Serial.print(SERR_SETTINGS);
+			Serial.println("! No such latency statistic");
+			return;
+		}
+		Serial.print("\nLatency statistic #"); Serial.println(stage, DEC);
+		Serial.print("- samples: "); Serial.println(l.count, DEC);
+		Serial.print("- min / mean / max: "); Serial.print(min, DEC);
+		Serial.print(" / "); Serial.print(mean, DEC);
+		Serial.print(" / "); Serial.println(l.max, DEC);
+		for(uint8_t i = 0; i < HS_LAT_BUCKETS; i++) {
+			if(l.hist[i] == 0) continue;
+			Serial.print("- < "); Serial.print((uint32_t)1 << i, DEC);
+			Serial.print(": "); Serial.println(l.hist[i], DEC);
+		}
+	} else {
+		if(!ok) {
+			Serial.write(SERR_SETTINGS);
+			Serial.write(SERR_CRLF);
+			return;
+		}
+		uint16_t val[3] = { min, l.max, mean };
+		Serial.write(SCMD_LATENCY);
+		Serial.write(stage);
+		for(uint8_t j = 0; j < 4; j++) {
+			Serial.write((uint8_t)(l.count >> (8 * j)));
+		}
+		for(uint8_t i = 0; i < 3; i++) {
+			Serial.write((uint8_t)val[i]);
+			Serial.write((uint8_t)(val[i] >> 8));
+		}
+		for(uint8_t i = 0; i < HS_LAT_BUCKETS; i++) {
+			Serial.write((uint8_t)l.hist[i]);
+			Serial.write((uint8_t)(l.hist[i] >> 8));
+		}
+		Serial.write(SERR_CRLF);
+	}
+}
+
+// Clear the latency statistics of the slaves, then of the master (the
+// blocking writes to the slaves release the piezo sets queued before)
+void latencyReset(void)
+{
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		for(uint8_t j = 0; j < HS_SLAVE_STATS; j++) {
+			slaveStatReset(i, j);
+		}
+	}
+#if(LAT_STATS > 0)
+	for(uint8_t i = 0; i < LAT_STAGES; i++) {
+		hsLatReset(&latStat[i]);
+	}
+#endif
+}
 
-			cmdIndexCnt += 1;
+// Read statistic st of slave sn, one i2cCmd_stats page per request
+bool slaveStatRead(uint8_t sn, uint8_t st, struct hsLatency *l)
+{
+	uint8_t *dst = (uint8_t *)l;
+	
+	if(!HSd.i2cSlaveAvailable[sn]) return false;
+	for(uint8_t p = 0; p < HS_LAT_PAGES; p++) {
+		uint8_t cmd[2] = { i2cCmd_stats, (uint8_t)((st << 4) | (p + 1)) };
+		uint8_t reply[HS_LAT_PAGE + 1];
+		if(i2cQueueWrite(hsSlaveAddr(sn), cmd, 2) != I2C_XFER_OK) return false;
+		if(i2cQueueRead(hsSlaveAddr(sn), reply, HS_LAT_PAGE + 1) != (HS_LAT_PAGE + 1)) return false;
+		if(reply[0] != hsSlaveAddr(sn)) return false;
+		for(uint8_t i = 0; (i < HS_LAT_PAGE) && ((p * HS_LAT_PAGE + i) < sizeof(struct hsLatency)); i++) {
+			dst[p * HS_LAT_PAGE + i] = reply[i + 1];
 		}
 	}
+	return true;
+}
+
+// Read the commit -> latch times of slave sn, by commit slot (cleared by the
+// read, I2C_LATCH_NONE: not latched)
+bool slaveCommitRead(uint8_t sn, uint16_t *d)
+{
+	uint8_t cmd[2] = { i2cCmd_stats, (uint8_t)((I2C_STATS_COMMITS << 4) | 1) };
+	uint8_t reply[HS_LAT_PAGE + 1];
+	
+	if(i2cQueueWrite(hsSlaveAddr(sn), cmd, 2) != I2C_XFER_OK) return false;
+	if(i2cQueueRead(hsSlaveAddr(sn), reply, HS_LAT_PAGE + 1) != (HS_LAT_PAGE + 1)) return false;
+	if(reply[0] != hsSlaveAddr(sn)) return false;
+	for(uint8_t i = 0; i < I2C_COMMIT_SLOTS; i++) {
+		d[i] = reply[2 * i + 1] | (reply[2 * i + 2] << 8);
+	}
+	return true;
+}
+
+void slaveStatReset(uint8_t sn, uint8_t st)
+{
+	uint8_t cmd[2] = { i2cCmd_stats, (uint8_t)(I2C_STATS_RESET | (st << 4)) };
+	if(HSd.i2cSlaveAvailable[sn]) i2cQueueWrite(hsSlaveAddr(sn), cmd, 2);
 }
 
 
@@ -278,402 +814,821 @@ void loop()
 /* -------------------------------------------------------------------------- */
 void parseCommand(void)
 {
-	int8_t addr = 0;
-	uint8_t drvMask = 0;
-	uint8_t gain = 0;
-	bool reset = false;
-	bool on = false;
-	// Command parser, resp. coordinate forwarder
+	bool refresh = false;
+
+	// Periodically re-send the piezo set of every slave, even if unchanged
+	if(SLAVE_REFRESH_FRAMES > 0) {
+		HSd.refreshCnt += 1;
+		if(HSd.refreshCnt >= SLAVE_REFRESH_FRAMES) {
+			HSd.refreshCnt = 0;
+			refresh = true;
+		}
+	}
+
+	// Columns touched by this frame, for the power scheduler
+	uint32_t act = drvPowerCols(HSd.drvBm);
+
+	// Command parser, resp. coordinate forwarder. One pending command is
+	// executed per slave and frame, then the coordinates are forwarded.
 	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		bool off = false;
 		// if(HSd.i2cSlaveAvailable[i]) {
 			// ...switch off all piezos (relay)
 			if(HSd.piezoOffAll[i]) {
-				if(debug) {
-					Serial.print("\nSwitching off piezos on slave#");
-					Serial.println(i, DEC);
-				}
-				addr = HSd.i2cSwitchAddress[i];
-				drvMask = 0xFF;
-				reset = false;
-				on = false;
-				gain = 3;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
-
-				sendToSlave(HSd.i2cSlaveAddress[i], NULL, 0);
+				hsTrace(trc_slaveCmd, i, (SCMD_POFF_ALL << 8) | 0xFF);
+				updateSlave(i, NULL, 0, true);
 
 				HSd.piezoOffAll[i] = false;
+				off = true;
 			}
 			// ...swich off all drivers
 			else if(HSd.drvOffAll[i]) {
-				if(debug) {
-					Serial.print("\nSwitching off all drivers on slave#");
-					Serial.println(i, DEC);
-				}
-				addr = HSd.i2cSwitchAddress[i];
-				drvMask = 0xFF;
-				reset = false;
-				on = false;
-				gain = 0;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
+				hsTrace(trc_slaveCmd, i, (SCMD_DOFF_ALL << 8) | 0xFF);
+				setupSlaveDrv(i, 0xFF, false, false, 0);
 
 				HSd.drvOffAll[i] = false;
 			}
 			// ...switch on all drivers
 			else if(HSd.drvOnAll[i]) {
-				if(debug) {
-					Serial.print("\nSwitching on all drivers on slave#");
-					Serial.println(i, DEC);
-				}
-				addr = HSd.i2cSwitchAddress[i];
-				drvMask = 0xFF;
-				reset = false;
-				on = true;
-				gain = 3;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
+				hsTrace(trc_slaveCmd, i, (SCMD_DON_ALL << 8) | 0xFF);
+				setupSlaveDrv(i, 0xFF, false, true, 3);
 
 				HSd.drvOnAll[i] = false;
 			}
 			// ...switch off selected drivers
 			else if(HSd.drvOff[i] > 0) {
-				if(debug) {
-					Serial.print("\nSwitching off drivers "); Serial.print(HSd.drvOff[i], BIN);
-					Serial.print(" on slave#"); Serial.println(i, DEC);
-				}
-				addr = HSd.i2cSwitchAddress[i];
-				drvMask = HSd.drvOff[i];
-				reset = false;
-				on = false;
-				gain = 0;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
+				hsTrace(trc_slaveCmd, i, (SCMD_DOFF << 8) | HSd.drvOff[i]);
+				setupSlaveDrv(i, HSd.drvOff[i], false, false, 0);
 
 				HSd.drvOff[i] = 0;
 			}
 			// ...switch on selected drivers
 			else if(HSd.drvOn[i] > 0) {
-				if(debug) {
-					Serial.print("\nSwitching on drivers "); Serial.print(HSd.drvOn[i], BIN);
-					Serial.print(" on slave#"); Serial.println(i, DEC);
-				}
-				addr = HSd.i2cSwitchAddress[i];
-				drvMask = HSd.drvOff[i];
-				reset = false;
-				on = true;
-				gain = 3;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
+				hsTrace(trc_slaveCmd, i, (SCMD_DON << 8) | HSd.drvOn[i]);
+				setupSlaveDrv(i, HSd.drvOn[i], false, true, 3);
 
 				HSd.drvOn[i] = 0;
 			}
+			
 			// ...send coordinate values
-			else if(HSd.indexCnt[i] > 0) {
-				if(debug) {
-					Serial.print("\nSending piezo settings to slave #"); Serial.println(i, DEC);
-				}
-				
-				addr = HSd.i2cSwitchAddress[i];
-				drvMask = ~HSd.drvBm[i] & HSd.drvOldBm[i];
-				reset = false;
-				on = false;
-				gain = 0;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
-
-				drvMask = HSd.drvBm[i];
-				on = true;
-				gain = 3;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
-				
-				sendToSlave(HSd.i2cSlaveAddress[i], HSd.outputIndex[i], HSd.indexCnt[i]);
-				
-				HSd.indexCnt[i] = 0;
-				HSd.drvOldBm[i] = HSd.drvBm[i];
-				HSd.drvBm[i] = 0;
+			if(off) {
+				// relays were just closed, ignore the coordinates
 			}
-			// ...no coordinate received, switch off piezos & drivers
-			else if(HSd.indexCnt[i] == 0) {
-				if(debug) {
-					Serial.print("No coordinate received for slave#"); Serial.print(i, DEC);
-					Serial.println(". Closing relays & switching off drivers.");
+			else if((HSd.indexCnt[i] > 0) || (bitmapPending && (HSd.drvBm[i] > 0))) {
+				if(bitmapPending) {
+					updateSlaveSet(i, HSd.piezoBm[i], NULL, HS_PIEZO_MAX, refresh);
+				} else {
+					updateSlave(i, HSd.outputIndex[i], HSd.indexCnt[i], refresh);
 				}
-				addr = HSd.i2cSwitchAddress[i];
-				drvMask = 0xFF;
-				reset = false;
-				on = false;
-				gain = 0;
-				// setupSlaveDrv(addr, drvMask, reset, on, gain);
-
-				sendToSlave(HSd.i2cSlaveAddress[i], NULL, 0);
 			}
-		// }
+			// ...no coordinate received, switch off the piezos (the drivers
+			// are left to the power scheduler)
+			else {
+				updateSlave(i, NULL, 0, refresh);
+			}
+			
+			HSd.indexCnt[i] = 0;
+			HSd.drvOldBm[i] = HSd.drvBm[i];
+			HSd.drvBm[i] = 0;
+		// }
+	}
+	
+	// Latch the new sets of all slaves at once
+	commitSlaves();
+	
+	// Play the requested waveforms on the piezos just latched
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		drvPlay(i);
+	}
+	
+	// Drivers to wake around the touches, once the frame has left the bus
+	drvPowerFrame(act);
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | slavesReady / slaveProbe / slaveStep / slaveLost / slaveHealth			| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+bool slavesReady(void)
+{
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		if(slaveSt.state[i] != slave_ready) return false;
+	}
+	return true;
+}
+
+// Read the poll reply of slave sn (slaveProbeResult). The worst receive ->
+// latch time it carries is kept for pollSlaves().
+uint8_t slaveProbe(uint8_t sn)
+{
+	uint8_t reply[I2C_POLL_LENGTH];
+	
+	if(i2cQueueRead(hsSlaveAddr(sn), reply, I2C_POLL_LENGTH) != I2C_POLL_LENGTH) return probe_none;
+	if(reply[0] != hsSlaveAddr(sn)) return probe_none;
+	
+	uint16_t c = reply[1] | (reply[2] << 8);
+	if(c > slaveSt.pollCycles[sn]) slaveSt.pollCycles[sn] = c;
+	return (reply[3]) ? probe_registered : probe_booted;
+}
+
+// One step of the registration of slave sn, returns true if it progressed:
+// probe -> reset the drivers (one at a time, to find the present ones) ->
+// switch them on, notify the slave and switch its relays off
+bool slaveStep(uint8_t sn)
+{
+	uint8_t bit = pgm_read_byte(&hsBit[sn]);
+	
+	switch(slaveSt.state[sn]) {
+		case slave_missing:
+			if(slaveProbe(sn) == probe_none) return false;
+			HSd.i2cSlaveAvailable[sn] = true;
+			notifySlave(hsSlaveAddr(sn), false);
+			slaveSt.state[sn] = slave_found;
+			break;
+		
+		case slave_found:
+			HSd.i2cSlaveSetup[sn] = 0xFF;
+			setupSlaveDrv(sn, 0xFF, true, false, 0);
+			slaveSt.state[sn] = slave_reset;
+			break;
+		
+		case slave_reset:
+			// the drivers that did not acknowledge their reset are known
+			// once the resets have left the bus (drvWriteDone)
+			if(!i2cQueueIdle()) return false;
+			i2cQueueService();
+			setupSlaveDrv(sn, HSd.i2cSlaveSetup[sn], false, true, 3);
+			notifySlave(hsSlaveAddr(sn), (HSd.i2cSlaveSetup[sn] == 0xFF));
+			
+			// Toggle sync pin for time measurement
+			syncPinState = !syncPinState;
+			digitalWrite(SYNC_PIN_1, syncPinState);
+			
+			// Switch off all relays, the other slaves have nothing staged
+			HSd.piezoShadowValid[sn] = false;
+			updateSlave(sn, NULL, 0, true);
+			commitSlaves();
+			
+			slaveSt.state[sn] = slave_ready;
+			if(slaveSt.lost & bit) {
+				uint32_t ms = millis() - slaveSt.lostAt[sn];
+				slaveSt.recoveryMs[sn] = (ms < 0xFFFF) ? ms : 0xFFFF;
+				if(slaveSt.recoveries[sn] < 0xFF) slaveSt.recoveries[sn] += 1;
+				slaveSt.lost &= ~bit;
+			}
+			break;
+		
+		default:
+			return false;
+	}
+	hsTrace(trc_slave, sn, slaveSt.state[sn]);
+	return true;
+}
+
+// Slave sn stopped answering (slave_missing) or answers unregistered after a
+// reboot (slave_found): its drivers, i2c switch and relays are unknown again
+void slaveLost(uint8_t sn, uint8_t state)
+{
+	uint8_t bit = pgm_read_byte(&hsBit[sn]);
+	
+	if(!(slaveSt.lost & bit)) {
+		slaveSt.lost |= bit;
+		slaveSt.lostAt[sn] = millis();
+	}
+	slaveSt.state[sn] = state;
+	HSd.i2cSlaveAvailable[sn] = (state != slave_missing);
+	HSd.i2cSlaveSetup[sn] = 0;
+	HSd.piezoShadowValid[sn] = false;
+	HSd.i2cSwitchOpen[sn] = I2C_SWITCH_UNKNOWN;
+	drvInvalidate(sn, 0xFF);
+	hsTrace(trc_slave, sn, state);
+}
+
+// Between frames (serial frame handled, bus idle): finish the registrations
+// in progress one step at a time, then probe the slaves whose writes failed,
+// one slave every SLAVE_HEALTH_MS in turn and the missing ones.
+void slaveHealth(void)
+{
+	if(framePending || !i2cQueueIdle()) return;
+	
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		if((slaveSt.state[i] == slave_found) || (slaveSt.state[i] == slave_reset)) {
+			slaveStep(i);
+			return;
+		}
+	}
+	
+	if((SLAVE_HEALTH_MS > 0) && ((millis() - slaveSt.last) >= SLAVE_HEALTH_MS)) {
+		slaveSt.last = millis();
+		slaveSt.check |= pgm_read_byte(&hsBit[slaveSt.next]);
+		slaveSt.next = (slaveSt.next + 1) % HS_SLAVE_NUMBER;
+		for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+			if(slaveSt.state[i] == slave_missing) slaveSt.check |= pgm_read_byte(&hsBit[i]);
+		}
+	}
+	if(slaveSt.check == 0) return;
+	
+	// one probe per pass
+	uint8_t sn = 0;
+	while(!(slaveSt.check & pgm_read_byte(&hsBit[sn]))) sn++;
+	slaveSt.check &= ~pgm_read_byte(&hsBit[sn]);
+	
+	if(slaveSt.state[sn] == slave_missing) {
+		slaveStep(sn);
+		return;
+	}
+	switch(slaveProbe(sn)) {
+		case probe_none:
+			slaveLost(sn, slave_missing);
+			break;
+		case probe_booted:
+			slaveLost(sn, slave_found);
+			break;
+		default:
+			HSd.i2cSlaveAvailable[sn] = true;	// a failed write only
+			break;
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | setupSlaveDrv															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Reset, switch on or put in standby the drivers dbm of slave sn. The writes
+// are queued: a failed one forgets the state of its drivers (drvWriteDone).
+void setupSlaveDrv(uint8_t sn, uint8_t dbm, bool reset, bool on, uint8_t gain)
+{
+	uint8_t data[2];
+	uint8_t mask;
+	
+	// Setup commands...		
+	// ...reset
+	if(reset) {
+		// reset the drivers one at a time, so that the acknowledge tells which
+		// ones are present
+		for(uint8_t i = 0; i < HS_DPS; i++) {
+			mask = pgm_read_byte(&hsBit[i]);
+			if(dbm & mask) {
+				data[0] = DEV_RST;
+				drvWrite(sn, mask, DRV2667_REG02, data, 1);
+				HSd.drvReg1[sn][i] = 0;
+				HSd.drvReg2[sn][i] = STANDBY;
+				HSd.drvSeq[sn][i] = 0;
+				HSd.drvWaves[sn][i] = 0;
+			}
+		}
+		hsTrace(trc_drvReset, sn, dbm);
+	}
+  
+	// ...switch on
+	if(on) {
+		uint8_t r1 = INPUT_MUX | gain;
+		uint8_t wake = 0;
+		uint8_t cfg = 0;
+		
+		// only the drivers whose shadowed registers differ need to be written
+		for(uint8_t i = 0; i < HS_DPS; i++) {
+			mask = pgm_read_byte(&hsBit[i]);
+			if(dbm & mask) {
+				if(HSd.drvReg2[sn][i] != EN_OVERRIDE) wake |= mask;
+				if((HSd.drvReg2[sn][i] != EN_OVERRIDE) || (HSd.drvReg1[sn][i] != r1)) cfg |= mask;
+			}
+		}
+		hsTrace(trc_drvOn, sn, (wake << 8) | cfg);
+
+		// wake up (all sleeping drivers at once)
+		if(wake) {
+			data[0] = GO;
+			drvWrite(sn, wake, DRV2667_REG02, data, 1);
+			drvShadow(sn, wake, DRV2667_REG02, GO);
+		}
+		
+		// set mux & gain and enable amplifier (REG01 & REG02 in one auto-incremented write)
+		if(cfg) {
+			data[0] = r1;
+			data[1] = EN_OVERRIDE;
+			drvWrite(sn, cfg, DRV2667_REG01, data, 2);
+			drvShadow(sn, cfg, DRV2667_REG01, r1);
+			drvShadow(sn, cfg, DRV2667_REG02, EN_OVERRIDE);
+		}
+	}
+	// ...switch off
+	else {
+		uint8_t standby = 0;
+		for(uint8_t i = 0; i < HS_DPS; i++) {
+			mask = pgm_read_byte(&hsBit[i]);
+			if((dbm & mask) && (HSd.drvReg2[sn][i] != STANDBY)) standby |= mask;
+		}
+		hsTrace(trc_drvOff, sn, standby);
+		
+		if(standby) {
+			data[0] = STANDBY;
+			drvWrite(sn, standby, DRV2667_REG02, data, 1);
+			drvShadow(sn, standby, DRV2667_REG02, STANDBY);
+		}
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | drvSwitch / drvSelect / drvWrite / drvRead / drvShadow / drvInvalidate	| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Open the channels in mask of the i2c switch of slave sn (several at once to
+// broadcast to their drivers). The open channels are tracked to skip
+// redundant writes, drvSwitchDone makes them unknown if the write fails.
+void drvSwitch(uint8_t sn, uint8_t mask)
+{
+	if(mask == HSd.i2cSwitchOpen[sn]) return;
+	
+	struct i2cXfer *x = i2cQueueAlloc();
+	x->addr = hsSwitchAddr(sn);
+	x->data[0] = mask;
+	x->len = 1;
+	x->tag = (sn << 8) | mask;
+	x->done = drvSwitchDone;
+	i2cQueueSubmit(x);
+	HSd.i2cSwitchOpen[sn] = mask;
+}
+
+// Open the channels of the drivers in mask on slave sn. The drivers of all
+// slaves share the same address, so the switches of the others are closed
+// (an unanswered switch is taken as closed). Channels are left open until
+// another set of drivers is addressed.
+void drvSelect(uint8_t sn, uint8_t mask)
+{
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		if((i != sn) && (HSd.i2cSwitchOpen[i] != 0)) drvSwitch(i, 0);
+	}
+	drvSwitch(sn, mask);
+}
+
+// Queue a write of consecutive registers to every drv2667 in mask on slave sn
+void drvWrite(uint8_t sn, uint8_t mask, uint8_t reg, const uint8_t *data, uint8_t len)
+{
+	drvSelect(sn, mask);
+	
+	struct i2cXfer *x = i2cQueueAlloc();
+	if(len > (I2C_XFER_DATA - 1)) len = I2C_XFER_DATA - 1;
+	x->addr = DRV2667_I2C_ADDRESS;
+	x->data[0] = reg;
+	for(uint8_t i = 0; i < len; i++) {
+		x->data[i+1] = data[i];
+	}
+	x->len = len + 1;
+	x->tag = (sn << 8) | mask;
+	x->done = drvWriteDone;
+	i2cQueueSubmit(x);
+}
+
+// Completion of a switch write (tag: slave << 8 | channels). Channels that did
+// not open may leave others open: every driver of the slave is written again
+// next time, and while it registers, the drivers behind them are not found.
+void drvSwitchDone(struct i2cXfer *x)
+{
+	uint8_t sn = x->tag >> 8;
+	uint8_t mask = x->tag;
+	
+	hsTrace(trc_switch, x->addr, (x->status << 8) | mask);
+	if((x->status == I2C_XFER_OK) || (mask == 0)) return;
+	HSd.i2cSwitchOpen[sn] = I2C_SWITCH_UNKNOWN;
+	drvInvalidate(sn, 0xFF);
+	if(slaveSt.state[sn] != slave_ready) HSd.i2cSlaveSetup[sn] &= ~mask;
+}
+
+// Completion of a driver write (tag: slave << 8 | drivers). The drivers of a
+// failed write are written again next time, the ones that do not acknowledge
+// their reset are absent.
+void drvWriteDone(struct i2cXfer *x)
+{
+	uint8_t sn = x->tag >> 8;
+	uint8_t mask = x->tag;
+	
+	hsTrace(trc_drvReg, x->data[0], (x->status << 8) | x->data[1]);
+	if(x->status == I2C_XFER_OK) return;
+	drvInvalidate(sn, mask);
+	if((x->data[0] == DRV2667_REG02) && (x->data[1] == DEV_RST)) HSd.i2cSlaveSetup[sn] &= ~mask;
+}
+
+// Read consecutive registers of the drv2667 behind the opened channels (with
+// several channels open, the bits read are the AND of all drivers). Blocking,
+// after the transactions already queued.
+uint8_t drvRead(uint8_t reg, uint8_t *data, uint8_t len)
+{
+	if(i2cQueueWrite(DRV2667_I2C_ADDRESS, &reg, 1) != 0) return 0;
+	return i2cQueueRead(DRV2667_I2C_ADDRESS, data, len);
+}
+
+// Update the register shadow of the drivers in mask
+void drvShadow(uint8_t sn, uint8_t mask, uint8_t reg, uint8_t val)
+{
+	for(uint8_t i = 0; i < HS_DPS; i++) {
+		if(mask & pgm_read_byte(&hsBit[i])) {
+			if(reg == DRV2667_REG01) HSd.drvReg1[sn][i] = val;
+			else HSd.drvReg2[sn][i] = val;
+		}
+	}
+}
+
+// Forget the register state of the drivers in mask (rewritten next time)
+void drvInvalidate(uint8_t sn, uint8_t mask)
+{
+	drvShadow(sn, mask, DRV2667_REG01, DRV_REG_UNKNOWN);
+	drvShadow(sn, mask, DRV2667_REG02, DRV_REG_UNKNOWN);
+	for(uint8_t i = 0; i < HS_DPS; i++) {
+		if(mask & pgm_read_byte(&hsBit[i])) {
+			HSd.drvSeq[sn][i] = DRV_REG_UNKNOWN;
+			HSd.drvWaves[sn][i] = 0;
+		}
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | drvPlay / drvUpload													| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Play the waveforms requested on the drivers of slave sn. Once a waveform is
+// resident, selected in the sequencer and the driver in digital mode, the
+// trigger is a single GO write (all drivers playing it at once).
+void drvPlay(uint8_t sn)
+{
+	for(uint8_t w = 0; w < DRV_WAVES; w++) {
+		uint8_t play = 0;
+		uint8_t load = 0;
+		uint8_t cfg = 0;
+		uint8_t seq = 0;
+		uint8_t data[2];
+		
+		for(uint8_t i = 0; i < HS_DPS; i++) {
+			if(HSd.waveReq[sn][i] != w) continue;
+			uint8_t mask = pgm_read_byte(&hsBit[i]);
+			HSd.waveReq[sn][i] = DRV_WAVE_NONE;
+			play |= mask;
+			if(!(HSd.drvWaves[sn][i] & pgm_read_byte(&hsBit[w]))) load |= mask;
+			if(HSd.drvReg1[sn][i] != DRV_WAVE_GAIN) cfg |= mask;
+			if(HSd.drvSeq[sn][i] != (w + 1)) seq |= mask;
+		}
+		if(!play || !HSd.i2cSlaveAvailable[sn]) continue;
+		
+		hsTrace(trc_wave, w, (sn << 8) | play);
+		
+		// ...upload it where it is not resident yet
+		if(load) drvUpload(sn, load, w);
+		
+		// ...digital input (leaves the analog mode of SCMD_DON)
+		if(cfg) {
+			data[0] = DRV_WAVE_GAIN;
+			drvWrite(sn, cfg, DRV2667_REG01, data, 1);
+			drvShadow(sn, cfg, DRV2667_REG01, DRV_WAVE_GAIN);
+		}
+		// ...sequence: this waveform only
+		if(seq) {
+			data[0] = w + 1;
+			data[1] = 0;
+			drvWrite(sn, seq, DRV2667_REG03, data, 2);
+			for(uint8_t i = 0; i < HS_DPS; i++) {
+				if(seq & pgm_read_byte(&hsBit[i])) HSd.drvSeq[sn][i] = w + 1;
+			}
+		}
+		// ...and go
+		data[0] = GO;
+		drvWrite(sn, play, DRV2667_REG02, data, 1);
+		drvShadow(sn, play, DRV2667_REG02, GO);
+		drvPowerKeep(sn, play);
+	}
+}
+
+// Upload waveform w into the RAM of the drivers in mask (header entry and
+// synthesizer entries, on the first RAM page). The waveform is taken as
+// resident before the writes are queued, a failed one forgets it again.
+void drvUpload(uint8_t sn, uint8_t mask, uint8_t w)
+{
+	uint8_t buf[WAV_HDR_BYTES];
+	uint8_t at = 1 + (DRV_WAVES * WAV_HDR_BYTES) + pgm_read_byte(&drvWaveIndex[w][0]);
+	uint8_t len = pgm_read_byte(&drvWaveIndex[w][1]) * WAV_SYN_BYTES;
+	
+	for(uint8_t i = 0; i < HS_DPS; i++) {
+		if(mask & pgm_read_byte(&hsBit[i])) HSd.drvWaves[sn][i] |= pgm_read_byte(&hsBit[w]);
+	}
+	hsTrace(trc_upload, w, (mask << 8) | len);
+	
+	buf[0] = DRV2667_RAM_PAGE;
+	drvWrite(sn, mask, DRV2667_REGFF, buf, 1);
+	
+	// header size, then the header entry of ID w + 1
+	buf[0] = DRV_WAVES * WAV_HDR_BYTES;
+	drvWrite(sn, mask, 0x00, buf, 1);
+	buf[0] = WAV_HDR_SYNTH;
+	buf[1] = at;
+	buf[2] = 0;
+	buf[3] = at + len - 1;
+	buf[4] = pgm_read_byte(&drvWaveIndex[w][2]);
+	drvWrite(sn, mask, 1 + (w * WAV_HDR_BYTES), buf, WAV_HDR_BYTES);
+	
+	// synthesizer entries, one at a time
+	for(uint8_t i = 0; i < len; i += WAV_SYN_BYTES) {
+		for(uint8_t j = 0; j < WAV_SYN_BYTES; j++) {
+			buf[j] = pgm_read_byte(&drvWaveData[pgm_read_byte(&drvWaveIndex[w][0]) + i + j]);
+		}
+		drvWrite(sn, mask, at + i, buf, WAV_SYN_BYTES);
 	}
+	
+	// back to the control registers
+	buf[0] = 0;
+	drvWrite(sn, mask, DRV2667_REGFF, buf, 1);
 }
 
 
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-/* | registerSlave															| */
+/* | drvFifoPush / drvFifoService											| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-void registerSlave(void)
+// Buffer the samples of a SCMD_FIFO frame (two per pair)
+void drvFifoPush(const uint8_t (*in)[2], uint8_t len)
 {
-	uint8_t receivedAddr;
-  
-	if(debug) {
-		Serial.println("Registering slaves...");
-		Serial.println("----------------------------------------");
+	for(uint8_t i = 0; i < len; i++) {
+		for(uint8_t j = 0; j < 2; j++) {
+			if((uint8_t)(drvFifo.head - drvFifo.tail) >= DRV_FIFO_RING) {
+				drvFifo.dropped++;
+				continue;
+			}
+			drvFifo.ring[drvFifo.head & DRV_FIFO_MASK] = in[i][j];
+			drvFifo.head++;
+		}
 	}
+}
 
-	// Registering each slave...
-	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
-		// If registration doesn't succeed, retry several times to be sure
-		for(uint8_t j = 0; j < SLAVE_REG_RETRIES; j++) {
-			Wire.requestFrom(HSd.i2cSlaveAddress[i], 1);
-			while(Wire.available()) {
-				receivedAddr = Wire.read();
-				if(receivedAddr == HSd.i2cSlaveAddress[i]) {
-					HSd.i2cSlaveAvailable[i] = true;
-					j = SLAVE_REG_RETRIES;
-				} else {
-					HSd.i2cSlaveAvailable[i] = false;
-				}
-			}
+// Refill the FIFO of the streaming drivers. Their level is estimated from
+// the time elapsed at DRV2667_FIFO_RATE and corrected with FIFO_FULL /
+// FIFO_EMPTY whenever it gets low: the data writes are then queued without
+// waiting for the bus.
+void drvFifoService(void)
+{
+	uint8_t avail = drvFifo.head - drvFifo.tail;
+	uint8_t status;
+	
+	if(!drvFifo.mask) return;
+	
+	// samples played since the last estimate (125 us each at 8 kHz)
+	uint32_t now = micros();
+	uint32_t played = (now - drvFifo.last) / (1000000 / DRV2667_FIFO_RATE);
+	drvFifo.last += played * (1000000 / DRV2667_FIFO_RATE);
+	drvFifo.level = (played < drvFifo.level) ? (drvFifo.level - played) : 0;
+	
+	if(!drvFifo.running) {
+		drvFifo.last = now;
+		if(avail < DRV_FIFO_PREFILL) return;
+	} else if(avail == 0) {
+		if(drvFifo.level == 0) drvFifo.running = false;
+		return;
+	}
+	if((drvFifo.level >= DRV_FIFO_LOW) || !i2cQueueIdle()) return;
+	
+	// digital input and out of standby (the FIFO enables the amplifier)
+	uint8_t cfg = 0;
+	for(uint8_t i = 0; i < HS_DPS; i++) {
+		if(!(drvFifo.mask & pgm_read_byte(&hsBit[i]))) continue;
+		uint8_t r2 = HSd.drvReg2[drvFifo.sn][i];
+		if((HSd.drvReg1[drvFifo.sn][i] != DRV_WAVE_GAIN) || (r2 == STANDBY) || (r2 == DRV_REG_UNKNOWN)) {
+			cfg |= pgm_read_byte(&hsBit[i]);
 		}
+	}
+	if(cfg) {
+		uint8_t data[2] = { DRV_WAVE_GAIN, 0 };
+		drvWrite(drvFifo.sn, cfg, DRV2667_REG01, data, 2);
+		drvShadow(drvFifo.sn, cfg, DRV2667_REG01, DRV_WAVE_GAIN);
+		drvShadow(drvFifo.sn, cfg, DRV2667_REG02, 0);
+	}
+	
+	// (the read runs the callbacks of the writes queued before it)
+	drvSelect(drvFifo.sn, drvFifo.mask);
+	if((drvRead(DRV2667_REG00, &status, 1) != 1) || (HSd.i2cSwitchOpen[drvFifo.sn] != drvFifo.mask)) {
+		drvInvalidate(drvFifo.sn, drvFifo.mask);
+		drvFifo.mask = 0;
+		return;
+	}
+	if(status & FIFO_FULL) {
+		drvFifo.level = DRV2667_FIFO_SIZE;
+		return;
+	}
+	if(status & FIFO_EMPTY) {
+		if(drvFifo.running) drvFifo.underruns++;
+		drvFifo.level = 0;
+	}
+	drvFifo.running = true;
+	
+	// fill the free room, I2C_XFER_DATA - 1 samples per write
+	uint8_t room = DRV2667_FIFO_SIZE - drvFifo.level;
+	while((room > 0) && (avail > 0)) {
+		uint8_t n = I2C_XFER_DATA - 1;
+		if(n > room) n = room;
+		if(n > avail) n = avail;
 		
-		if(debug) {
-			Serial.print("Slave @ address 0x"); Serial.print(HSd.i2cSlaveAddress[i], HEX);
-			Serial.println((HSd.i2cSlaveAvailable[i]) ? " available" : " NOT available");
+		struct i2cXfer *x = i2cQueueAlloc();
+		x->addr = DRV2667_I2C_ADDRESS;
+		x->data[0] = DRV2667_REG0B;
+		for(uint8_t i = 0; i < n; i++) {
+			x->data[i+1] = drvFifo.ring[drvFifo.tail & DRV_FIFO_MASK];
+			drvFifo.tail++;
 		}
+		x->len = n + 1;
+		i2cQueueSubmit(x);
 		
-		if(HSd.i2cSlaveAvailable[i] == true) {
-			notifySlave(HSd.i2cSlaveAddress[i], false);
-		}
-	}
-	
-	if(debug) {
-		Serial.println("");
+		room -= n;
+		avail -= n;
+		drvFifo.level += n;
 	}
 }
 
 
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-/* | setupSlaveDrv															| */
+/* | drvPowerFrame / drvPowerIdle / drvPowerWake / reportPower				| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-uint8_t setupSlaveDrv(int8_t addr, uint8_t dbm, bool reset, bool on, uint8_t gain)
+// Haptic columns of the drivers set in the per-slave masks dbm
+uint32_t drvPowerCols(const uint8_t *dbm)
 {
-	int8_t i2cRet;
-	uint8_t retVal = 0;
-	bool activeDrv[HS_DPS];
+	uint32_t cols = 0;
+	uint8_t col = 0;
 	
-	// Test which driver the current command is for
-	for(uint8_t i = 0; i < HS_DPS; i++) {
-		activeDrv[i] = ((dbm >> i) & 1) ? true : false;
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		cols |= (uint32_t)dbm[i] << col;
+		col += hsSlaveCols(i);
 	}
+	return cols & DRV_POWER_COLS;
+}
+
+// Count the columns touched since the last frame as hits (driver awake) or
+// misses, and mark the drivers of the touched columns, of their neighbours
+// and of the columns a touch moving sideways is heading for to be woken.
+// drvPowerIdle() wakes them when the bus is idle and no frame waits for it.
+void drvPowerFrame(uint32_t act)
+{
+	uint16_t now = millis();
+	uint32_t down = act & ~drvPw.act;
+	uint32_t need = act;
 	
-	// Setup commands...		
-	// ...reset
-	if(reset) {
-		if(debug) {
-			Serial.println("\nResetting drv2667...");
-			Serial.print("- addressing i2c switch @ 0x"); Serial.println(addr, HEX);
+	if(drvPw.ahead) {
+		uint32_t right = down & (drvPw.act << 1);
+		uint32_t left = down & (drvPw.act >> 1);
+		
+		for(uint8_t k = 1; k <= DRV_WAKE_SPREAD; k++) {
+			need |= (act << k) | (act >> k);
 		}
-
-		// open each i2c switch channel and send reset command to the attached drv2667
-		for(uint8_t i = 0; i < HS_DPS; i++) {
-			if(activeDrv[i]) {
-				// open switch
-				Wire.beginTransmission(addr);		
-				Wire.write((uint8_t)(1 << i));
-				i2cRet = Wire.endTransmission();
-				if(debug) {
-					Serial.print("\n- opening switch #"); Serial.print(i, DEC);
-					if(i2cRet == 0) {
-						Serial.println("\t\t\tsuccess!");
-					} else {
-						Serial.println("\t\t\tERROR!");
-					}
-				}
-			
-				// reset driver
-				Wire.beginTransmission(DRV2667_I2C_ADDRESS);
-				Wire.write(DRV2667_REG02);
-				Wire.write(DEV_RST);
-				i2cRet = Wire.endTransmission();
-				bool r0 = (i2cRet == 0) ? true : false;
-				if(debug) {
-					Serial.print("- resetting device");
-					if(i2cRet == 0) {
-						Serial.println("\t\t\tsuccess!");
-					} else {
-						Serial.println("\t\t\tERROR!");
-					}
-				}
-				
-				if(r0) retVal |= (1 << i);
-				else retVal &= ~(1 << i);
-			}
+		for(uint8_t k = DRV_WAKE_SPREAD + 1; k <= (DRV_WAKE_SPREAD + DRV_WAKE_AHEAD); k++) {
+			need |= (right << k) | (left >> k);
 		}
+		need &= DRV_POWER_COLS;
+	}
+	drvPw.act = act;
+	if(need == 0) return;
+	
+	uint8_t col = 0;
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		uint8_t wake = 0;
 		
-		// close switch
-		Wire.beginTransmission(addr);
-		Wire.write(0);
-		i2cRet = Wire.endTransmission();
-		if(debug) {
-			Serial.print("\n- closing i2c switch");
-			if(i2cRet == 0) {
-				Serial.println("\t\t\tsuccess!\n");
-			} else {
-				Serial.println("\t\t\tERROR!\n");
+		for(uint8_t j = 0; j < hsSlaveCols(i); j++, col++) {
+			uint32_t bit = 1UL << col;
+			uint8_t mask = pgm_read_byte(&hsBit[j]);
+			uint8_t r2 = HSd.drvReg2[i][j];
+			
+			if(!(need & bit)) continue;
+			drvPw.need[i][j] = now;
+			if((drvPw.waking[i] & mask) && ((uint16_t)(now - drvPw.woke[i][j]) >= DRV_WAKE_MS)) {
+				drvPw.waking[i] &= ~mask;
 			}
+			if(down & bit) {
+				if((r2 == STANDBY) || (r2 == DRV_REG_UNKNOWN) || (drvPw.waking[i] & mask)) drvPw.misses++;
+				else drvPw.hits++;
+			}
+			if(r2 == STANDBY) wake |= mask;
 		}
+		drvPw.wake[i] |= wake;
 	}
-  
-	// ...switch on
-	if(on) {
-		if(debug) {
-			Serial.println("Starting up drv2667...");
-			Serial.print("- addressing i2c switch @ 0x"); Serial.println(addr, HEX);
-		}
-
-		// open each i2c switch channel and send settings to the attached drv2667
-		for(uint8_t i = 0; i < HS_DPS; i++) {
-			if(activeDrv[i]) {
-				// open switch
-				Wire.beginTransmission(addr);
-				Wire.write((uint8_t)(1 << i));
-				i2cRet = Wire.endTransmission();
-				if(debug) {
-					Serial.print("\n- opening switch #"); Serial.print(i, DEC);
-					if(i2cRet == 0) {
-						Serial.println("\t\t\tsuccess!");					
-					} else {
-						Serial.println("\t\t\tERROR!");					
-					}
-				}
-			
-				// wake up
-				Wire.beginTransmission(DRV2667_I2C_ADDRESS);
-				Wire.write(DRV2667_REG02);
-				Wire.write(GO);
-				i2cRet = Wire.endTransmission();
-				bool r0 = (i2cRet == 0) ? true : false;
-				if(debug) {
-					Serial.print("- waking up");
-					if(i2cRet == 0) {
-						Serial.println("\t\t\t\t\tsuccess!");
-					} else {
-						Serial.println("\t\t\t\t\tERROR!");
-					}
-				}
+}
 
-				// set mux & gain
-				Wire.beginTransmission(DRV2667_I2C_ADDRESS);
-				Wire.write(DRV2667_REG01);
-				Wire.write(INPUT_MUX | gain);
-				i2cRet = Wire.endTransmission();
-				bool r1 = (i2cRet == 0) ? true : false;
-				if(debug) {
-					Serial.print("- setting MUX&GAIN to 0x:"); Serial.print((INPUT_MUX | gain), HEX);
-					if(i2cRet == 0) {
-						Serial.println("\tsuccess!");
-					} else {
-						Serial.println("\tERROR!");
-					}
-				}
+// Between frames, wake the drivers marked by the last frames, then put the
+// drivers not needed for the hold time in standby (the streaming ones
+// excepted), or wake them all if the scheduler is off
+void drvPowerIdle(void)
+{
+	if(framePending || !i2cQueueIdle()) return;
+	
+	uint16_t now = millis();
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		uint8_t wake = 0;
+		for(uint8_t j = 0; j < HS_DPS; j++) {
+			uint8_t mask = pgm_read_byte(&hsBit[j]);
+			if((drvPw.wake[i] & mask) && (HSd.drvReg2[i][j] == STANDBY)) wake |= mask;
+		}
+		drvPw.wake[i] = 0;
+		drvPowerWake(i, wake, now);
+	}
+	
+	if((uint16_t)(now - drvPw.last) < DRV_POWER_CHECK_MS) return;
+	drvPw.last = now;
+	
+	uint8_t col = 0;
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		uint8_t idle = 0;
+		uint8_t wake = 0;
+		
+		for(uint8_t j = 0; j < hsSlaveCols(i); j++, col++) {
+			uint8_t mask = pgm_read_byte(&hsBit[j]);
+			uint8_t r2 = HSd.drvReg2[i][j];
 			
-				// enable amplifier
-				Wire.beginTransmission(DRV2667_I2C_ADDRESS);
-				Wire.write(DRV2667_REG02);
-				Wire.write(EN_OVERRIDE);
-				i2cRet = Wire.endTransmission();
-				bool r2 = (i2cRet == 0) ? true : false;
-				if(debug) {
-					Serial.print("- enabling amplifier");
-					if(i2cRet == 0) {
-						Serial.println("\t\t\tsuccess!");
-					} else {
-						Serial.println("\t\t\tERROR!");
-					}
-				}
-				
-				if(r0 && r1 && r2) retVal |= (1 << i);
-				else retVal &= ~(1 << i);
+			if(!(DRV_POWER_COLS & (1UL << col))) continue;
+			if((uint16_t)(now - drvPw.woke[i][j]) >= DRV_WAKE_MS) drvPw.waking[i] &= ~mask;
+			if(drvPw.hold == 0) {
+				if(r2 == STANDBY) wake |= mask;
+			} else if((r2 != STANDBY) && (r2 != DRV_REG_UNKNOWN) && ((uint16_t)(now - drvPw.need[i][j]) >= drvPw.hold)) {
+				idle |= mask;
 			}
 		}
+		if(drvFifo.sn == i) idle &= ~drvFifo.mask;
+		if(slaveSt.state[i] != slave_ready) continue;
 		
-		// close i2c switch
-		Wire.beginTransmission(addr);
-		Wire.write(0);
-		i2cRet = Wire.endTransmission();
-		// initOk = ((retVal == 0) && (initOk == true)) ? true : false;
-		if(debug) {
-			Serial.print("\n- closing i2c switch");
-			if(i2cRet == 0) {
-				Serial.println("\t\t\tsuccess!");
-			} else {
-				Serial.println("\t\t\tERROR!");
+		drvPowerWake(i, wake, now);
+		if(idle) {
+			setupSlaveDrv(i, idle, false, false, 0);
+			for(uint8_t j = 0; j < HS_DPS; j++) {
+				if(idle & pgm_read_byte(&hsBit[j])) drvPw.sleeps++;
 			}
 		}
-		
-		
 	}
-	// ...switch off
-	else {
-		if(debug) {
-			Serial.println("Switching off drv2667...");
-			Serial.print("- addressing i2c switch @ 0x"); Serial.println(addr, HEX);
+}
+
+// Wake the drivers dbm of slave sn (analog input, as SCMD_DON)
+void drvPowerWake(uint8_t sn, uint8_t dbm, uint16_t now)
+{
+	if((dbm == 0) || (slaveSt.state[sn] != slave_ready)) return;
+	
+	setupSlaveDrv(sn, dbm, false, true, 3);
+	for(uint8_t j = 0; j < HS_DPS; j++) {
+		if(dbm & pgm_read_byte(&hsBit[j])) {
+			drvPw.woke[sn][j] = now;
+			drvPw.wakes++;
 		}
-		
-		// open each i2c switch channel and send standby command to the attached drv2667
-		for(uint8_t i = 0; i < HS_DPS; i++) {
-			if(activeDrv[i]) {
-				// open switch
-				Wire.beginTransmission(addr);
-				Wire.write((uint8_t)(1 << i));
-				i2cRet = Wire.endTransmission();
-				if(debug) {
-					Serial.print("\n- opening switch #"); Serial.print(i, DEC);
-					if(i2cRet == 0) {
-						Serial.println("\t\t\tsuccess!");					
-					} else {
-						Serial.println("\t\t\tERROR!");					
-					}
-				}
-      
-				Wire.beginTransmission(DRV2667_I2C_ADDRESS);
-				Wire.write(DRV2667_REG02);
-				Wire.write(STANDBY);
-				i2cRet = Wire.endTransmission();
-				bool r0 = (i2cRet == 0) ? true : false;
-				if(debug) {
-					Serial.print("- standing by");
-					if(i2cRet == 0) {
-						Serial.println("\t\t\tsuccess!");					
-					} else {
-						Serial.println("\t\t\tERROR!");					
-					}
-				}
-				
-				if(r0) retVal |= (1 << i);
-				else retVal &= ~(1 << i);
-			}
+	}
+	drvPw.waking[sn] |= dbm;
+}
+
+// Keep the drivers dbm of slave sn awake for the hold time (waveforms)
+void drvPowerKeep(uint8_t sn, uint8_t dbm)
+{
+	uint16_t now = millis();
+	
+	for(uint8_t j = 0; j < HS_DPS; j++) {
+		if(dbm & pgm_read_byte(&hsBit[j])) drvPw.need[sn][j] = now;
+	}
+}
+
+void reportPower(bool reset)
+{
+	uint8_t awake = 0;
+	uint8_t col = 0;
+	
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		for(uint8_t j = 0; j < hsSlaveCols(i); j++, col++) {
+			uint8_t r2 = HSd.drvReg2[i][j];
+			if((DRV_POWER_COLS & (1UL << col)) && (r2 != STANDBY) && (r2 != DRV_REG_UNKNOWN)) awake++;
 		}
-		
-		// close i2c switch
-		Wire.beginTransmission(addr);
-		Wire.write(0);
-		i2cRet = Wire.endTransmission();
-		// initOk = ((retVal == 0) && (initOk == true)) ? true : false;
-		if(debug) {
-			Serial.print("\n- closing i2c switch");
-			if(i2cRet == 0) {
-				Serial.println("\t\t\tsuccess!");
-			} else {
-				Serial.println("\t\t\tERROR!");
-			}
+	}
+	
+	if(debug) {
+		Serial.print("\nDriver power: hold "); Serial.print(drvPw.hold, DEC);
+		Serial.println((drvPw.ahead) ? " ms, wake-ahead" : " ms, touched columns only");
+		Serial.print("- awake: "); Serial.println(awake, DEC);
+		Serial.print("- hits: "); Serial.println(drvPw.hits, DEC);
+		Serial.print("- misses: "); Serial.println(drvPw.misses, DEC);
+		Serial.print("- wakes: "); Serial.println(drvPw.wakes, DEC);
+		Serial.print("- standbys: "); Serial.println(drvPw.sleeps, DEC);
+	} else {
+		uint16_t val[4] = { drvPw.hits, drvPw.misses, drvPw.wakes, drvPw.sleeps };
+		Serial.write(SCMD_POWER);
+		Serial.write(awake);
+		for(uint8_t i = 0; i < 4; i++) {
+			Serial.write((uint8_t)val[i]);
+			Serial.write((uint8_t)(val[i] >> 8));
 		}
+		Serial.write(SERR_CRLF);
 	}
 	
-	return retVal;
+	if(reset) {
+		drvPw.hits = 0;
+		drvPw.misses = 0;
+		drvPw.wakes = 0;
+		drvPw.sleeps = 0;
+	}
 }
 
 
@@ -684,14 +1639,9 @@ uint8_t setupSlaveDrv(int8_t addr, uint8_t dbm, bool reset, bool on, uint8_t gai
 /* -------------------------------------------------------------------------- */
 void notifySlave(int8_t addr, bool notification)
 {
-	Wire.beginTransmission(addr);
-	Wire.write(i2cCmd_notify);
-	Wire.write((notification) ? 1 : 0);
-	Wire.endTransmission();
-	if(debug) {
-		Serial.print("\nSending notification to slave 0x"); Serial.print(addr, HEX);
-		Serial.println((notification) ? ": true\n" : ": false\n");
-	}
+	uint8_t buf[2] = { i2cCmd_notify, (uint8_t)((notification) ? 1 : 0) };
+	i2cQueueWrite(addr, buf, 2);
+	hsTrace(trc_notified, addr, buf[1]);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -699,80 +1649,134 @@ void notifySlave(int8_t addr, bool notification)
 /* | distributeCoordinates													| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-void distributeCoordinates(uint8_t len, uint8_t in[HS_COORD_MAX][2], uint8_t out[HS_SLAVE_NUMBER][HS_COORD_MAX])
+void distributeCoordinates(const struct serialFrame *f, uint8_t out[HS_SLAVE_NUMBER][HS_COORD_MAX])
 {
+	uint8_t len = f->len;
+	uint8_t (*in)[2] = f->coord;
+	uint8_t sel = 0;					// slave of the slave-indexed commands
+	bool coordErr = false;				// bad coordinate in a sequenced frame
 
-	if(debug) {
-		Serial.print("\nDistributing coordinates... pairs: "); Serial.println(len);
-		Serial.println("----------------------------------------");
-	}
-	
 	// For each coordinate pair, the first item is tested.
 	// If it is above a threshold value, a setting mode is entered FOR THE GIVEN PAIR!
 	// Else the pair is processed like a standard coordinate.
 	for(uint8_t i = 0; i < len; i++) {
-		if(debug) {
-			Serial.print("pair#"); Serial.print(i, DEC);
-			Serial.println("...");
-		}
-		
 		// Check (first) if command mode was entered
 		if(in[i][0] >= SCMD_SETTINGS) {
 			bool cmdErr = false;
-			switch(in[i][0]) {
+			hsTrace(trc_cmd, in[i][0], in[i][1]);
+			bool stream = false;
+			uint8_t cmd = in[i][0];
+			uint8_t sn = sel;
+			// Slave-indexed commands apply to the slave selected by SCMD_SLAVE,
+			// their 4-slave aliases (cmd + 1..3) directly to slaves 1 to 3
+			if((cmd >= SCMD_DOFF) && (cmd <= SCMD_FIFO + 3) && ((cmd % 10) <= 3)) {
+				if(cmd % 10) sn = cmd % 10;
+				cmd -= cmd % 10;
+				if(sn >= HS_SLAVE_NUMBER) cmd = 0;
+			}
+			switch(cmd) {
+				// Select the slave# given in orig[i][1] for the slave-indexed commands
+				case SCMD_SLAVE:
+				if(in[i][1] < HS_SLAVE_NUMBER) sel = in[i][1];
+				else cmdErr = true;
+				break;
 				// Switch off all relays of slave# given in orig[i][1]
 				case SCMD_POFF_ALL:
 				if(in[i][1] < HS_SLAVE_NUMBER) HSd.piezoOffAll[in[i][1]] = true;
 				else cmdErr = true;
 				break;
-				// Switch off drivers of slave1 according to the bitmask in orig[i][1]
-				case SCMD_DOFF_S0:
-				HSd.drvOff[0] = in[i][1];
-				break;
-				// Switch off drivers of slave2 according to the bitmask in orig[i][1]
-				case SCMD_DOFF_S1:
-				HSd.drvOff[1] = in[i][1];
-				break;
-				// Switch off drivers of slave3 according to the bitmask in orig[i][1]
-				case SCMD_DOFF_S2:
-				HSd.drvOff[2] = in[i][1];
-				break;
-				// Switch off drivers of slave4 according to the bitmask in orig[i][1]
-				case SCMD_DOFF_S3:
-				HSd.drvOff[3] = in[i][1];
+				// Switch off drivers of the slave according to the bitmask in orig[i][1]
+				case SCMD_DOFF:
+				HSd.drvOff[sn] |= in[i][1];
+				HSd.drvOn[sn] &= ~in[i][1];
 				break;
 				// Switch off all drivers of slave# given in orig[i][1]
 				case SCMD_DOFF_ALL:
-				if(in[i][i] < HS_SLAVE_NUMBER) HSd.drvOffAll[in[i][1]] = true;
+				if(in[i][1] < HS_SLAVE_NUMBER) {
+					HSd.drvOffAll[in[i][1]] = true;
+					HSd.drvOnAll[in[i][1]] = false;
+				}
 				else cmdErr = true;
 				break;
-				// Switch on drivers of slave1 according to the bitmask in orig[i][1]
-				case SCMD_DON_S0:
-				HSd.drvOn[0] = in[i][1];
-				break;
-				// Switch on drivers of slave2 according to the bitmask in orig[i][1]
-				case SCMD_DON_S1:
-				HSd.drvOn[1] = in[i][1];
-				break;
-				// Switch on drivers of slave3 according to the bitmask in orig[i][1]
-				case SCMD_DON_S2:
-				HSd.drvOn[2] = in[i][1];
-				break;
-				// Switch on drivers of slave4 according to the bitmask in orig[i][1]
-				case SCMD_DON_S3:
-				HSd.drvOn[3] = in[i][1];
+				// Switch on drivers of the slave according to the bitmask in orig[i][1]
+				case SCMD_DON:
+				HSd.drvOn[sn] |= in[i][1];
+				HSd.drvOff[sn] &= ~in[i][1];
 				break;
 				// Switch on all drivers of slave# given in orig[i][1]
 				case SCMD_DON_ALL:
-				if(in[i][1] < HS_SLAVE_NUMBER) HSd.drvOnAll[in[i][1]] = true;
+				if(in[i][1] < HS_SLAVE_NUMBER) {
+					HSd.drvOnAll[in[i][1]] = true;
+					HSd.drvOffAll[in[i][1]] = false;
+				}
+				else cmdErr = true;
+				break;
+				// Play the selected waveform on the drivers of the slave
+				case SCMD_WAVE:
+				for(uint8_t j = 0; j < HS_DPS; j++) {
+					if(in[i][1] & pgm_read_byte(&hsBit[j])) HSd.waveReq[sn][j] = waveSel;
+				}
+				break;
+				// Select the waveform of the next SCMD_WAVE
+				case SCMD_WAVE_SEL:
+				if(in[i][1] < DRV_WAVES) waveSel = in[i][1];
 				else cmdErr = true;
 				break;
-				// Switch on/off debug mode
+				// Stream the rest of the frame to the FIFO of the drivers of the
+				// slave given by the bitmask in orig[i][1]
+				case SCMD_FIFO:
+				if((drvFifo.sn != sn) || (drvFifo.mask != in[i][1])) {
+					drvFifo.sn = sn;
+					drvFifo.mask = in[i][1];
+					drvFifo.tail = drvFifo.head;
+					drvFifo.level = 0;
+					drvFifo.running = false;
+				}
+				if(drvFifo.mask) drvFifoPush(&in[i + 1], len - i - 1);
+				stream = true;
+				break;
+				// Switch on/off debug mode (text or binary trace)
 				case SCMD_DEBUG:
-				debug = (in[i][1] > 0) ? true : false;
+				debug = ((in[i][1] > 0) && (in[i][1] != DEBUG_TRACE)) ? true : false;
+				hsTraceEnable(in[i][1] > 0);
+				break;
+				// Select immediate (orig[i][1] = 0) or committed latching
+				case SCMD_LATCH:
+				latchCommit = (in[i][1] > 0) ? true : false;
+				break;
+				// Report the serial decoder counters (reset them if orig[i][1] > 0)
+				case SCMD_STATS:
+				reportStats(in[i][1] > 0);
+				break;
+				// Report the latency statistic orig[i][1] (reset it if | LAT_RESET)
+				case SCMD_LATENCY:
+				reportLatency(in[i][1]);
+				break;
+				// Report the topology and the registered slaves
+				case SCMD_TOPOLOGY:
+				reportTopology();
+				break;
+				// Report the startup and slave recovery times
+				case SCMD_HEALTH:
+				reportHealth();
+				break;
+				// Restart (orig[i][1] = 0) and report the frame clock
+				case SCMD_SYNC:
+				frameSync(in[i][1], f->start);
+				break;
+				// Report the power scheduler counters (reset them if in[i][1] > 0)
+				case SCMD_POWER:
+				reportPower(in[i][1] > 0);
+				break;
+				// Standby hold time of the drivers, wake-ahead on / off
+				case SCMD_POWER_HOLD:
+				drvPw.hold = (uint16_t)(in[i][1] & ~POWER_NO_AHEAD) * 10;
+				drvPw.ahead = !(in[i][1] & POWER_NO_AHEAD);
 				break;
 				case SCMD_RESET:
+#if defined(__AVR__)
 				asm volatile ("   jmp 0");
+#endif
 				break;
 				// No command match
 				default:
@@ -781,98 +1785,89 @@ void distributeCoordinates(uint8_t len, uint8_t in[HS_COORD_MAX][2], uint8_t out
 			}
 			
 			if(cmdErr) {
-				if(debug) {
-					Serial.print("ERROR#"); Serial.print(SERR_SETTINGS);
-					Serial.println("! Wrong values entered");
-				} else {
+				hsTrace(trc_cmdErr, in[i][0], in[i][1]);
+				if(!debug) {
 					Serial.write(SERR_SETTINGS);
 					Serial.write(SERR_CRLF);
 				}
 				cmdErr = false;
 			}
+			if(stream) break;
 		}
 
 		// Check (second) if entered coordinate items are within the HSoundplane.
-		// Note that coordinate system of the HSoundplane is a bit error generating:
-		// - Soundplane input example:		(6, 3)
-		// - HSoundplane coordinate:		(7, 3)
-		// - Corresponding audio channel:	8
-		// This is due to the fact that the 4 haptic slaves are made of 8 channels each,
-		// with first (0) and last (31) one are used for audio purpose. That means that
-		// the Soundplane columns 0 to 29 correspond to the haptic columns 1 to 30, on
-		// audio channels 2 to 31!
-		// Thus, first of all, add 1 to the input column number!
-		else if((in[i][0] += HS_COL_OFFSET) <= HS_COL_NUMBER) {
-			bool rErr = false;
-
-			// First assign col to the corresponding slave number (sn) and modulo value (mod).
-			uint8_t sn = in[i][0] / HS_CPS;
-			uint8_t mod = sn * HS_CPS;
-			
-			// Then check if raw was also entered within the HSoundplane range.
-			if(HSd.raw9) {
-				if(in[i][1] > 8) {
-					rErr = true;
-					if(debug) {
-						Serial.println("Raw value not valid (> 8)!");
-					}						
-				}
-			} else {
-				if(in[i][1] > 4) {
-					rErr = true;
-					if(debug) {
-						Serial.println("Raw value not valid (> 4)!");
-					}						
-				}
-			}
+		// Column offset, slave assignment and range checks are all folded into
+		// the compile time hsPiezoMap table (see hsoundplane.h).
+		else {
+			uint16_t map = hsPiezoLookup(in[i][0], in[i][1]);
 
-			// If coordinates were entered correctly, calculate the piezo index.
-			if(!rErr) {
-				// calculate the linear position (piezo index) of the pair
-				// and save it as next item of the selected slave of 'outputIndex'.
-				// !! always multiply by 9!! Not connected piezo will be skipped.
-				uint8_t pi = ((in[i][0] - mod) * 9) + (in[i][1] * 2);
+			// If coordinates were entered correctly, save the piezo index as
+			// next item of the selected slave of 'outputIndex'.
+			if(map != HS_MAP_INVALID) {
+				uint8_t sn = HS_MAP_SLAVE(map);
+				uint8_t pi = HS_MAP_PIEZO(map);
 				HSd.outputIndex[sn][HSd.indexCnt[sn]] = pi;
 				HSd.indexCnt[sn] += 1;	// increment the pi counter of the selected slave
 				
-				HSd.drvBm[sn] |= (1 << (in[i][0] - mod));
-	
-				if(debug) {
-					uint8_t pi5 = ((in[i][0] - mod) * 5) + in[i][1];
-
-					Serial.print("\nWorking on slave #"); Serial.print(sn, DEC); Serial.println("...");
-					Serial.print("- col value = "); Serial.println((in[i][0] - mod), DEC);
-					Serial.print("- raw value = "); Serial.println(in[i][1], DEC);
-					Serial.print("- available? "); Serial.println((HSd.i2cSlaveAvailable[sn]) ? "yes" : "no");
-					Serial.print("- setup ok? "); Serial.println((HSd.i2cSlaveSetup[sn]) ? "yes" : "no");
-					Serial.print("- piezo#: "); Serial.print(pi, DEC);
-					Serial.print("("); Serial.print(pi5, DEC); Serial.println(")");  
-					Serial.print("- outputIndex: "); Serial.print(HSd.outputIndex[sn][HSd.indexCnt[sn]-1], DEC);
-					Serial.print(" / indexCnt: "); Serial.println((HSd.indexCnt[sn]-1), DEC);
-					Serial.print("- drvBm: "); Serial.println(HSd.drvBm[sn], BIN);
+				HSd.drvBm[sn] |= pgm_read_byte(&hsBit[HS_MAP_DRV(map)]);
+				hsTrace(trc_coord, sn, pi);
+			}
+
+			// If nothing matched... something went entered wrong.
+			else {
+				hsTrace(trc_coordErr, in[i][0], in[i][1]);
+				if(f->seq != SERIAL_SEQ_NONE) {
+					coordErr = true;
 				}
-			} else {
-				if(debug) {
-					Serial.print("ERROR#"); Serial.print(SERR_COORD);
-					Serial.println("! Wrong values entered");
-				} else {
+				else if(!debug) {
 					Serial.write(SERR_COORD);
 					Serial.write(SERR_CRLF);
 				}
-				rErr = false;
 			}
 		}
+	}
+	
+	// A sequenced frame is reported once and counts as received (its valid
+	// pairs are applied): the host drops it instead of sending it again.
+	if(coordErr) {
+		serialReply(SERR_COORD, f->seq);
+	}
+}
 
-		// If nothing matched... something went entered wrong.
-		else {
-			if(debug) {
-				Serial.print("ERROR#"); Serial.print(SERR_COORD, DEC);
-				Serial.println("! Wrong values entered!");
-			} else {
-				Serial.write(SERR_COORD);
-				Serial.write(SERR_CRLF);
-			}
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | distributeBitmap														| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Convert a bitmap frame into the piezo set (HSd.piezoBm) and the driver mask
+// of every slave: each host column is one field of HS_ROWS bits, or'ed as is
+// (9 rows) or spread (5 rows) onto the 9 piezos of its driver.
+void distributeBitmap(const uint8_t *in)
+{
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		for(uint8_t j = 0; j < HS_PIEZO_BYTES; j++) {
+			HSd.piezoBm[i][j] = 0;
 		}
+		HSd.drvBm[i] = 0;
+	}
+	
+	uint16_t bit = 0;
+	for(uint8_t c = 0; c < HS_BITMAP_COLS; c++, bit += HS_ROWS) {
+		// the rows of the column (in[] has a spare byte after the last one)
+		uint16_t rows = (in[bit >> 3] | (in[(bit >> 3) + 1] << 8)) >> (bit & 0x07);
+		rows &= (1 << HS_ROWS) - 1;
+		if(rows == 0) continue;
+		
+		uint16_t map = hsPiezoLookup(c, 0);
+		uint8_t sn = HS_MAP_SLAVE(map);
+		uint8_t p = HS_MAP_PIEZO(map);
+#if(HS_9RAW_MODE == 0)
+		rows = pgm_read_word(&hsRowSpread[rows]);
+#endif
+		rows <<= (p & 0x07);
+		HSd.piezoBm[sn][p >> 3] |= (uint8_t)rows;
+		if(rows > 0xFF) HSd.piezoBm[sn][(p >> 3) + 1] |= (uint8_t)(rows >> 8);
+		HSd.drvBm[sn] |= pgm_read_byte(&hsBit[HS_MAP_DRV(map)]);
 	}
 }
 
@@ -881,28 +1876,206 @@ void distributeCoordinates(uint8_t len, uint8_t in[HS_COORD_MAX][2], uint8_t out
 /* | sendToSlave															| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-void sendToSlave(uint8_t sAddr, uint8_t *mes, uint8_t len)
+// Queue the index list for slave sn. The transaction completes in the
+// background and reports to slaveWriteDone().
+void sendToSlave(uint8_t sn, uint8_t *mes, uint8_t len)
 {
-	if(debug) {
-		Serial.print("\nWriting to 0x"); Serial.print(sAddr, HEX);
-		Serial.print(" (length: "); Serial.print(len, DEC);
-		Serial.println("):");
-		Serial.println("----------------------------------------");
-	}
+	uint8_t sAddr = hsSlaveAddr(sn);
+	
+	if(len > (I2C_XFER_DATA - 1)) len = I2C_XFER_DATA - 1;
+	hsTrace(trc_send, sn, len);
   
-	Wire.beginTransmission(sAddr);		// address slave @ sAddr
-	Wire.write(i2cCmd_regSet);			// command byte with register set message
+	struct i2cXfer *x = i2cQueueAlloc();
+	x->addr = sAddr;					// address slave @ sAddr
+	x->data[0] = i2cCmd_regSet;			// command byte with register set message
+	if(latchCommit) {
+		x->data[0] |= I2C_CMD_STAGED;	// ...held until commitSlaves()
+		commitPending = true;
+	}
 	for(uint8_t i = 0; i < len; i++) {
-		if(debug) {
-			Serial.print(mes[i], DEC); Serial.print("(0x");
-			Serial.print(mes[i], HEX); Serial.print(")");
-			if(i < (len-1)) Serial.print(" - ");
-		}
-		Wire.write(mes[i]);				// send all indexes associated to this slave
+		x->data[i+1] = mes[i];			// send all indexes associated to this slave
 	}
-	if(debug) {
-		Serial.println("");
+	x->len = len + 1;
+	x->tag = sn;
+	x->done = slaveWriteDone;
+	i2cQueueSubmit(x);
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | sendImageToSlave														| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+void sendImageToSlave(uint8_t sn, const uint8_t *bm)
+{
+	uint8_t sAddr = hsSlaveAddr(sn);
+	
+	hsTrace(trc_image, sn, latchCommit);
+	
+	// The slave copies the payload straight into its shift registers, which
+	// are active low: send the inverted piezo bitmap.
+	struct i2cXfer *x = i2cQueueAlloc();
+	x->addr = sAddr;					// address slave @ sAddr
+	x->data[0] = i2cCmd_regImage;		// command byte with register image message
+	if(latchCommit) {
+		x->data[0] |= I2C_CMD_STAGED;	// ...held until commitSlaves()
+		commitPending = true;
+	}
+	for(uint8_t i = 0; i < HS_PIEZO_BYTES; i++) {
+		x->data[i+1] = ~bm[i];
+	}
+	x->len = HS_PIEZO_BYTES + 1;
+	x->tag = sn;
+	x->done = slaveWriteDone;
+	i2cQueueSubmit(x);
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | slaveWriteDone															| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Completion of a queued piezo set: a failed slave is marked unavailable and
+// its shadow invalidated, so that the next frame sends the full set again
+void slaveWriteDone(struct i2cXfer *x)
+{
+	uint8_t sn = x->tag;
+	
+	hsTrace(trc_written, sn, x->status);
+	if(x->status == I2C_XFER_OK) {
+		uint32_t now = micros();
+		LAT_ADD(lat_write, now - latT.sent);
+		LAT_ADD(lat_total, now - latT.sentOrigin);
+		HSd.i2cSlaveAvailable[sn] = true;
+		return;
+	}
+	HSd.i2cSlaveAvailable[sn] = false;
+	HSd.piezoShadowValid[sn] = false;
+	slaveSt.check |= pgm_read_byte(&hsBit[sn]);		// probed between frames
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | updateSlave / updateSlaveSet											| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+void updateSlave(uint8_t sn, uint8_t *mes, uint8_t len, bool force)
+{
+	uint8_t bm[HS_PIEZO_BYTES];
+
+	// Build the bitmap of the requested piezo set
+	for(uint8_t j = 0; j < HS_PIEZO_BYTES; j++) {
+		bm[j] = 0;
+	}
+	for(uint8_t j = 0; j < len; j++) {
+		if(mes[j] < HS_PIEZO_MAX) bm[mes[j] >> 3] |= (1 << (mes[j] & 0x07));
+	}
+	updateSlaveSet(sn, bm, mes, len, force);
+}
+
+// Send the piezo set bm (index list mes of len piezos, or none: mes == NULL
+// and len > 0) if it differs from the last one committed to the slave. Only
+// changed sets are transmitted, the ones without index list as image.
+void updateSlaveSet(uint8_t sn, const uint8_t *bm, uint8_t *mes, uint8_t len, bool force)
+{
+	bool changed = !HSd.piezoShadowValid[sn];
+
+	// Missing slaves get their set once registered again
+	if(slaveSt.state[sn] == slave_missing) return;
+
+	for(uint8_t j = 0; j < HS_PIEZO_BYTES; j++) {
+		if(bm[j] != HSd.piezoShadow[sn][j]) changed = true;
+	}
+	
+	if(!changed && !force) {
+		hsTrace(trc_skip, sn, 0);
+		return;
+	}
+	
+	// Queue the new set as index list or as register image (constant size).
+	// The shadow is committed right away, slaveWriteDone() drops it on failure.
+#if(SLAVE_IMAGE_MODE > 1)
+	bool image = (len > HS_PIEZO_BYTES);
+#else
+	bool image = (SLAVE_IMAGE_MODE > 0);
+#endif
+	if((mes == NULL) && (len > 0)) image = true;
+	if(image) {
+		sendImageToSlave(sn, bm);
+	} else {
+		sendToSlave(sn, mes, len);
+	}
+	for(uint8_t j = 0; j < HS_PIEZO_BYTES; j++) {
+		HSd.piezoShadow[sn][j] = bm[j];
 	}
-	Wire.endTransmission();
+	HSd.piezoShadowValid[sn] = true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | commitSlaves / commitDone / pollSlaves								| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// General call after the staged sets: every slave latches on the same STOP.
+// The commit number tells the slaves where to keep their latch time.
+void commitSlaves(void)
+{
+	if(!commitPending) return;
+	
+	struct i2cXfer *x = i2cQueueAlloc();
+	x->addr = I2C_GENERAL_CALL;
+	x->data[0] = i2cCmd_commit;
+	x->data[1] = commitSeq++;
+	x->len = 2;
+	x->done = commitDone;
+	i2cQueueSubmit(x);
+	commitPending = false;
+}
+
+// Commit not on the bus: the staged sets are committed again after the next
+// frame (or its refresh)
+void commitDone(struct i2cXfer *x)
+{
+	if(x->status != I2C_XFER_OK) commitPending = true;
 }
 
+// Read the latch times of the last I2C_COMMIT_SLOTS commits from every slave.
+// All slaves receive a commit together, so the spread of the latch times of
+// one commit is its inter-slave latch skew: returns the largest one [us].
+// Also returns the worst receive -> latch time of the slaves [cycles].
+void pollSlaves(uint16_t *skew, uint16_t *cycles)
+{
+	uint16_t lo[I2C_COMMIT_SLOTS];
+	uint16_t hi[I2C_COMMIT_SLOTS];
+	uint16_t d[I2C_COMMIT_SLOTS];
+	
+	for(uint8_t k = 0; k < I2C_COMMIT_SLOTS; k++) {
+		lo[k] = I2C_LATCH_NONE;
+		hi[k] = 0;
+	}
+	*skew = 0;
+	*cycles = 0;
+	for(uint8_t i = 0; i < HS_SLAVE_NUMBER; i++) {
+		if(!HSd.i2cSlaveAvailable[i]) continue;
+		if(slaveProbe(i) != probe_registered) slaveSt.check |= pgm_read_byte(&hsBit[i]);
+		
+		// worst value since the last poll, health probes included
+		uint16_t c = slaveSt.pollCycles[i];
+		slaveSt.pollCycles[i] = 0;
+		if(c > *cycles) *cycles = c;
+		
+		if(!slaveCommitRead(i, d)) continue;
+		for(uint8_t k = 0; k < I2C_COMMIT_SLOTS; k++) {
+			if(d[k] == I2C_LATCH_NONE) continue;
+			if(d[k] < lo[k]) lo[k] = d[k];
+			if(d[k] > hi[k]) hi[k] = d[k];
+		}
+	}
+	for(uint8_t k = 0; k < I2C_COMMIT_SLOTS; k++) {
+		if((hi[k] >= lo[k]) && ((hi[k] - lo[k]) > *skew)) *skew = hi[k] - lo[k];
+	}
+}
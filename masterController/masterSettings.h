@@ -41,36 +41,119 @@
 
 #define SCMD_START			253			// serial command start byte
 #define SCMD_STOP			255			// serial command stop byte
+#define SCMD_BITMAP			254			// length byte of a full-surface bitmap frame
+										// (START BITMAP HS_BITMAP_BYTES STOP, no command)
+#define SCMD_TIMED			252			// timed frame header, in front of the length byte
+										// (START TIMED time(2) n ... STOP, see SCMD_SYNC)
+#define SCMD_SEQ			251			// sequenced frame header, first in front of the length
+										// byte (START SEQ seq [TIMED time(2)] n ... STOP,
+										// acknowledged by SERR_ACK)
 //-- SERIAL COMMANDS --
 #define SCMD_SETTINGS		100			// threshold value above wich
 										// setting commands are sent
+#define SCMD_SLAVE			104			// select the slave of the slave-indexed commands (byte 2: slave#,
+										// back to slave0 at each frame)
 #define SCMD_POFF_ALL		110			// switch off all relays (byte 2: slave#)
-#define SCMD_DOFF_S0		120			// switch off slave0 drivers (byte 2: drivers bitmask)
-#define SCMD_DOFF_S1		121			// switch off slave1 drivers (byte 2: drivers bitmask)
-#define SCMD_DOFF_S2		122			// switch off slave2 drivers (byte 2: drivers bitmask)
-#define SCMD_DOFF_S3		123			// switch off slave3 drivers (byte 2: drivers bitmask)
+// Slave-indexed commands: cmd applies to the selected slave, cmd + n (n = 1..3)
+// to slave n without a SCMD_SLAVE pair (4-slave hosts)
+#define SCMD_DOFF			120			// switch off drivers (byte 2: drivers bitmask)
 #define SCMD_DOFF_ALL		129			// switch off all drivers (byte 2: slave#)
-#define SCMD_DON_S0			130			// switch on slave0 drivers (byte 2: drivers bitmask)
-#define SCMD_DON_S1			131			// switch on slave1 drivers (byte 2: drivers bitmask)
-#define SCMD_DON_S2			132			// switch on slave2 drivers (byte 2: drivers bitmask)
-#define SCMD_DON_S3			133			// switch on slave3 drivers (byte 2: drivers bitmask)
+#define SCMD_DON			130			// switch on drivers (byte 2: drivers bitmask)
 #define SCMD_DON_ALL		139			// switch on all drivers (byte 2: slave#)
-#define SCMD_DEBUG			200			// toggle debug mode (byte 2: 0 -> off, >0 -> on)
+#define SCMD_WAVE			140			// play the selected waveform on drivers (byte 2: drivers bitmask)
+#define SCMD_WAVE_SEL		149			// select the waveform of the next SCMD_WAVE (byte 2: drvWave)
+#define SCMD_FIFO			150			// stream to drivers (byte 2: drivers bitmask, 0 -> stop),
+										// the remaining pairs of the frame are samples
+										// (2 signed bytes per pair, 8 kHz)
+#define SCMD_DEBUG			200			// debug mode (byte 2: 0 -> off, 1 -> text, DEBUG_TRACE ->
+										// binary trace records, see hsTraceDecode)
+#define SCMD_STATS			201			// report serial decoder counters (byte 2: >0 -> and reset
+										// them, latency statistics included)
+#define SCMD_LATCH			202			// latch mode (byte 2: 0 -> immediate, >0 -> committed)
+#define SCMD_TOPOLOGY		203			// report the slaves and their registration (byte 2: unused)
+#define SCMD_LATENCY		204			// report a latency statistic (byte 2: latStage,
+										// | LAT_RESET -> and reset it)
+#define SCMD_HEALTH			206			// report the startup and slave recovery times (byte 2: unused)
+#define SCMD_SYNC			207			// report the frame clock of the timed frames (byte 2:
+										// 0 -> restart it at this frame, >0 -> report only)
+#define SCMD_POWER			208			// report the driver power scheduler counters (byte 2:
+										// >0 -> and reset them)
+#define SCMD_POWER_HOLD		209			// driver standby hold time (byte 2: n * 10 ms, 0 -> all
+										// drivers on, | POWER_NO_AHEAD -> touched columns only)
 #define SCMD_RESET			250			// master software reset (byte 2: unused)
 //-- ERROR MESSAGES --
 #define SERR_NOERROR		0			// no error
 #define SERR_MISMATCH		1			// mismatch between entered and calculated length
-#define SERR_COORD			2
+										// (byte 2, sequenced frames: sequence number expected)
+#define SERR_COORD			2			// coordinate outside of the surface (byte 2, sequenced
+										// frames: its sequence number, the frame counts as
+										// received)
 #define SERR_SETTINGS		3
+#define SERR_ACK			4			// sequenced frames accepted (byte 2: sequence number
+										// expected next)
 #define SERR_CRLF			255
 
-#define STARTUP_WAIT_MS		500			// startup waiting time to let the slaves be ready
-#define INIT_WAIT_MS		50			// initialization waiting time to SEE slave getting ready
+#define SERIAL_RING_SIZE	128			// serial frame ring buffer (power of 2, <= 128)
+#define SERIAL_RING_MASK	(SERIAL_RING_SIZE - 1)
+#define SERIAL_FRAME_TIMEOUT_US	2000	// drop an incomplete frame after this silence
+#define SERIAL_ACK_EVERY	4			// sequenced frames acknowledged together, at most
+#define SERIAL_SEQ_MASK		0x7F		// sequence numbers (7 bits, never SERR_CRLF)
+#define SERIAL_SEQ_RESTART	0x80		// flag of a sequence number: accepted whatever was
+										// expected, the count goes on from there
+#define SERIAL_SEQ_NONE		0xFF		// frame without sequence number
+#define FRAME_COALESCING	1			// 0 -> send every frame to the slaves,
+										// 1 -> only the newest once the bus is free (the
+										// commands of superseded frames are kept)
+#define FRAME_QUEUE_SIZE	2			// timed frames buffered until their time (jitter buffer,
+										// 44 bytes each)
+#define FRAME_TIME_SHIFT	6			// time unit of the timed frames: 1 << n us (64 us,
+										// +/- 2 s ahead of the frame clock)
+#define FRAME_LATE_US		500			// timed frames released later are counted late
 
-#define SLAVE_REG_RETRIES	5
+#define STARTUP_WAIT_MS		500			// longest startup wait for the slaves (the late ones
+										// are registered by the health check)
+#define SLAVE_PROBE_MS		2			// startup probe interval while no slave answers
+#define SLAVE_HEALTH_MS		20			// health check: a slave probed every n ms in turn,
+										// the missing ones every time (0 -> never)
+
+#define DRV_POWER_HOLD_MS	200			// drivers of the haptic columns untouched for n ms are
+										// put in standby (0 -> always on, see SCMD_POWER_HOLD)
+#define DRV_WAKE_SPREAD		1			// columns woken ahead on both sides of a touch
+#define DRV_WAKE_AHEAD		2			// more columns woken ahead of a touch moving sideways
+#define DRV_WAKE_MS			2			// drv2667 wake-up time out of standby (a touch on a
+										// driver woken more recently counts as a miss)
+#define DRV_POWER_CHECK_MS	10			// idle drivers looked for every n ms between frames
+
+#define SLAVE_IMAGE_MODE	2			// 0 -> send the piezo indexes (i2cCmd_regSet),
+										// 1 -> send the shift registers image (i2cCmd_regImage),
+										// 2 -> send whichever is shorter (at most HS_PIEZO_BYTES)
+
+#define SLAVE_LATCH_MODE	1			// 0 -> each slave latches its piezo set on reception,
+										// 1 -> slaves stage their set, a general call commit
+										// latches them all at once
+
+#define SLAVE_REFRESH_FRAMES	100		// unchanged slaves are skipped, but every n frames all
+										// slaves are re-sent their piezo set (0 -> never)
+
+#define DRV_WAVE_GAIN		3			// drv2667 gain in waveform and FIFO playback (digital
+										// input, a later SCMD_DON goes back to analog)
+#define DRV_FIFO_RING		128			// samples buffered for the FIFO stream (power of 2, <= 128)
+#define DRV_FIFO_MASK		(DRV_FIFO_RING - 1)
+#define DRV_FIFO_PREFILL	48			// samples buffered before a stream starts playing
+#define DRV_FIFO_LOW		50			// estimated FIFO level below which it is refilled
 
 #define SYNC_PIN_1			2			// pin used to measure time between events
 
+#ifndef LAT_STATS
+#define LAT_STATS			0			// 1 -> keep the latency statistics of the master stages
+										// (latStat, 264 bytes of RAM: too much for the ATmega328,
+										// the slave statistics are always available)
+#endif
+
+#define DEBUG_TRACE			2			// SCMD_DEBUG value of the binary trace
+#define HS_TRACE_SIZE		16			// trace events buffered (power of 2, <= 128)
+#include "hsTrace.h"
+
 
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
@@ -78,6 +161,7 @@
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 bool debug = false;						// DEBUG FLAG!!
+struct hsTraceRing hsTraceBuf;			// debug events waiting for the serial port
 
 #if(I2C_FAST_MODE > 0)					// i2c speed flag
   bool i2cFastMode = true;
@@ -87,21 +171,270 @@ bool debug = false;						// DEBUG FLAG!!
   
 bool syncPinState;
 
+#if(SLAVE_LATCH_MODE > 0)				// latch mode flag (SCMD_LATCH)
+  bool latchCommit = true;
+#else
+  bool latchCommit = false;
+#endif
+bool commitPending = false;				// staged piezo sets queued since the last commit
+uint8_t commitSeq = 0;					// number of the next commit (i2cCmd_commit)
+
+// Serial frame decoder
+enum frameType {
+	frame_none,
+	frame_coord,						// coordinate pairs (or setting commands)
+	frame_allOff,						// START STOP message
+	frame_bitmap						// full-surface bitmap (HSd.inputBitmap)
+};
+struct serialFrame {
+	uint8_t type;						// frameType
+	uint8_t len;						// number of pairs (bytes of a bitmap)
+	uint8_t (*coord)[2];				// pairs (HSd.inputCoord)
+	uint8_t seq;						// SCMD_SEQ header: sequence number (or SERIAL_SEQ_NONE)
+	bool timed;							// SCMD_TIMED header (queued until its time)
+	uint16_t time;						// ...its time, frame clock units (FRAME_TIME_SHIFT)
+	uint32_t start;						// micros() of the start byte (released timed
+										// frames: the time they were due)
+};
+enum decodeStep {
+	dec_hunt,							// looking for SCMD_START
+	dec_length,							// waiting for the length byte
+	dec_body							// waiting for the pairs and SCMD_STOP
+};
+static_assert((2 * HS_COORD_MAX + 3) < SERIAL_RING_SIZE, "a full frame must fit the serial ring");
+static_assert((HS_BITMAP_BYTES + 3) < SERIAL_RING_SIZE, "a bitmap frame must fit the serial ring");
+static_assert(HS_COORD_MAX < SCMD_BITMAP, "SCMD_BITMAP must not be a pair count");
+uint8_t rxRing[SERIAL_RING_SIZE];
+uint8_t rxHead = 0;						// next byte to write
+uint8_t rxTail = 0;						// first byte not decoded yet
+uint32_t rxLast = 0;					// micros() of the last received bytes
+uint8_t decodeState = dec_hunt;
+uint8_t decodeLen;						// frame length in bytes (dec_body)
+uint8_t decodeHdr;						// bytes of the SCMD_SEQ & SCMD_TIMED headers
+bool framePending = false;				// distributed frame waiting for the bus
+bool bitmapPending = false;				// ...and it is a bitmap frame (HSd.piezoBm)
+struct {
+	uint32_t frames;					// decoded frames
+	uint32_t bytes;						// bytes consumed by the decoder
+	uint16_t resyncs;					// frames dropped (length, stop byte, timeout)
+	uint16_t skipped;					// bytes skipped looking for a start byte
+	uint16_t dropped;					// frames superseded before reaching the slaves
+	uint32_t since;						// millis() of the last reset
+} serialSt;
+struct {
+	uint8_t expected;					// next sequence number accepted
+	uint8_t unacked;					// sequenced frames accepted, not acknowledged yet
+	bool nakSent;						// frames out of order: expected one requested
+	uint16_t rejected;					// sequenced frames dropped (out of order)
+} seqSt;
+
+// Jitter buffer: timed frames wait here until the frame clock (restarted by
+// SCMD_SYNC) reaches their time, then frameRelease() processes them in order
+#define FRAME_DATA_MAX		((2 * HS_COORD_MAX > HS_BITMAP_BYTES) ? 2 * HS_COORD_MAX : HS_BITMAP_BYTES)
+static_assert(FRAME_QUEUE_SIZE > 0, "FRAME_QUEUE_SIZE: at least 1");
+struct timedFrame {
+	uint32_t due;						// micros() to release the frame at
+	uint8_t type;						// frameType
+	uint8_t len;						// number of pairs (bytes of a bitmap)
+	uint8_t seq;						// sequence number (or SERIAL_SEQ_NONE)
+	uint8_t data[FRAME_DATA_MAX];		// pairs or bitmap
+};
+struct {
+	struct timedFrame q[FRAME_QUEUE_SIZE];
+	uint8_t head;						// next frame to release
+	uint8_t count;						// frames waiting
+	uint32_t epoch;						// micros() of the frame clock origin
+	uint16_t underruns;					// frames received after their time
+	uint16_t late;						// frames released more than FRAME_LATE_US late
+	uint16_t early;						// frames released ahead of time, buffer full
+} frameQ;
+
+// Driver power scheduler: the drivers of the haptic columns (bit = column of
+// the topology) untouched for the hold time are put in standby between
+// frames, the ones around the touches are woken between frames too
+#define POWER_NO_AHEAD		0x80
+#define DRV_POWER_COLS		(((1UL << HS_COL_NUMBER) << 1) - (1UL << HS_COL_OFFSET))
+static_assert(hsColTotal() <= 32, "the power scheduler holds 32 columns");
+struct {
+	uint16_t hold;						// standby hold time in ms (0 -> scheduler off)
+	bool ahead;							// wake the columns around the touches
+	uint32_t act;						// columns touched by the last frame
+	uint16_t need[HS_SLAVE_NUMBER][HS_DPS];	// millis() each driver was last needed
+	uint16_t woke[HS_SLAVE_NUMBER][HS_DPS];	// millis() each driver was woken
+	uint8_t wake[HS_SLAVE_NUMBER];		// drivers to wake once the bus is idle
+	uint8_t waking[HS_SLAVE_NUMBER];	// drivers woken less than DRV_WAKE_MS ago
+	uint16_t last;						// millis() of the last idle check
+	uint16_t hits;						// columns touched with their driver awake
+	uint16_t misses;					// ...asleep or still waking up
+	uint16_t wakes;
+	uint16_t sleeps;
+} drvPw;
+
+// Waveforms & FIFO streaming
+uint8_t waveSel = wave_click;			// waveform of the next SCMD_WAVE
+struct {
+	uint8_t sn;							// slave of the streaming drivers
+	uint8_t mask;						// streaming drivers (0 -> no stream)
+	uint8_t ring[DRV_FIFO_RING];		// samples not written to the drivers yet
+	uint8_t head;						// next sample to write
+	uint8_t tail;						// next sample to send
+	uint8_t level;						// estimated fill of the drivers FIFO
+	bool running;						// FIFO playing (underruns are counted)
+	uint32_t last;						// micros() of the last level estimate
+	uint16_t underruns;					// FIFO found empty while streaming
+	uint16_t dropped;					// samples lost on a full ring
+} drvFifo;
+
+// Latency statistics (SCMD_LATENCY), master stages in us. The slave ones
+// (hsSlaveStat) are read from the slaves on request: lat_slaves + statistic
+// for all of them merged, LAT_SLAVE(sn, statistic) for one of them.
+enum latStage {
+	lat_receive,						// start byte -> frame complete
+	lat_distribute,						// frame complete -> coordinates distributed
+	lat_wait,							// distributed -> sent to the bus (coalescing)
+	lat_write,							// sent -> each slave write done
+	lat_total,							// start byte (timed frames: their time) -> each
+										// slave write done
+	lat_release,						// timed frames: their time -> released
+	LAT_STAGES,
+	lat_slaves = LAT_STAGES
+};
+#define LAT_SLAVE_BASE		16
+#define LAT_SLAVE(sn, st)	(LAT_SLAVE_BASE + ((sn) * HS_SLAVE_STATS) + (st))
+#define LAT_RESET			0x80
+
+static_assert((lat_slaves + HS_SLAVE_STATS) <= LAT_SLAVE_BASE, "latStage overlaps the slave statistics");
+static_assert(LAT_SLAVE(HS_SLAVE_NUMBER, 0) <= LAT_RESET, "latStage overlaps LAT_RESET");
+static_assert(I2C_XFER_DATA > HS_LAT_PAGE, "an i2cCmd_stats page does not fit an i2c read");
+
+#if(LAT_STATS > 0)
+struct hsLatency latStat[LAT_STAGES];
+#define LAT_ADD(stage, us)	hsLatAdd(&latStat[stage], (us))
+#else
+#define LAT_ADD(stage, us)				// master stages not measured
+#endif
+struct {
+	uint32_t start;						// micros() of the start byte being decoded
+	uint32_t origin;					// ...of the pending frame
+	uint32_t ready;						// pending frame distributed
+	uint32_t sentOrigin;				// start byte of the frame on the bus
+	uint32_t sent;						// frame sent to the bus
+} latT;
+
+// Slave registration & health (SCMD_HEALTH). Slaves are registered and set
+// up in steps, at startup and in the idle time of loop(): missing slaves are
+// probed, a slave that stops answering or answers unregistered (rebooted) is
+// set up again while the others keep playing.
+enum slaveState {
+	slave_missing,						// not answering, probed
+	slave_found,						// answered, drivers to reset
+	slave_reset,						// drivers reset, to switch on
+	slave_ready							// set up and notified
+};
+enum slaveProbeResult {
+	probe_none,							// no (valid) answer
+	probe_booted,						// answering, not registered since its power-up
+	probe_registered
+};
+static_assert(HS_SLAVE_NUMBER <= 8, "slaveSt masks hold 8 slaves");
+struct {
+	uint8_t state[HS_SLAVE_NUMBER];		// slaveState
+	uint8_t check;						// slaves to probe at the next idle time (bit mask)
+	uint8_t lost;						// slaves lost and not ready again (bit mask)
+	uint8_t next;						// next slave of the periodic probe
+	uint32_t last;						// millis() of the last periodic probe
+	uint32_t lostAt[HS_SLAVE_NUMBER];	// millis() the slave was found missing or rebooted
+	uint16_t recoveryMs[HS_SLAVE_NUMBER];	// lost -> ready again, last recovery
+	uint8_t recoveries[HS_SLAVE_NUMBER];
+	uint16_t bootMs;					// power-up -> end of setup()
+	uint16_t pollCycles[HS_SLAVE_NUMBER];	// worst receive -> latch times read by the
+											// probes, until pollSlaves()
+} slaveSt;
+
 // String slicedCmd[2 * HS_COORD_MAX];		// command line sliced into integers
 
 // extern...
 extern struct HSdata HSd;
 
+// Static RAM budget of the buffers: the ATmega328 has 2048 bytes, the
+// HardwareSerial rx/tx buffers take about 157 of them, the stack, the core
+// and the smaller variables need the rest. Sizes taken on the host are
+// larger than on the AVR (pointers, alignment), the check holds there too.
+#ifndef RAM_BUDGET
+#define RAM_BUDGET			1536		// bytes left to the buffers below
+#endif
+#if(LAT_STATS > 0)
+#define RAM_LAT_STATS		sizeof(latStat)
+#else
+#define RAM_LAT_STATS		0
+#endif
+#define RAM_BUFFERS			(sizeof(struct HSdata) + sizeof(struct i2cXfer) * I2C_QUEUE_SIZE + \
+							sizeof(hsTraceBuf) + sizeof(rxRing) + sizeof(serialSt) + sizeof(seqSt) + \
+							sizeof(frameQ) + sizeof(drvPw) + sizeof(drvFifo) + sizeof(latT) + \
+							sizeof(slaveSt) + RAM_LAT_STATS)
+static_assert(RAM_BUFFERS <= RAM_BUDGET, "the buffers exceed RAM_BUDGET");
+
 
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 /* | FUNCTIONS																| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
+void serialDrain(void);
+void serialResync(void);
+uint8_t serialDecode(struct serialFrame *f);
+bool serialAccept(struct serialFrame *f, uint8_t type, uint8_t bytes);
+void serialAck(const struct serialFrame *f);
+void serialAckFlush(void);
+void serialReply(uint8_t code, uint8_t seq);
+void processFrame(struct serialFrame *f);
+void frameQueue(struct serialFrame *f);
+void frameRelease(void);
+void frameApply(void);
+void frameSync(uint8_t arg, uint32_t at);
+void dispatchFrame(void);
+void reportStats(bool reset);
+void reportTopology(void);
+void reportLatency(uint8_t arg);
+void latencyReset(void);
+bool slaveStatRead(uint8_t sn, uint8_t st, struct hsLatency *l);
+bool slaveCommitRead(uint8_t sn, uint16_t *d);
+void slaveStatReset(uint8_t sn, uint8_t st);
 void parseCommand(void);
-void registerSlave(void);
-uint8_t setupSlaveDrv(int8_t addr, uint8_t dbm, bool reset, bool on, uint8_t gain);
+bool slavesReady(void);
+uint8_t slaveProbe(uint8_t sn);
+bool slaveStep(uint8_t sn);
+void slaveLost(uint8_t sn, uint8_t state);
+void slaveHealth(void);
+void reportHealth(void);
+void setupSlaveDrv(uint8_t sn, uint8_t dbm, bool reset, bool on, uint8_t gain);
+void drvSwitch(uint8_t sn, uint8_t mask);
+void drvSelect(uint8_t sn, uint8_t mask);
+void drvWrite(uint8_t sn, uint8_t mask, uint8_t reg, const uint8_t *data, uint8_t len);
+void drvSwitchDone(struct i2cXfer *x);
+void drvWriteDone(struct i2cXfer *x);
+uint8_t drvRead(uint8_t reg, uint8_t *data, uint8_t len);
+void drvShadow(uint8_t sn, uint8_t mask, uint8_t reg, uint8_t val);
+void drvInvalidate(uint8_t sn, uint8_t mask);
+void drvPlay(uint8_t sn);
+void drvUpload(uint8_t sn, uint8_t mask, uint8_t w);
+void drvFifoPush(const uint8_t (*in)[2], uint8_t len);
+void drvFifoService(void);
+uint32_t drvPowerCols(const uint8_t *dbm);
+void drvPowerFrame(uint32_t act);
+void drvPowerIdle(void);
+void drvPowerWake(uint8_t sn, uint8_t dbm, uint16_t now);
+void drvPowerKeep(uint8_t sn, uint8_t dbm);
+void reportPower(bool reset);
 void notifySlave(int8_t addr, bool notification);
-void distributeCoordinates(uint8_t len, uint8_t orig[HS_COORD_MAX][2], uint8_t dest[HS_SLAVE_NUMBER][HS_COORD_MAX]);
-void sendToSlave(uint8_t sAddr, uint8_t *mes, uint8_t len);
+void distributeCoordinates(const struct serialFrame *f, uint8_t dest[HS_SLAVE_NUMBER][HS_COORD_MAX]);
+void distributeBitmap(const uint8_t *in);
+void sendToSlave(uint8_t sn, uint8_t *mes, uint8_t len);
+void sendImageToSlave(uint8_t sn, const uint8_t *bm);
+void slaveWriteDone(struct i2cXfer *x);
+void updateSlave(uint8_t sn, uint8_t *mes, uint8_t len, bool force);
+void updateSlaveSet(uint8_t sn, const uint8_t *bm, uint8_t *mes, uint8_t len, bool force);
+void commitSlaves(void);
+void commitDone(struct i2cXfer *x);
+void pollSlaves(uint16_t *skew, uint16_t *cycles);
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _ARDUINO_H
+#define _ARDUINO_H
+
+// Host replacement of the Arduino core for the HSoundplane simulation.
+// Only the parts used by the master & slave firmware are provided. The
+// free functions (pinMode, digitalWrite, millis...) and the Serial, Wire
+// and SPI objects are declared per board by simGlue.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sim.h"
+
+#define HIGH				0x1
+#define LOW					0x0
+
+#define INPUT				0x0
+#define OUTPUT				0x1
+#define INPUT_PULLUP		0x2
+
+#define DEC					10
+#define HEX					16
+#define OCT					8
+#define BIN					2
+
+#define LSBFIRST			0
+#define MSBFIRST			1
+
+#ifndef F_CPU
+#define F_CPU				16000000UL
+#endif
+
+// arduino nano analog pins
+#define A0					14
+#define A1					15
+#define A2					16
+#define A3					17
+#define A4					18
+#define A5					19
+#define A6					20
+#define A7					21
+
+#define SERIAL_RX_BUFFER_SIZE	64
+#define SERIAL_TX_BUFFER_SIZE	64
+
+// flash is plain memory on the host
+#define PROGMEM
+#define pgm_read_byte(addr)		(*(const uint8_t *)(addr))
+#define pgm_read_word(addr)		(*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t *)(addr))
+
+// interrupts are only serviced between two core calls on the host
+#define interrupts()
+#define noInterrupts()
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#include "Print.h"
+#include "HardwareSerial.h"
+
+#endif
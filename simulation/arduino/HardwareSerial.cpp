@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include "Arduino.h"
+
+HardwareSerial::HardwareSerial(sim::Board &board) :
+	mBoard(board), mBaud(230400), mLastArrival(0), mOverflows(0), mReceived(0)
+{
+	board.serial = this;
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+	mBaud = baud;
+}
+
+// Move the bytes arrived until t into the rx ring buffer. The ring buffer of
+// the AVR core keeps one slot free, so only SERIAL_RX_BUFFER_SIZE-1 bytes fit.
+void HardwareSerial::ingest(sim::Time t)
+{
+	while(!mPending.empty() && mPending.front().t <= t) {
+		if(mRx.size() < (SERIAL_RX_BUFFER_SIZE - 1)) {
+			mRx.push_back(mPending.front().b);
+			mReceived++;
+		} else {
+			mOverflows++;
+		}
+		mPending.pop_front();
+	}
+}
+
+void HardwareSerial::drain(sim::Time t)
+{
+	while(!mTx.empty() && mTx.front() <= t) mTx.pop_front();
+}
+
+int HardwareSerial::available(void)
+{
+	mBoard.advance(sim::cost::serialAvailable);
+	ingest(mBoard.now());
+	return (int)mRx.size();
+}
+
+int HardwareSerial::availableForWrite(void)
+{
+	mBoard.advance(sim::cost::serialAvailable);
+	drain(mBoard.now());
+	return (int)(SERIAL_TX_BUFFER_SIZE - 1 - mTx.size());
+}
+
+int HardwareSerial::peek(void)
+{
+	mBoard.advance(sim::cost::serialRead);
+	ingest(mBoard.now());
+	return mRx.empty() ? -1 : mRx.front();
+}
+
+int HardwareSerial::read(void)
+{
+	mBoard.advance(sim::cost::serialRead);
+	ingest(mBoard.now());
+	if(mRx.empty()) return -1;
+	uint8_t c = mRx.front();
+	mRx.pop_front();
+	return c;
+}
+
+void HardwareSerial::flush(void)
+{
+	if(!mTx.empty()) mBoard.advanceTo(mTx.back());
+	drain(mBoard.now());
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	mBoard.advance(sim::cost::serialWrite);
+	drain(mBoard.now());
+
+	// buffer full: busy wait until the UDRE interrupt frees a slot
+	if(mTx.size() >= (SERIAL_TX_BUFFER_SIZE - 1)) {
+		mBoard.advanceTo(mTx.front());
+		drain(mBoard.now());
+	}
+
+	sim::Time start = mTx.empty() ? mBoard.now() : mTx.back();
+	if(start < mBoard.now()) start = mBoard.now();
+	mTx.push_back(start + byteTime());
+
+	Byte s = { start + byteTime(), c };
+	mSent.push_back(s);
+	if(sim::World::instance().echo) {
+		putchar(c);
+	}
+	return 1;
+}
+
+void HardwareSerial::formatted(uint8_t digits)
+{
+	mBoard.advance(digits * sim::cost::printDigit);
+}
+
+sim::Time HardwareSerial::inject(const uint8_t *data, size_t len, sim::Time at)
+{
+	sim::Time t = (at > mLastArrival) ? at : mLastArrival;
+	for(size_t i = 0; i < len; i++) {
+		t += byteTime();
+		Byte b = { t, data[i] };
+		mPending.push_back(b);
+	}
+	mLastArrival = t;
+	return t;
+}
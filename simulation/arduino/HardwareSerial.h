@@ -0,0 +1,87 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _HARDWARESERIAL_H
+#define _HARDWARESERIAL_H
+
+#include <deque>
+#include <vector>
+#include "Print.h"
+#include "sim.h"
+
+// UART of a simulated board. The firmware side behaves like the AVR core
+// (64 byte rx/tx ring buffers, rx bytes lost when the buffer is full, write()
+// blocking while the tx buffer is full). The host side injects timestamped
+// bytes and collects what the board sent.
+class HardwareSerial : public Print {
+public:
+	struct Byte {
+		sim::Time t;				// arrival (rx) or end of transmission (tx)
+		uint8_t b;
+	};
+
+	explicit HardwareSerial(sim::Board &board);
+
+	void begin(unsigned long baud);
+	void end(void) {}
+	int available(void);
+	int availableForWrite(void);
+	int peek(void);
+	int read(void);
+	void flush(void);
+	size_t write(uint8_t c);
+	inline size_t write(unsigned long n) { return write((uint8_t)n); }
+	inline size_t write(long n) { return write((uint8_t)n); }
+	inline size_t write(unsigned int n) { return write((uint8_t)n); }
+	inline size_t write(int n) { return write((uint8_t)n); }
+	using Print::write;
+	operator bool() { return true; }
+
+	// host side
+	sim::Time byteTime(void) const { return 10000000000LL / mBaud; }
+	sim::Time inject(const uint8_t *data, size_t len, sim::Time at);
+	sim::Time lastArrival(void) const { return mLastArrival; }
+	size_t pending(void) const { return mPending.size(); }
+	const std::vector<Byte> &sent(void) const { return mSent; }
+	uint32_t overflows(void) const { return mOverflows; }
+	uint32_t received(void) const { return mReceived; }
+
+protected:
+	void formatted(uint8_t digits);
+
+private:
+	void ingest(sim::Time t);
+	void drain(sim::Time t);
+
+	sim::Board &mBoard;
+	unsigned long mBaud;
+	sim::Time mLastArrival;
+	std::deque<Byte> mPending;		// bytes on the wire, not yet arrived
+	std::deque<uint8_t> mRx;		// rx ring buffer
+	std::deque<sim::Time> mTx;		// tx ring buffer (end of transmission of each byte)
+	std::vector<Byte> mSent;
+	uint32_t mOverflows;
+	uint32_t mReceived;
+};
+
+#endif
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "Arduino.h"
+
+size_t Print::write(const char *str)
+{
+	if(str == NULL) return 0;
+	return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = 0;
+	while(size--) n += write(*buffer++);
+	return n;
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+	char buf[8 * sizeof(long) + 1];
+	char *str = &buf[sizeof(buf) - 1];
+
+	*str = '\0';
+	if(base < 2) base = 10;
+	do {
+		unsigned long m = n;
+		n /= base;
+		char c = m - base * n;
+		*--str = c < 10 ? c + '0' : c + 'A' - 10;
+	} while(n);
+
+	formatted((uint8_t)strlen(str));
+	return write(str);
+}
+
+size_t Print::print(const char *s) { return write(s); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(unsigned char n, int base) { return print((unsigned long)n, base); }
+size_t Print::print(unsigned int n, int base) { return print((unsigned long)n, base); }
+size_t Print::print(int n, int base) { return print((long)n, base); }
+
+size_t Print::print(long n, int base)
+{
+	if(base == 0) return write((uint8_t)n);
+	if(base == 10 && n < 0) {
+		size_t t = print('-');
+		return printNumber(-n, 10) + t;
+	}
+	return printNumber((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+	if(base == 0) return write((uint8_t)n);
+	return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+	size_t t = 0;
+	if(n < 0.0) {
+		t += print('-');
+		n = -n;
+	}
+	double rounding = 0.5;
+	for(uint8_t i = 0; i < digits; ++i) rounding /= 10.0;
+	n += rounding;
+
+	unsigned long integer = (unsigned long)n;
+	double remainder = n - (double)integer;
+	t += print(integer);
+	if(digits > 0) t += print('.');
+	while(digits-- > 0) {
+		remainder *= 10.0;
+		unsigned int d = (unsigned int)remainder;
+		t += print(d);
+		remainder -= d;
+	}
+	return t;
+}
+
+size_t Print::println(void) { return write("\r\n"); }
+size_t Print::println(const char *s) { size_t n = print(s); return n + println(); }
+size_t Print::println(char c) { size_t n = print(c); return n + println(); }
+size_t Print::println(unsigned char v, int base) { size_t n = print(v, base); return n + println(); }
+size_t Print::println(int v, int base) { size_t n = print(v, base); return n + println(); }
+size_t Print::println(unsigned int v, int base) { size_t n = print(v, base); return n + println(); }
+size_t Print::println(long v, int base) { size_t n = print(v, base); return n + println(); }
+size_t Print::println(unsigned long v, int base) { size_t n = print(v, base); return n + println(); }
+size_t Print::println(double v, int digits) { size_t n = print(v, digits); return n + println(); }
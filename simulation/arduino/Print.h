@@ -0,0 +1,64 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _PRINT_H
+#define _PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t) = 0;
+	size_t write(const char *str);
+	size_t write(const uint8_t *buffer, size_t size);
+
+	size_t print(const char *s);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = 10);
+	size_t print(int n, int base = 10);
+	size_t print(unsigned int n, int base = 10);
+	size_t print(long n, int base = 10);
+	size_t print(unsigned long n, int base = 10);
+	size_t print(double n, int digits = 2);
+
+	size_t println(void);
+	size_t println(const char *s);
+	size_t println(char c);
+	size_t println(unsigned char n, int base = 10);
+	size_t println(int n, int base = 10);
+	size_t println(unsigned int n, int base = 10);
+	size_t println(long n, int base = 10);
+	size_t println(unsigned long n, int base = 10);
+	size_t println(double n, int digits = 2);
+
+protected:
+	// cost of the number to string conversion on the target
+	virtual void formatted(uint8_t digits) { (void)digits; }
+
+private:
+	size_t printNumber(unsigned long n, uint8_t base);
+};
+
+#endif
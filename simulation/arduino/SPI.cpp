@@ -0,0 +1,57 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "Arduino.h"
+#include "SPI.h"
+
+SPIClass::SPIClass(sim::Board &board) :
+	mBoard(board), mClock(F_CPU / 4)
+{
+	board.spi = this;
+}
+
+void SPIClass::beginTransaction(SPISettings settings)
+{
+	mBoard.advance(sim::cost::spiTransaction);
+	uint32_t clock = F_CPU / 2;
+	while((clock > settings.clock) && (clock > (F_CPU / 128))) clock /= 2;
+	mClock = clock;
+}
+
+void SPIClass::endTransaction(void)
+{
+	mBoard.advance(sim::cost::spiTransaction);
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	mBoard.advance(sim::cost::spiTransferOverhead + (8000000000LL / mClock));
+	if(mBoard.spiDevice) mBoard.spiDevice->spiByte(data, mBoard.now());
+	return 0;
+}
+
+void SPIClass::transfer(void *buf, size_t count)
+{
+	uint8_t *p = (uint8_t *)buf;
+	for(size_t i = 0; i < count; i++) p[i] = transfer(p[i]);
+}
@@ -0,0 +1,67 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _SPI_H
+#define _SPI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sim.h"
+
+#define SPI_MODE0			0x00
+#define SPI_MODE1			0x04
+#define SPI_MODE2			0x08
+#define SPI_MODE3			0x0C
+
+class SPISettings {
+public:
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) :
+		clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+	SPISettings() : clock(4000000), bitOrder(1), dataMode(SPI_MODE0) {}
+
+	uint32_t clock;
+	uint8_t bitOrder;
+	uint8_t dataMode;
+};
+
+// SPI master of a simulated board. The clock is rounded down to the nearest
+// F_CPU divider (2..128) like the AVR core does.
+class SPIClass {
+public:
+	explicit SPIClass(sim::Board &board);
+
+	void begin(void) {}
+	void end(void) {}
+	void beginTransaction(SPISettings settings);
+	void endTransaction(void);
+	uint8_t transfer(uint8_t data);
+	void transfer(void *buf, size_t count);
+
+	uint32_t clock(void) const { return mClock; }
+
+private:
+	sim::Board &mBoard;
+	uint32_t mClock;
+};
+
+#endif
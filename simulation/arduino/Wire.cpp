@@ -0,0 +1,170 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "Arduino.h"
+#include "Wire.h"
+
+TwoWire::TwoWire(sim::Board &board) :
+	mBoard(board), mSlave(false), mAddress(0), mRegistered(false), mGeneralCall(false),
+	mTransmitting(false), mReplying(false), mTxAddress(0), mTxLength(0),
+	mRxLength(0), mRxIndex(0), mOnReceive(NULL), mOnRequest(NULL)
+{
+	board.wire = this;
+}
+
+void TwoWire::begin(void)
+{
+	mSlave = false;
+}
+
+void TwoWire::begin(uint8_t address)
+{
+	mSlave = true;
+	mAddress = address;
+	if(!mRegistered) {
+		sim::World::instance().bus().addDevice(this);
+		mRegistered = true;
+	}
+}
+
+void TwoWire::setClock(uint32_t clock)
+{
+	// only the bus master drives SCL
+	if(!mSlave) sim::World::instance().bus().setClock(clock);
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+	mBoard.advance(sim::cost::wireBegin);
+	mTransmitting = true;
+	mTxAddress = address;
+	mTxLength = 0;
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop)
+{
+	(void)sendStop;
+	mBoard.advance(sim::cost::wireEndOverhead);
+	uint8_t ret = sim::World::instance().bus().write(mBoard, mTxAddress, mTx, mTxLength);
+	mTransmitting = false;
+	mTxLength = 0;
+	return ret;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop)
+{
+	(void)sendStop;
+	if(quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+	mBoard.advance(sim::cost::wireEndOverhead);
+	uint8_t ret = sim::World::instance().bus().read(mBoard, address, mRx, quantity);
+	mRxIndex = 0;
+	mRxLength = (ret == 0) ? quantity : 0;
+	return mRxLength;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+	return requestFrom(address, quantity, (uint8_t)true);
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	mBoard.advance(sim::cost::wireWrite);
+	if(mTransmitting || mReplying) {
+		if(mTxLength >= BUFFER_LENGTH) return 0;
+		mTx[mTxLength++] = data;
+		return 1;
+	}
+	return 0;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+	size_t n = 0;
+	for(size_t i = 0; i < quantity; i++) n += write(data[i]);
+	return n;
+}
+
+int TwoWire::available(void)
+{
+	mBoard.advance(sim::cost::wireRead);
+	return mRxLength - mRxIndex;
+}
+
+int TwoWire::read(void)
+{
+	mBoard.advance(sim::cost::wireRead);
+	if(mRxIndex < mRxLength) return mRx[mRxIndex++];
+	return -1;
+}
+
+int TwoWire::peek(void)
+{
+	if(mRxIndex < mRxLength) return mRx[mRxIndex];
+	return -1;
+}
+
+bool TwoWire::i2cPresent(uint8_t addr)
+{
+	return mSlave && mBoard.booted() && ((addr == mAddress) || (mGeneralCall && (addr == 0)));
+}
+
+// The TWI interrupt of the slave board fires at the STOP condition, wherever
+// its own clock is (the message waits if the board is still behind)
+void TwoWire::i2cReceive(const uint8_t *data, uint8_t len, sim::Time t)
+{
+	Message m;
+	if(len > BUFFER_LENGTH) len = BUFFER_LENGTH;
+	memcpy(m.data, data, len);
+	m.len = len;
+	mPending.push_back(m);
+	mBoard.raise(t, receiveIsr, this, sim::cost::twiIsrEntry + len * sim::cost::twiIsrByte);
+}
+
+void TwoWire::receiveIsr(void *ctx)
+{
+	TwoWire *w = (TwoWire *)ctx;
+	Message m = w->mPending.front();
+	w->mPending.erase(w->mPending.begin());
+	memcpy(w->mRx, m.data, m.len);
+	w->mRxLength = m.len;
+	w->mRxIndex = 0;
+	if(w->mOnReceive) w->mOnReceive(m.len);
+}
+
+uint8_t TwoWire::i2cRequest(uint8_t *data, uint8_t len, sim::Time t, sim::Time *stretch)
+{
+	mBoard.beginIsr(t, 1);
+	sim::Time start = mBoard.now();
+	mReplying = true;
+	mTxLength = 0;
+	if(mOnRequest) mOnRequest();
+	mReplying = false;
+	*stretch = mBoard.now() - start;
+	mBoard.endIsr();
+
+	uint8_t n = (mTxLength < len) ? mTxLength : len;
+	memcpy(data, mTx, n);
+	mTxLength = 0;
+	return n;
+}
@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _WIRE_H
+#define _WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sim.h"
+
+#define BUFFER_LENGTH		32
+
+// TWI of a simulated board. As master, transactions are timed on the shared
+// sim::I2CBus and block the board like twi_writeTo()/twi_readFrom() do. As
+// slave (begin(address)), the onReceive/onRequest handlers run in interrupt
+// context on the slave board's own clock.
+class TwoWire : public sim::I2CDevice {
+public:
+	explicit TwoWire(sim::Board &board);
+
+	void begin(void);
+	void begin(uint8_t address);
+	void begin(int address) { begin((uint8_t)address); }
+	void end(void) {}
+	void setClock(uint32_t clock);
+
+	void beginTransmission(uint8_t address);
+	void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+	uint8_t endTransmission(void) { return endTransmission((uint8_t)true); }
+	uint8_t endTransmission(uint8_t sendStop);
+	uint8_t requestFrom(uint8_t address, uint8_t quantity);
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop);
+	uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (uint8_t)quantity); }
+	uint8_t requestFrom(int address, int quantity, int sendStop) { return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)sendStop); }
+
+	size_t write(uint8_t data);
+	size_t write(const uint8_t *data, size_t quantity);
+	inline size_t write(int n) { return write((uint8_t)n); }
+	int available(void);
+	int read(void);
+	int peek(void);
+	void flush(void) {}
+
+	void onReceive(void (*function)(int)) { mOnReceive = function; }
+	void onRequest(void (*function)(void)) { mOnRequest = function; }
+
+	// host side of TWAR |= _BV(TWGCE): also receive the general call (0x00)
+	void generalCall(bool on) { mGeneralCall = on; }
+
+	// sim::I2CDevice (slave role)
+	bool i2cPresent(uint8_t addr);
+	void i2cReceive(const uint8_t *data, uint8_t len, sim::Time t);
+	uint8_t i2cRequest(uint8_t *data, uint8_t len, sim::Time t, sim::Time *stretch);
+
+private:
+	struct Message {
+		uint8_t data[BUFFER_LENGTH];
+		uint8_t len;
+	};
+	static void receiveIsr(void *ctx);
+
+	sim::Board &mBoard;
+	bool mSlave;
+	uint8_t mAddress;
+	bool mRegistered;
+	bool mGeneralCall;
+
+	bool mTransmitting;
+	bool mReplying;
+	uint8_t mTxAddress;
+	uint8_t mTx[BUFFER_LENGTH];
+	uint8_t mTxLength;
+	uint8_t mRx[BUFFER_LENGTH];
+	uint8_t mRxLength;
+	uint8_t mRxIndex;
+
+	std::vector<Message> mPending;		// received, waiting for the slave's interrupt
+	void (*mOnReceive)(int);
+	void (*mOnRequest)(void);
+};
+
+#endif
@@ -0,0 +1,874 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// End-to-end benchmark of the HSoundplane firmware on the host simulation.
+//
+// Coordinate frames (SCMD_START n col row ... SCMD_STOP, or SCMD_START
+// SCMD_BITMAP bitmap SCMD_STOP) are injected into the master's serial port at
+// SERIAL_SPEED. For each scenario two runs are made:
+// - latency:	 one frame every --period-us, the time from the serial bytes
+//				 arriving at the master to the rising edge of LOAD_PIN on each
+//				 slave that latches for the frame is recorded.
+// - throughput: all frames back-to-back, as fast as the serial link allows.
+// Each run forks from a freshly constructed process image, so the firmware
+// globals always start from their power-on values.
+// The boot run reports the startup time, the jitter run delivers frames in
+// bursts and compares applying them on arrival with timed frames, the
+// recovery run power-cycles a slave while frames are played and reports how
+// the master sets it up again, the power run compares the drivers kept on
+// with the standby scheduler, reacting to the touches or waking ahead.
+// --trace FILE turns on the master's binary trace (SCMD_DEBUG DEBUG_TRACE) in
+// the latency run and saves its serial output for tools/hsTraceDecode.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "Arduino.h"
+#include "Wire.h"
+#include "hsTraceEvents.h"
+
+#define SCMD_START			253
+#define SCMD_STOP			255
+#define SCMD_BITMAP			254
+#define SCMD_TIMED			252
+#define SCMD_STATS			201
+#define SCMD_LATCH			202
+#define SCMD_WAVE			140
+#define SCMD_WAVE_SEL		149
+#define SCMD_FIFO			150
+#define SCMD_LATENCY		204
+#define SCMD_DEBUG			200
+#define SCMD_HEALTH			206
+#define SCMD_SYNC			207
+#define SCMD_POWER			208
+#define SCMD_POWER_HOLD		209
+#define POWER_NO_AHEAD		0x80
+#define POWER_LENGTH		11			// SCMD_POWER + awake + 4 * 2 bytes + SERR_CRLF
+#define POWER_HOLD			20			// SCMD_POWER_HOLD: 200 ms
+#define POWER_IDLE			40			// power run: frames without touch between gestures
+#define POWER_GESTURES		12
+#define DEBUG_TRACE			2
+#define STATS_LENGTH		24			// SCMD_STATS + 22 bytes + SERR_CRLF
+#define LATENCY_LENGTH		45			// SCMD_LATENCY + stage + 42 bytes + SERR_CRLF
+#define SLAVES				4
+#define BITMAP_COLS			30			// host columns of a bitmap frame
+#define BITMAP_ROWS			5			// HS_ROWS of the firmware (HS_9RAW_MODE 0)
+#define BITMAP_BYTES		((BITMAP_COLS * BITMAP_ROWS + 7) / 8)
+#define HEALTH_LENGTH		(4 + 4 * SLAVES)	// SCMD_HEALTH + 2 + 4 per slave + SERR_CRLF
+#define BOOT_NS				2000000000LL
+#define OUTAGE_NS			50000000LL	// recovery run: slave powered off for 50 ms
+#define SYNC_LENGTH			13			// SCMD_SYNC + 11 bytes + SERR_CRLF
+#define FRAME_TIME_NS		64000		// time unit of the timed frames
+#define JITTER_BURST		2			// jitter run: frames delivered at once (<= FRAME_QUEUE_SIZE)
+#define LAT_RELEASE			5			// latStage of the timed frames release
+
+static const char *slaveNames[SLAVES] = { "slave1", "slave2", "slave3", "slave4" };
+
+/* -------------------------------------------------------------------------- */
+/* | scenarios																| */
+/* -------------------------------------------------------------------------- */
+typedef void (*FrameGen)(uint32_t k, std::vector<uint8_t> &pairs);
+
+static void frameOff(uint32_t k, std::vector<uint8_t> &pairs)
+{
+	(void)k;
+	pairs.clear();
+}
+
+static void frameSingle(uint32_t k, std::vector<uint8_t> &pairs)
+{
+	(void)k;
+	pairs.clear();
+	pairs.push_back(3); pairs.push_back(2);
+}
+
+static void frameDual(uint32_t k, std::vector<uint8_t> &pairs)
+{
+	pairs.clear();
+	pairs.push_back(3); pairs.push_back(k % 5);
+	pairs.push_back(18); pairs.push_back((k + 2) % 5);
+}
+
+static void frameSweep(uint32_t k, std::vector<uint8_t> &pairs)
+{
+	pairs.clear();
+	pairs.push_back((k / 4) % 30); pairs.push_back(k % 5);
+}
+
+static void frameDense(uint32_t k, std::vector<uint8_t> &pairs)
+{
+	pairs.clear();
+	for(uint8_t i = 0; i < 16; i++) {
+		pairs.push_back((i * 2 + (k % 2)) % 30);
+		pairs.push_back((i + k) % 5);
+	}
+}
+
+static void frameSurface(uint32_t k, std::vector<uint8_t> &pairs)
+{
+	pairs.clear();
+	for(uint8_t c = 0; c < 30; c++) {
+		pairs.push_back(c); pairs.push_back((c + k) % 5);
+		pairs.push_back(c); pairs.push_back((c + k + 2) % 5);
+	}
+}
+
+struct Scenario {
+	const char *name;
+	const char *description;
+	FrameGen gen;
+	uint32_t corruptEvery;				// drop the first pair byte of every n-th frame
+	bool bitmap;						// send the contacts as a full-surface bitmap
+};
+
+static const Scenario scenarios[] = {
+	{ "off",	"empty frame (all piezos off)",				frameOff,		0,	false },
+	{ "single",	"one static contact on slave 0",			frameSingle,	0,	false },
+	{ "dual",	"two contacts on slaves 0 and 2",			frameDual,		0,	false },
+	{ "sweep",	"one contact sweeping over all columns",	frameSweep,		0,	false },
+	{ "dense",	"16 contacts spread over the surface",		frameDense,		0,	false },
+	{ "noisy",	"dual, one byte lost every 10th frame",		frameDual,		10,	false },
+	{ "dense-bitmap",	"dense, as full-surface bitmap frames",		frameDense,		0,	true },
+	{ "surface",	"60 contacts (2 per column) as bitmap frames",	frameSurface,	0,	true },
+};
+static const size_t scenarioCount = sizeof(scenarios) / sizeof(scenarios[0]);
+
+/* -------------------------------------------------------------------------- */
+/* | measurement															| */
+/* -------------------------------------------------------------------------- */
+class BusWatch : public sim::I2CMonitor {
+public:
+	BusWatch() : lastEnd(0) {}
+	void i2cTransaction(uint8_t addr, bool read, const uint8_t *data, uint8_t len,
+						uint8_t status, sim::Time start, sim::Time end)
+	{
+		(void)addr; (void)data; (void)len; (void)status; (void)start;
+		if(!read) lastEnd = end;
+	}
+	sim::Time lastEnd;					// end of the last write (frames are only written,
+										// the reads are the master's health probes)
+};
+
+struct Options {
+	uint32_t frames;
+	uint32_t periodUs;
+	uint32_t i2cKhz;
+	const char *only;
+	bool echo;
+	int latch;							// SCMD_LATCH argument, -1 -> firmware default
+	const char *trace;					// master trace output of the latency run
+};
+
+static void buildFrame(const Scenario &s, uint32_t k, std::vector<uint8_t> &frame)
+{
+	std::vector<uint8_t> pairs;
+	s.gen(k, pairs);
+	frame.clear();
+	frame.push_back(SCMD_START);
+	if(s.bitmap) {
+		// host column c, row r is bit (c * BITMAP_ROWS + r), LSB first
+		uint8_t bm[BITMAP_BYTES] = { 0 };
+		for(size_t i = 0; i + 1 < pairs.size(); i += 2) {
+			unsigned bit = pairs[i] * BITMAP_ROWS + pairs[i + 1];
+			bm[bit / 8] |= 1 << (bit % 8);
+		}
+		frame.push_back(SCMD_BITMAP);
+		frame.insert(frame.end(), bm, bm + BITMAP_BYTES);
+	}
+	else if(!pairs.empty()) {
+		frame.push_back((uint8_t)(pairs.size() / 2));
+		frame.insert(frame.end(), pairs.begin(), pairs.end());
+	}
+	frame.push_back(SCMD_STOP);
+	if(s.corruptEvery && (k % s.corruptEvery) == (s.corruptEvery - 1) && frame.size() > 3) {
+		frame.erase(frame.begin() + 2);
+	}
+}
+
+static uint32_t le(const std::vector<HardwareSerial::Byte> &tx, size_t at, uint8_t n)
+{
+	uint32_t v = 0;
+	for(uint8_t i = 0; i < n; i++) v |= (uint32_t)tx[at + i].b << (8 * i);
+	return v;
+}
+
+// Send a one-pair setting command to the master and let it process it
+static void sendCommand(HardwareSerial &serial, uint8_t cmd, uint8_t arg)
+{
+	sim::World &w = sim::World::instance();
+	const uint8_t request[] = { SCMD_START, 1, cmd, arg, SCMD_STOP };
+	serial.inject(request, sizeof(request), w.now());
+	w.runUntil(serial.lastArrival() + 5000000LL);
+}
+
+// Send a report command (SCMD_STATS, SCMD_LATENCY...) with its argument and
+// let the master answer with len bytes: cmd, then tag if tag >= 0, ...,
+// SERR_CRLF. Returns the index of the answer in the master's serial output,
+// or tx.size() if there is none.
+static size_t requestReport(HardwareSerial &serial, uint8_t cmd, uint8_t arg, int tag, size_t len)
+{
+	size_t from = serial.sent().size();
+	sendCommand(serial, cmd, arg);
+
+	const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+	for(size_t i = from; i + len <= tx.size(); i++) {
+		if(tx[i].b == cmd && (tag < 0 || tx[i + 1].b == tag) && tx[i + len - 1].b == 255) return i;
+	}
+	return tx.size();
+}
+
+// Print the on-device latency statistics (master stages, slaves merged)
+static void printLatency(HardwareSerial &serial)
+{
+	static const char *names[] = {
+		"start byte -> frame complete [us]", "distribution [us]", "waiting for the bus [us]",
+		"sent -> slave write done [us]", "start byte -> slave write done [us]",
+		"timed frame due -> released [us]",
+		"slave receive -> latch [cycles]", "slave commit -> latch [us]"
+	};
+	printf("    on-device statistics                     samples      min     mean      max   log2 histogram\n");
+	for(uint8_t stage = 0; stage < sizeof(names) / sizeof(names[0]); stage++) {
+		const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+		size_t at = requestReport(serial, SCMD_LATENCY, stage, stage, LATENCY_LENGTH);
+		if(at >= tx.size() || le(tx, at + 2, 4) == 0) continue;	// no sample (no timed frame)
+		printf("      %-36s %8u %8u %8u %8u  ", names[stage], le(tx, at + 2, 4),
+			   le(tx, at + 6, 2), le(tx, at + 10, 2), le(tx, at + 8, 2));
+		int lo = -1, hi = -1;
+		for(int b = 0; b < 16; b++) {
+			if(le(tx, at + 12 + 2 * b, 2) == 0) continue;
+			if(lo < 0) lo = b;
+			hi = b;
+		}
+		for(int b = lo; (lo >= 0) && (b <= hi); b++) printf(" %u:%u", b, le(tx, at + 12 + 2 * b, 2));
+		printf("\n");
+	}
+}
+
+static sim::ShiftRegisterChain *chainOf(const char *name)
+{
+	sim::Board *b = sim::World::instance().board(name);
+	return b ? dynamic_cast<sim::ShiftRegisterChain *>(b->spiDevice) : NULL;
+}
+
+static uint32_t countAcks(HardwareSerial &serial, size_t from)
+{
+	const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+	uint32_t acks = 0;
+	for(size_t i = from; i + 1 < tx.size(); i++) {
+		if(tx[i].b == HS_TRACE_MARK && i + HS_TRACE_RECORD <= tx.size() &&
+		   tx[i + HS_TRACE_RECORD - 1].b == 255) {
+			i += HS_TRACE_RECORD - 1;	// trace record, may hold 0 255
+		} else if(tx[i].b == 0 && tx[i + 1].b == 255) {
+			acks++;
+			i++;
+		}
+	}
+	return acks;
+}
+
+static void runScenario(const Scenario &s, const Options &o, bool throughput)
+{
+	sim::World &w = sim::World::instance();
+	w.echo = o.echo;
+	if(o.i2cKhz) w.bus().forceClock(o.i2cKhz * 1000);
+	BusWatch watch;
+	w.bus().addMonitor(&watch);
+
+	w.runUntil(BOOT_NS);
+
+	HardwareSerial &serial = *w.board("master")->serial;
+	if(o.latch >= 0) sendCommand(serial, SCMD_LATCH, (uint8_t)o.latch);
+	bool trace = o.trace && !throughput;
+	if(trace) sendCommand(serial, SCMD_DEBUG, DEBUG_TRACE);
+	requestReport(serial, SCMD_STATS, 1, -1, STATS_LENGTH);
+	size_t txBase = serial.sent().size();
+	size_t latchBase[SLAVES];
+	for(uint8_t i = 0; i < SLAVES; i++) latchBase[i] = chainOf(slaveNames[i])->latches().size();
+	w.bus().resetStats();
+
+	sim::Time t0 = w.now();
+	sim::Time period = (sim::Time)o.periodUs * 1000;
+	std::vector<sim::Time> firstIn(o.frames), lastIn(o.frames);
+	std::vector<uint8_t> frame;
+	for(uint32_t k = 0; k < o.frames; k++) {
+		buildFrame(s, k, frame);
+		sim::Time at = throughput ? t0 : t0 + k * period;
+		firstIn[k] = ((at > serial.lastArrival()) ? at : serial.lastArrival()) + serial.byteTime();
+		lastIn[k] = serial.inject(&frame[0], frame.size(), at);
+	}
+	sim::Time end = throughput ? (lastIn[o.frames - 1] + 50000000LL) : (t0 + o.frames * period);
+	w.runUntil(end);
+
+	uint32_t acks = countAcks(serial, txBase);
+	if(trace) {
+		const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+		FILE *f = fopen(o.trace, "wb");
+		if(f) {
+			for(size_t i = txBase; i < tx.size(); i++) fputc(tx[i].b, f);
+			fclose(f);
+			printf("  trace: %zu bytes -> %s\n", tx.size() - txBase, o.trace);
+		} else {
+			printf("  !! cannot write %s\n", o.trace);
+		}
+	}
+
+	if(!throughput) {
+		printf("  latency, one frame every %u us (%u frames)\n", o.periodUs, o.frames);
+		printf("    slave  latched   first byte -> LOAD [us]    last byte -> LOAD [us]\n");
+		printf("                          mean       max          min      mean       max\n");
+		std::vector<sim::Time> frameLatch(o.frames * SLAVES, -1);
+		for(uint8_t i = 0; i < SLAVES; i++) {
+			const std::vector<sim::ShiftRegisterChain::Latch> &l = chainOf(slaveNames[i])->latches();
+			uint32_t n = 0;
+			double sumFirst = 0, sumLast = 0;
+			sim::Time maxFirst = 0, maxLast = 0, minLast = -1;
+			uint32_t k = 0;
+			for(size_t j = latchBase[i]; j < l.size(); j++) {
+				// attribute the latch to the last frame completed before it
+				while((k + 1 < o.frames) && (lastIn[k + 1] <= l[j].t)) k++;
+				if(l[j].t < lastIn[k]) continue;
+				if((j > latchBase[i]) && (l[j - 1].t >= lastIn[k])) continue;	// only the first latch per frame
+				frameLatch[k * SLAVES + i] = l[j].t;
+				sim::Time dFirst = l[j].t - firstIn[k];
+				sim::Time dLast = l[j].t - lastIn[k];
+				sumFirst += dFirst;
+				sumLast += dLast;
+				if(dFirst > maxFirst) maxFirst = dFirst;
+				if(dLast > maxLast) maxLast = dLast;
+				if(minLast < 0 || dLast < minLast) minLast = dLast;
+				n++;
+			}
+			if(n == 0) {
+				printf("    %u      %7u          -         -            -         -         -\n", i, n);
+			} else {
+				printf("    %u      %7u   %8.1f  %8.1f     %8.1f  %8.1f  %8.1f\n", i, n,
+					   sumFirst / n / 1000.0, maxFirst / 1000.0,
+					   minLast / 1000.0, sumLast / n / 1000.0, maxLast / 1000.0);
+			}
+		}
+		// spread of the LOAD edges of the slaves latching for the same frame
+		uint32_t skewed = 0;
+		double sumSkew = 0;
+		sim::Time maxSkew = 0;
+		for(uint32_t k = 0; k < o.frames; k++) {
+			sim::Time lo = -1, hi = -1;
+			for(uint8_t i = 0; i < SLAVES; i++) {
+				sim::Time t = frameLatch[k * SLAVES + i];
+				if(t < 0) continue;
+				if(lo < 0 || t < lo) lo = t;
+				if(t > hi) hi = t;
+			}
+			if(lo < 0 || hi == lo) continue;
+			skewed++;
+			sumSkew += hi - lo;
+			if(hi - lo > maxSkew) maxSkew = hi - lo;
+		}
+		if(skewed) {
+			printf("    latch skew between slaves over %u frames: mean %.1f us, max %.1f us\n",
+				   skewed, sumSkew / skewed / 1000.0, maxSkew / 1000.0);
+		}
+		sim::Time window = end - t0;
+		printf("    acked %u/%u, bus utilisation %.1f %%, %.2f i2c transactions & %.1f bytes per frame\n",
+			   acks, o.frames, 100.0 * w.bus().busyTime() / window,
+			   (double)w.bus().transactions() / o.frames, (double)w.bus().bytes() / o.frames);
+
+		const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+		size_t at = requestReport(serial, SCMD_STATS, 0, -1, STATS_LENGTH);
+		if(at < tx.size()) {
+			uint32_t cycles = le(tx, at + 17, 2);
+			printf("    reported by the slaves: latch skew %u us, receive -> latch max %u cycles (%.1f us)\n",
+				   le(tx, at + 15, 2), cycles, cycles / 16.0);
+		}
+		printLatency(serial);
+	} else {
+		sim::Time last = watch.lastEnd;
+		for(uint8_t i = 0; i < SLAVES; i++) {
+			const std::vector<sim::ShiftRegisterChain::Latch> &l = chainOf(slaveNames[i])->latches();
+			if(l.size() > latchBase[i] && l.back().t > last) last = l.back().t;
+		}
+		if(last < lastIn[o.frames - 1]) last = lastIn[o.frames - 1];
+		sim::Time elapsed = last - t0;
+		sim::Time serialOnly = lastIn[o.frames - 1] - t0;
+		printf("  throughput, %u frames back-to-back\n", o.frames);
+		printf("    %.0f frames/s (serial link alone: %.0f frames/s), acked %u/%u, rx overflows %u\n",
+			   1e9 * acks / elapsed, 1e9 * o.frames / serialOnly, acks, o.frames, serial.overflows());
+		printf("    bus utilisation %.1f %%, %.2f i2c transactions & %.1f bytes per frame\n",
+			   100.0 * w.bus().busyTime() / elapsed,
+			   (double)w.bus().transactions() / o.frames, (double)w.bus().bytes() / o.frames);
+
+		const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+		size_t at = requestReport(serial, SCMD_STATS, 0, -1, STATS_LENGTH);
+		if(at < tx.size()) {
+			printf("    decoder: %u frames, %u resyncs, %u bytes skipped, %u frames superseded\n",
+				   le(tx, at + 1, 4) - 1, le(tx, at + 9, 2), le(tx, at + 11, 2), le(tx, at + 13, 2));
+
+		}
+	}
+}
+
+static void runBoot(const Options &o)
+{
+	sim::World &w = sim::World::instance();
+	w.echo = o.echo;
+	if(o.i2cKhz) w.bus().forceClock(o.i2cKhz * 1000);
+	w.runUntil(BOOT_NS);
+
+	uint32_t drivers = 0, enabled = 0, writes = 0;
+	const std::vector<sim::Pca954x *> &sw = w.bus().switches();
+	for(size_t i = 0; i < sw.size(); i++) {
+		for(uint8_t ch = 0; ch < sim::Pca954x::CHANNELS; ch++) {
+			const std::vector<sim::I2CDevice *> &ds = sw[i]->downstream(ch);
+			for(size_t j = 0; j < ds.size(); j++) {
+				sim::Drv2667 *d = dynamic_cast<sim::Drv2667 *>(ds[j]);
+				if(!d) continue;
+				drivers++;
+				if(d->amplifierOn()) enabled++;
+				writes += d->writes();
+			}
+		}
+	}
+	printf("\n== boot\n");
+	printf("  master setup done at %.1f ms, %u i2c transactions (%u drv2667 register writes)\n",
+		   w.board("master")->setupDone() / 1e6, w.bus().transactions(), writes);
+	printf("  %u/%u drv2667 amplifiers enabled\n", enabled, drivers);
+
+	HardwareSerial &serial = *w.board("master")->serial;
+	const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+	size_t at = requestReport(serial, SCMD_HEALTH, 0, -1, HEALTH_LENGTH);
+	if(at < tx.size()) {
+		printf("  reported by the master: slaves set up %u ms after power-up, ready:", le(tx, at + 1, 2));
+		for(uint8_t i = 0; i < SLAVES; i++) printf(" %s", (tx[at + 3 + 4 * i].b == 3) ? "yes" : "no");
+		printf("\n");
+	}
+}
+
+static sim::Drv2667 *drvOf(uint8_t slave, uint8_t channel)
+{
+	const std::vector<sim::Pca954x *> &sw = sim::World::instance().bus().switches();
+	for(size_t i = 0; i < sw.size(); i++) {
+		if(!sw[i]->i2cPresent(0x70 + slave)) continue;
+		const std::vector<sim::I2CDevice *> &ds = sw[i]->downstream(channel);
+		return ds.empty() ? NULL : dynamic_cast<sim::Drv2667 *>(ds[0]);
+	}
+	return NULL;
+}
+
+// Waveform triggers (first one uploading the waveform) and FIFO streaming
+static void runWaves(const Options &o)
+{
+	sim::World &w = sim::World::instance();
+	w.echo = o.echo;
+	if(o.i2cKhz) w.bus().forceClock(o.i2cKhz * 1000);
+	w.runUntil(BOOT_NS);
+
+	HardwareSerial &serial = *w.board("master")->serial;
+	sim::Drv2667 *click = drvOf(0, 0);
+	sim::Drv2667 *stream = drvOf(1, 0);
+	if(!click || !stream) {
+		printf("  !! drivers not found\n");
+		return;
+	}
+	printf("\n== waves: drv2667 waveform playback & FIFO streaming\n");
+
+	// the same click on slave 0, driver 0, every --period-us
+	const uint8_t trigger[] = { SCMD_START, 2, SCMD_WAVE_SEL, 0, SCMD_WAVE, 0x01, SCMD_STOP };
+	sim::Time period = (sim::Time)o.periodUs * 1000;
+	sim::Time t0 = w.now();
+	std::vector<sim::Time> lastIn(o.frames);
+	uint32_t coldTx = 0;
+	w.bus().resetStats();
+	for(uint32_t k = 0; k < o.frames; k++) {
+		lastIn[k] = serial.inject(trigger, sizeof(trigger), t0 + k * period);
+		w.runUntil(t0 + (k + 1) * period);
+		if(k == 0) coldTx = w.bus().transactions();
+	}
+	const std::vector<sim::Drv2667::Play> &p = click->plays();
+	uint32_t valid = 0, n = 0;
+	double sum = 0;
+	sim::Time cold = -1, maxWarm = 0;
+	for(size_t j = 0, k = 0; j < p.size() && k < o.frames; j++) {
+		while((k + 1 < o.frames) && (lastIn[k + 1] <= p[j].t)) k++;
+		if(p[j].t < lastIn[k]) continue;
+		if(p[j].valid) valid++;
+		sim::Time d = p[j].t - lastIn[k];
+		if(k == 0) cold = d;
+		else {
+			sum += d;
+			if(d > maxWarm) maxWarm = d;
+			n++;
+		}
+	}
+	printf("  waveform trigger, one every %u us (%u frames), last byte -> GO\n", o.periodUs, o.frames);
+	printf("    played %u (%u valid), first (upload) %.1f us & %u i2c transactions\n",
+		   (uint32_t)p.size(), valid, cold / 1000.0, coldTx);
+	if(n) {
+		printf("    cached: mean %.1f us, max %.1f us, %.2f i2c transactions per trigger\n",
+			   sum / n / 1000.0, maxWarm / 1000.0, (double)(w.bus().transactions() - coldTx) / n);
+	}
+
+	// 30 samples per frame to slave 1, driver 0, at the 8 kHz FIFO rate
+	std::vector<uint8_t> frame;
+	const uint8_t pairs = 16;
+	sim::Time framePeriod = (pairs - 1) * 2 * sim::Drv2667::SAMPLE_TIME;
+	t0 = w.now();
+	w.bus().resetStats();
+	for(uint32_t k = 0; k < o.frames; k++) {
+		frame.clear();
+		frame.push_back(SCMD_START);
+		frame.push_back(pairs);
+		frame.push_back(SCMD_FIFO + 1);
+		frame.push_back(0x01);
+		for(uint8_t i = 0; i < (pairs - 1) * 2; i++) frame.push_back((uint8_t)(k * 30 + i));
+		frame.push_back(SCMD_STOP);
+		serial.inject(&frame[0], frame.size(), t0 + k * framePeriod);
+	}
+	sim::Time end = t0 + o.frames * framePeriod + 20000000LL;
+	w.runUntil(end);
+	printf("  FIFO stream, %u frames of %u samples every %.0f us\n",
+		   o.frames, (pairs - 1) * 2, framePeriod / 1000.0);
+	printf("    samples %u/%u, underruns %u, overflows %u, bus utilisation %.1f %%, %.2f i2c transactions per frame\n",
+		   stream->fifoSamples(), o.frames * (pairs - 1) * 2, stream->fifoUnderruns(), stream->fifoOverflows(),
+		   100.0 * w.bus().busyTime() / (end - t0), (double)w.bus().transactions() / o.frames);
+}
+
+// Dual frames every --period-us, delivered JITTER_BURST at a time (a host
+// whose USB transfers come in clumps). First applied on arrival, then timed
+// one period ahead of a frame clock restarted by SCMD_SYNC: the LOAD edges of
+// slave 0 must follow the period instead of the bursts.
+static void runJitter(const Options &o)
+{
+	sim::World &w = sim::World::instance();
+	w.echo = o.echo;
+	if(o.i2cKhz) w.bus().forceClock(o.i2cKhz * 1000);
+	w.runUntil(BOOT_NS);
+
+	HardwareSerial &serial = *w.board("master")->serial;
+	printf("\n== jitter: dual frames every %u us, delivered %u at a time\n", o.periodUs, JITTER_BURST);
+	sim::Time period = (sim::Time)o.periodUs * 1000;
+	sim::Time lead = period;				// a burst holds frames due over JITTER_BURST periods
+	const std::vector<sim::ShiftRegisterChain::Latch> &l = chainOf(slaveNames[0])->latches();
+	for(int timed = 0; timed < 2; timed++) {
+		// the frame clock starts with the first byte of SCMD_SYNC
+		sim::Time sync = ((w.now() > serial.lastArrival()) ? w.now() : serial.lastArrival()) + serial.byteTime();
+		requestReport(serial, SCMD_SYNC, 0, -1, SYNC_LENGTH);
+		requestReport(serial, SCMD_LATENCY, LAT_RELEASE | 0x80, LAT_RELEASE | 0x80, LATENCY_LENGTH);
+		size_t latchBase = l.size();
+		sim::Time t0 = w.now() + period;
+		std::vector<uint8_t> pairs, frame;
+		for(uint32_t k = 0; k < o.frames; k++) {
+			frameDual(k, pairs);
+			frame.clear();
+			frame.push_back(SCMD_START);
+			if(timed) {
+				uint16_t t = (uint16_t)((t0 + k * period + lead - sync) / FRAME_TIME_NS);
+				frame.push_back(SCMD_TIMED);
+				frame.push_back((uint8_t)t);
+				frame.push_back((uint8_t)(t >> 8));
+			}
+			frame.push_back((uint8_t)(pairs.size() / 2));
+			frame.insert(frame.end(), pairs.begin(), pairs.end());
+			frame.push_back(SCMD_STOP);
+			serial.inject(&frame[0], frame.size(), t0 + (k - k % JITTER_BURST) * period);
+		}
+		w.runUntil(t0 + o.frames * period + lead + period);
+
+		uint32_t n = 0;
+		double sum = 0, sum2 = 0, maxDev = 0;
+		for(size_t j = latchBase + 1; j < l.size(); j++) {
+			double d = (double)(l[j].t - l[j - 1].t);
+			double dev = (d > period) ? d - period : period - d;
+			sum += d;
+			sum2 += d * d;
+			if(dev > maxDev) maxDev = dev;
+			n++;
+		}
+		printf("  %s\n", timed ? "timed, one period ahead" : "applied on arrival");
+		if(n) {
+			double mean = sum / n;
+			double sd = (sum2 / n > mean * mean) ? sqrt(sum2 / n - mean * mean) : 0;
+			printf("    slave 0 latched %u, LOAD interval mean %.1f us, sd %.1f us, max deviation %.1f us\n",
+				   n + 1, mean / 1000.0, sd / 1000.0, maxDev / 1000.0);
+		}
+		const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+		size_t at = requestReport(serial, SCMD_SYNC, 1, -1, SYNC_LENGTH);
+		if(at < tx.size() && timed) {
+			sim::Time host = serial.lastArrival() - 4 * serial.byteTime() - sync;	// its start byte
+			printf("    frame clock %.1f ms (host %.1f ms), %u underruns, %u late, %u released early\n",
+				   le(tx, at + 1, 4) / 1000.0, host / 1e6, le(tx, at + 6, 2), le(tx, at + 8, 2), le(tx, at + 10, 2));
+		}
+		at = requestReport(serial, SCMD_LATENCY, LAT_RELEASE, LAT_RELEASE, LATENCY_LENGTH);
+		if(at < tx.size() && timed) {
+			printf("    due -> released: %u frames, min %u us, mean %u us, max %u us\n",
+				   le(tx, at + 2, 4), le(tx, at + 6, 2), le(tx, at + 10, 2), le(tx, at + 8, 2));
+		}
+	}
+}
+
+// Dense frames every --period-us, slave 2 powered off for OUTAGE_NS after a
+// quarter of them: the others must keep latching, slave 2 must be set up
+// again (drivers on, relays following the frames) without a master reset.
+static void runRecovery(const Options &o)
+{
+	sim::World &w = sim::World::instance();
+	w.echo = o.echo;
+	if(o.i2cKhz) w.bus().forceClock(o.i2cKhz * 1000);
+	w.runUntil(BOOT_NS);
+
+	const uint8_t victim = 2;
+	HardwareSerial &serial = *w.board("master")->serial;
+	sim::Board *board = w.board(slaveNames[victim]);
+	printf("\n== recovery: slave %u power-cycled (%.0f ms off) during dense frames\n", victim, OUTAGE_NS / 1e6);
+
+	size_t txBase = serial.sent().size();
+	size_t latchBase[SLAVES];
+	for(uint8_t i = 0; i < SLAVES; i++) latchBase[i] = chainOf(slaveNames[i])->latches().size();
+	sim::Time period = (sim::Time)o.periodUs * 1000;
+	sim::Time t0 = w.now();
+	sim::Time off = 0, on = 0;
+	std::vector<uint8_t> frame;
+	for(uint32_t k = 0; k < o.frames; k++) {
+		if(k == o.frames / 4) {
+			off = w.now();
+			on = off + OUTAGE_NS;
+			board->powerCycle(on);
+		}
+		buildFrame(scenarios[4], k, frame);
+		serial.inject(&frame[0], frame.size(), t0 + k * period);
+		w.runUntil(t0 + (k + 1) * period);
+	}
+	uint32_t acks = countAcks(serial, txBase);
+
+	printf("    slave  latched   during the outage\n");
+	for(uint8_t i = 0; i < SLAVES; i++) {
+		const std::vector<sim::ShiftRegisterChain::Latch> &l = chainOf(slaveNames[i])->latches();
+		uint32_t during = 0;
+		for(size_t j = latchBase[i]; j < l.size(); j++) {
+			if(l[j].t >= off && l[j].t < on) during++;
+		}
+		printf("    %u      %7u   %7u\n", i, (uint32_t)(l.size() - latchBase[i]), during);
+	}
+	const std::vector<sim::ShiftRegisterChain::Latch> &l = chainOf(slaveNames[victim])->latches();
+	sim::Time back = -1;
+	for(size_t j = latchBase[victim]; j < l.size(); j++) {
+		if(l[j].t >= on) {
+			back = l[j].t;
+			break;
+		}
+	}
+	uint32_t enabled = 0;
+	for(uint8_t ch = 0; ch < 8; ch++) {
+		sim::Drv2667 *d = drvOf(victim, ch);
+		if(d && d->amplifierOn()) enabled++;
+	}
+	printf("    acked %u/%u, slave %u latching again %.1f ms after power-on, %u/8 amplifiers enabled\n",
+		   acks, o.frames, victim, (back >= 0) ? (back - on) / 1e6 : -1.0, enabled);
+
+	const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+	size_t at = requestReport(serial, SCMD_HEALTH, 0, -1, HEALTH_LENGTH);
+	if(at < tx.size()) {
+		printf("    reported by the master: %u recoveries, lost -> ready again %u ms\n",
+			   tx[at + 3 + 4 * victim + 1].b, le(tx, at + 3 + 4 * victim + 2, 2));
+	}
+}
+
+// Power run touches: gestures of one contact sliding over 6 columns (2 to 4
+// frames on each), every third one a tap on a far column instead, each
+// followed by POWER_IDLE frames without touch
+static uint32_t powerDwell(uint32_t g) { return 2 + g % 3; }
+static uint32_t powerFrames(uint32_t g) { return ((g % 3) == 2) ? powerDwell(g) : 6 * powerDwell(g); }
+
+// Touched host column of frame k, or -1
+static int powerTouch(uint32_t k)
+{
+	uint32_t len = 0;
+	for(uint32_t g = 0; g < POWER_GESTURES; g++) {
+		uint32_t dwell = powerDwell(g);
+		uint32_t frames = powerFrames(g);
+		if(k < len + frames) {
+			uint32_t i = k - len;
+			if((g % 3) == 2) return (g * 11 + 5) % 30;
+			int start = (g * 7) % 24;
+			return (g % 2) ? start + 5 - (int)(i / dwell) : start + (int)(i / dwell);
+		}
+		len += frames + POWER_IDLE;
+		if(k < len) return -1;
+	}
+	return -1;
+}
+
+// The same touches with the drivers always on, woken on touch only and
+// woken ahead: first touches of a column latched before its amplifier is
+// ready, and average number of amplifiers on
+static void runPower(const Options &o)
+{
+	sim::World &w = sim::World::instance();
+	w.echo = o.echo;
+	if(o.i2cKhz) w.bus().forceClock(o.i2cKhz * 1000);
+	w.runUntil(BOOT_NS);
+
+	HardwareSerial &serial = *w.board("master")->serial;
+	uint32_t frames = 0;
+	for(uint32_t g = 0; g < POWER_GESTURES; g++) frames += powerFrames(g) + POWER_IDLE;
+	printf("\n== power: drv2667 standby scheduler, %u gestures over %u frames every %u us\n",
+		   POWER_GESTURES, frames, o.periodUs);
+	printf("    drivers                 first touches  cold  wait [ms]  amplifiers on   hits misses wakes standbys\n");
+
+	static const char *modes[] = { "always on", "woken on touch", "woken ahead" };
+	static const uint8_t holds[] = { 0, POWER_HOLD | POWER_NO_AHEAD, POWER_HOLD };
+	sim::Time period = (sim::Time)o.periodUs * 1000;
+	for(uint8_t m = 0; m < 3; m++) {
+		sendCommand(serial, SCMD_POWER_HOLD, holds[m]);
+		w.runUntil(w.now() + 500000000LL);
+		requestReport(serial, SCMD_POWER, 1, -1, POWER_LENGTH);
+
+		sim::Time t0 = w.now();
+		uint32_t firsts = 0, cold = 0;
+		double wait = 0;
+		int prev = -1;
+		std::vector<uint8_t> frame;
+		for(uint32_t k = 0; k < frames; k++) {
+			int c = powerTouch(k);
+			frame.clear();
+			frame.push_back(SCMD_START);
+			if(c >= 0) {
+				frame.push_back(1);
+				frame.push_back((uint8_t)c);
+				frame.push_back(2);
+			}
+			frame.push_back(SCMD_STOP);
+			sim::Time at = serial.inject(&frame[0], frame.size(), t0 + k * period);
+			size_t base = 0;
+			uint8_t sn = (c + 1) / 8, ch = (c + 1) % 8;
+			if(c >= 0) base = chainOf(slaveNames[sn])->latches().size();
+			w.runUntil(t0 + (k + 1) * period);
+			if((c < 0) || (c == prev)) {
+				prev = c;
+				continue;
+			}
+			prev = c;
+
+			// the latch of the touch and the amplifier of its column then
+			const std::vector<sim::ShiftRegisterChain::Latch> &l = chainOf(slaveNames[sn])->latches();
+			sim::Drv2667 *d = drvOf(sn, ch);
+			if(!d || base >= l.size() || l[base].t < at - serial.byteTime() * frame.size()) continue;
+			firsts++;
+			if(d->amplifierReady(l[base].t)) continue;
+			cold++;
+			const std::vector<sim::Drv2667::Switch> &sw = d->switches();
+			for(size_t j = sw.size(); j > 0; j--) {
+				if(sw[j - 1].on) {
+					sim::Time ready = sw[j - 1].t + sim::Drv2667::WAKE_TIME;
+					if(ready > l[base].t) wait += ready - l[base].t;
+					break;
+				}
+			}
+		}
+		sim::Time end = w.now();
+		double on = 0;
+		for(uint8_t c = 0; c < 30; c++) {
+			sim::Drv2667 *d = drvOf((c + 1) / 8, (c + 1) % 8);
+			if(d) on += (double)d->onTime(t0, end) / (end - t0);
+		}
+		const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+		size_t at = requestReport(serial, SCMD_POWER, 0, -1, POWER_LENGTH);
+		printf("    %-22s  %13u  %4u  %9.2f  %6.1f of 30  ", modes[m], firsts, cold,
+			   cold ? wait / cold / 1e6 : 0.0, on);
+		if(at < tx.size()) {
+			printf("%5u %6u %5u %8u", le(tx, at + 2, 2), le(tx, at + 4, 2), le(tx, at + 6, 2), le(tx, at + 8, 2));
+		}
+		printf("\n");
+	}
+}
+
+static void runForked(const Scenario *s, const Options &o, bool throughput, void (*other)(const Options &) = runBoot)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		if(s) runScenario(*s, o, throughput);
+		else other(o);
+		fflush(stdout);
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("  !! run failed (status %d)\n", status);
+	}
+}
+
+static void usage(const char *argv0)
+{
+	printf("usage: %s [--frames N] [--period-us P] [--i2c-khz K] [--scenario NAME]\n"
+		   "          [--latch immediate|commit] [--trace FILE] [--echo]\n", argv0);
+	printf("scenarios:");
+	for(size_t i = 0; i < scenarioCount; i++) printf(" %s", scenarios[i].name);
+	printf(" waves jitter recovery power\n");
+}
+
+int main(int argc, char **argv)
+{
+	Options o = { 200, 10000, 0, NULL, false, -1, NULL };
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--frames") && i + 1 < argc) o.frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--period-us") && i + 1 < argc) o.periodUs = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--i2c-khz") && i + 1 < argc) o.i2cKhz = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--scenario") && i + 1 < argc) o.only = argv[++i];
+		else if(!strcmp(argv[i], "--echo")) o.echo = true;
+		else if(!strcmp(argv[i], "--trace") && i + 1 < argc) o.trace = argv[++i];
+		else if(!strcmp(argv[i], "--latch") && i + 1 < argc) {
+			i++;
+			if(!strcmp(argv[i], "immediate")) o.latch = 0;
+			else if(!strcmp(argv[i], "commit")) o.latch = 1;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(o.frames == 0) o.frames = 1;
+
+	printf("HSoundplane benchmark: %u slaves, i2c %s\n", SLAVES,
+		   o.i2cKhz ? "forced" : "as configured by the firmware");
+	if(!o.only) runForked(NULL, o, false);
+	for(size_t i = 0; i < scenarioCount; i++) {
+		if(o.only && strcmp(o.only, scenarios[i].name)) continue;
+		printf("\n== %s: %s\n", scenarios[i].name, scenarios[i].description);
+		runForked(&scenarios[i], o, false);
+		runForked(&scenarios[i], o, true);
+	}
+	if(!o.only || !strcmp(o.only, "waves")) runForked(NULL, o, false, runWaves);
+	if(!o.only || !strcmp(o.only, "jitter")) runForked(NULL, o, false, runJitter);
+	if(!o.only || !strcmp(o.only, "recovery")) runForked(NULL, o, false, runRecovery);
+	if(!o.only || !strcmp(o.only, "power")) runForked(NULL, o, false, runPower);
+	return 0;
+}
@@ -0,0 +1,66 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _AVRTIMING_H
+#define _AVRTIMING_H
+
+#include <stdint.h>
+
+// Cost model of the Arduino core calls on a 16 MHz ATmega328 (nano), in ns.
+// Plain C++ code between two core calls is considered free: the simulation
+// only advances a board's clock when the firmware touches the hardware.
+// Values are rounded from scope measurements of the 1.6.x core.
+namespace sim {
+
+typedef int64_t Time;							// simulated time in ns
+
+namespace cost {
+	const Time loopOverhead			= 1000;		// main() -> loop() + serialEventRun()
+	const Time pinMode				= 4000;
+	const Time digitalWrite			= 3500;
+	const Time digitalRead			= 3000;
+	const Time portWrite			= 125;		// direct port access (2 cycles)
+	const Time micros				= 1500;
+	const Time timerRead			= 125;		// TCNT1 (2 cycles)
+
+	const Time serialAvailable		= 600;
+	const Time serialRead			= 1000;
+	const Time serialWrite			= 1500;		// when the tx ring buffer is not full
+	const Time printDigit			= 4000;		// number formatting, per digit
+
+	const Time spiTransaction		= 1000;		// beginTransaction() / endTransaction()
+	const Time spiTransferOverhead	= 500;		// SPDR load + SPIF polling
+	const Time spiBurstGap			= 250;		// SPIF poll -> next SPDR load in a tight loop
+
+	const Time wireBegin			= 1000;		// beginTransmission()
+	const Time wireWrite			= 300;		// write() into the tx buffer
+	const Time wireRead				= 300;		// read() / available()
+	const Time wireEndOverhead		= 8000;		// twi_writeTo() setup and wait loop
+	const Time twiIsrEntry			= 2500;		// TWI vector + onReceive/onRequest dispatch
+	const Time twiIsrByte			= 3000;		// TWI interrupt per received byte
+	const Time twiMasterIsr			= 1500;		// interrupt driven master, per TWI state
+}
+
+}
+
+#endif
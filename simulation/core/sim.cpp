@@ -0,0 +1,577 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <string.h>
+#include "sim.h"
+
+namespace sim {
+
+/* -------------------------------------------------------------------------- */
+/* | Board																	| */
+/* -------------------------------------------------------------------------- */
+Board::Board(const char *name, Time bootAt) :
+	serial(NULL), wire(NULL), spi(NULL), spiDevice(NULL),
+	mName(name), mNow(bootAt), mBooted(false), mSetupDone(0), mInIsr(false),
+	mSetup(NULL), mLoop(NULL)
+{
+	memset(mLevel, 0, sizeof(mLevel));
+	memset(mOutput, 0, sizeof(mOutput));
+	World::instance().addBoard(this);
+}
+
+bool Board::attach(void (*setup)(void), void (*loop)(void))
+{
+	mSetup = setup;
+	mLoop = loop;
+	return true;
+}
+
+void Board::step(void)
+{
+	if(!mBooted) {
+		mBooted = true;
+		if(mSetup) mSetup();
+		mSetupDone = mNow;
+	} else {
+		if(mLoop) mLoop();
+	}
+	advance(cost::loopOverhead);
+}
+
+// The pins float (the i2c switch loses its address), pending interrupts are
+// dropped and the board answers nothing on the bus until it boots again
+void Board::powerCycle(Time on)
+{
+	mBooted = false;
+	mInIsr = false;
+	mIrqs.clear();
+	memset(mLevel, 0, sizeof(mLevel));
+	memset(mOutput, 0, sizeof(mOutput));
+	for(size_t i = 0; i < mPowerListeners.size(); i++) {
+		mPowerListeners[i]->powerLost(*this, mNow);
+	}
+	if(on > mNow) mNow = on;
+}
+
+void Board::raise(Time at, void (*isr)(void), Time cost)
+{
+	Irq irq = { at, isr, NULL, NULL, cost };
+	mIrqs.push_back(irq);
+}
+
+void Board::raise(Time at, void (*isr)(void *), void *ctx, Time cost)
+{
+	Irq irq = { at, NULL, isr, ctx, cost };
+	mIrqs.push_back(irq);
+}
+
+// Advance to 'until', running the interrupts falling due on the way at their
+// own time. The interrupted core call completes later by the time they took.
+void Board::serviceIrqs(Time until)
+{
+	for(;;) {
+		size_t next = mIrqs.size();
+		for(size_t i = 0; i < mIrqs.size(); i++) {
+			if((mIrqs[i].at <= until) && ((next == mIrqs.size()) || (mIrqs[i].at < mIrqs[next].at))) next = i;
+		}
+		if(next == mIrqs.size()) break;
+		Irq irq = mIrqs[next];
+		mIrqs.erase(mIrqs.begin() + next);
+
+		if(irq.at > mNow) mNow = irq.at;
+		Time start = mNow;
+		mInIsr = true;
+		mNow += irq.cost;
+		if(irq.isr) irq.isr();
+		else irq.ctxIsr(irq.ctx);
+		mInIsr = false;
+		until += mNow - start;
+	}
+	if(until > mNow) mNow = until;
+}
+
+void Board::waitInterrupt(void)
+{
+	if(mIrqs.empty()) {
+		advance(cost::loopOverhead);
+		return;
+	}
+	Time at = mIrqs[0].at;
+	for(size_t i = 1; i < mIrqs.size(); i++) {
+		if(mIrqs[i].at < at) at = mIrqs[i].at;
+	}
+	advanceTo(at);
+}
+
+void Board::beginIsr(Time t, uint8_t bytes)
+{
+	advanceTo(t);
+	advance(cost::twiIsrEntry + bytes * cost::twiIsrByte);
+	mInIsr = true;
+}
+
+void Board::pinMode(uint8_t pin, uint8_t mode)
+{
+	advance(cost::pinMode);
+	if(pin >= PIN_COUNT) return;
+	mOutput[pin] = (mode == 1);
+}
+
+void Board::setLevel(uint8_t pin, uint8_t val)
+{
+	if(pin >= PIN_COUNT) return;
+	uint8_t level = val ? 1 : 0;
+	if(mLevel[pin] == level) return;
+	mLevel[pin] = level;
+	for(size_t i = 0; i < mPinListeners.size(); i++) {
+		mPinListeners[i]->pinChanged(*this, pin, level, mNow);
+	}
+}
+
+void Board::digitalWrite(uint8_t pin, uint8_t val)
+{
+	advance(cost::digitalWrite);
+	setLevel(pin, val);
+}
+
+void Board::portWrite(uint8_t pin, uint8_t val)
+{
+	advance(cost::portWrite);
+	setLevel(pin, val);
+}
+
+int Board::digitalRead(uint8_t pin)
+{
+	advance(cost::digitalRead);
+	return (pin < PIN_COUNT) ? mLevel[pin] : 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* | World																	| */
+/* -------------------------------------------------------------------------- */
+World &World::instance(void)
+{
+	static World world;
+	return world;
+}
+
+Board *World::board(const char *name)
+{
+	for(size_t i = 0; i < mBoards.size(); i++) {
+		if(strcmp(mBoards[i]->name(), name) == 0) return mBoards[i];
+	}
+	return NULL;
+}
+
+void World::runUntil(Time t)
+{
+	for(;;) {
+		Board *next = NULL;
+		for(size_t i = 0; i < mBoards.size(); i++) {
+			if(!next || (mBoards[i]->now() < next->now())) next = mBoards[i];
+		}
+		if(!next || (next->now() >= t)) break;
+		next->step();
+	}
+}
+
+void World::sync(Time t, Board *self)
+{
+	for(size_t i = 0; i < mBoards.size(); i++) {
+		Board *b = mBoards[i];
+		if(b == self || b->inIsr()) continue;
+		while(b->now() < t) b->step();
+	}
+}
+
+Time World::now(void) const
+{
+	Time t = 0;
+	for(size_t i = 0; i < mBoards.size(); i++) {
+		if(i == 0 || mBoards[i]->now() < t) t = mBoards[i]->now();
+	}
+	return t;
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* | I2CBus																	| */
+/* -------------------------------------------------------------------------- */
+I2CBus::I2CBus() :
+	mClock(100000), mForced(false), mBusy(0), mTransactions(0), mBytes(0), mNacks(0)
+{
+}
+
+void I2CBus::addSwitch(Pca954x *sw)
+{
+	mSwitches.push_back(sw);
+	mDevices.push_back(sw);
+}
+
+void I2CBus::collect(uint8_t addr, std::vector<I2CDevice *> &out)
+{
+	out.clear();
+	for(size_t i = 0; i < mDevices.size(); i++) {
+		if(mDevices[i]->i2cPresent(addr)) out.push_back(mDevices[i]);
+	}
+	// devices behind the open channels of every switch see the transaction
+	for(size_t i = 0; i < mSwitches.size(); i++) {
+		uint8_t ctrl = mSwitches[i]->control();
+		for(uint8_t ch = 0; ch < Pca954x::CHANNELS; ch++) {
+			if(!(ctrl & (1 << ch))) continue;
+			const std::vector<I2CDevice *> &ds = mSwitches[i]->downstream(ch);
+			for(size_t j = 0; j < ds.size(); j++) {
+				if(ds[j]->i2cPresent(addr)) out.push_back(ds[j]);
+			}
+		}
+	}
+}
+
+void I2CBus::record(uint8_t addr, bool read, const uint8_t *data, uint8_t len,
+					uint8_t status, Time start, Time end)
+{
+	mBusy += end - start;
+	mTransactions++;
+	mBytes += 1 + ((status == 0) ? len : 0);
+	if(status != 0) mNacks++;
+	for(size_t i = 0; i < mMonitors.size(); i++) {
+		mMonitors[i]->i2cTransaction(addr, read, data, len, status, start, end);
+	}
+}
+
+uint8_t I2CBus::transmit(Board &master, uint8_t addr, const uint8_t *data, uint8_t len, Time *end)
+{
+	World &w = World::instance();
+	Time start = master.now();
+	w.sync(start, &master);
+
+	std::vector<I2CDevice *> targets;
+	collect(addr, targets);
+
+	// START + address + ACK (+ data + ACK) + STOP
+	if(targets.empty()) {
+		*end = start + bitTime() * (2 + 9);
+		record(addr, false, data, len, 2, start, *end);
+		return 2;
+	}
+	// devices with a board of their own take the data in their TWI interrupt
+	*end = start + bitTime() * (2 + 9 * (1 + len));
+	for(size_t i = 0; i < targets.size(); i++) {
+		targets[i]->i2cReceive(data, len, *end);
+	}
+	record(addr, false, data, len, 0, start, *end);
+	return 0;
+}
+
+uint8_t I2CBus::receive(Board &master, uint8_t addr, uint8_t *data, uint8_t len, Time *end)
+{
+	World &w = World::instance();
+	Time start = master.now();
+	w.sync(start, &master);
+
+	std::vector<I2CDevice *> targets;
+	collect(addr, targets);
+
+	if(targets.empty()) {
+		*end = start + bitTime() * (2 + 9);
+		record(addr, true, data, 0, 2, start, *end);
+		return 2;
+	}
+
+	// the addressed device prepares its answer with SCL held low
+	Time addressed = start + bitTime() * (1 + 9);
+	w.sync(addressed, &master);
+	Time stretch = 0;
+	memset(data, 0xFF, len);
+	targets[0]->i2cRequest(data, len, addressed, &stretch);
+	*end = addressed + stretch + bitTime() * (1 + 9 * len);
+	record(addr, true, data, len, 0, start, *end);
+	return 0;
+}
+
+uint8_t I2CBus::write(Board &master, uint8_t addr, const uint8_t *data, uint8_t len)
+{
+	Time end;
+	uint8_t ret = transmit(master, addr, data, len, &end);
+	master.advanceTo(end);
+	return ret;
+}
+
+uint8_t I2CBus::read(Board &master, uint8_t addr, uint8_t *data, uint8_t len)
+{
+	Time end;
+	uint8_t ret = receive(master, addr, data, len, &end);
+	master.advanceTo(end);
+	return ret;
+}
+
+uint8_t I2CBus::start(Board &master, uint8_t addr, bool read, uint8_t *data, uint8_t len, Time *end)
+{
+	if(read) return receive(master, addr, data, len, end);
+	return transmit(master, addr, data, len, end);
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* | ShiftRegisterChain														| */
+/* -------------------------------------------------------------------------- */
+ShiftRegisterChain::ShiftRegisterChain(Board &board, uint8_t loadPin, uint8_t clrPin, uint8_t length) :
+	mLoadPin(loadPin), mClrPin(clrPin), mLength(length), mBytes(0)
+{
+	if(mLength > MAX_LENGTH) mLength = MAX_LENGTH;
+	memset(mShift, 0, sizeof(mShift));
+	memset(mOutput, 0, sizeof(mOutput));
+	board.spiDevice = this;
+	board.addPinListener(this);
+}
+
+void ShiftRegisterChain::spiByte(uint8_t b, Time t)
+{
+	(void)t;
+	memmove(&mShift[1], &mShift[0], mLength - 1);
+	mShift[0] = b;
+	mBytes++;
+}
+
+void ShiftRegisterChain::pinChanged(Board &board, uint8_t pin, uint8_t level, Time t)
+{
+	(void)board;
+	if(pin == mClrPin && level == 0) {
+		memset(mShift, 0, sizeof(mShift));
+	} else if(pin == mLoadPin && level == 1) {
+		memcpy(mOutput, mShift, sizeof(mOutput));
+		Latch l;
+		l.t = t;
+		memcpy(l.image, mShift, sizeof(l.image));
+		mLatches.push_back(l);
+	}
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* | Pca954x																| */
+/* -------------------------------------------------------------------------- */
+Pca954x::Pca954x(Board &board, uint8_t baseAddr, uint8_t a0, uint8_t a1, uint8_t a2) :
+	mBoard(board), mBase(baseAddr), mControl(0)
+{
+	mPins[0] = a0;
+	mPins[1] = a1;
+	mPins[2] = a2;
+	World::instance().bus().addSwitch(this);
+	board.addPowerListener(this);
+}
+
+// The hardware address is only valid once the slave drives the address pins
+bool Pca954x::i2cPresent(uint8_t addr)
+{
+	uint8_t a = mBase;
+	for(uint8_t i = 0; i < 3; i++) {
+		if(!mBoard.isOutput(mPins[i])) return false;
+		if(mBoard.level(mPins[i])) a |= (1 << i);
+	}
+	return addr == a;
+}
+
+void Pca954x::i2cReceive(const uint8_t *data, uint8_t len, Time t)
+{
+	(void)t;
+	if(len > 0) mControl = data[len - 1];
+}
+
+uint8_t Pca954x::i2cRequest(uint8_t *data, uint8_t len, Time t, Time *stretch)
+{
+	(void)t;
+	*stretch = 0;
+	for(uint8_t i = 0; i < len; i++) data[i] = mControl;
+	return len;
+}
+
+
+/* -------------------------------------------------------------------------- */
+/* | Drv2667																| */
+/* -------------------------------------------------------------------------- */
+Drv2667::Drv2667() : mPointer(0), mWrites(0),
+	mFifoSamples(0), mFifoUnderruns(0), mFifoOverflows(0)
+{
+	reset();
+}
+
+void Drv2667::reset(void)
+{
+	memset(mMem, 0, sizeof(mMem));
+	mMem[0][0x00] = 0x02;			// FIFO_EMPTY
+	mMem[0][0x01] = 0x18;			// chip ID 3
+	mMem[0][0x02] = 0x40;			// STANDBY
+	mPointer = 0;
+	mFifoLevel = 0;
+	mFifoTime = 0;
+	mFifoStarved = false;
+}
+
+bool Drv2667::amplifierOn(void) const
+{
+	uint8_t r2 = mMem[0][0x02];
+	return (r2 & 0x02) && !(r2 & 0x40);
+}
+
+// Enabled for WAKE_TIME at time t
+bool Drv2667::amplifierReady(Time t) const
+{
+	for(size_t i = mSwitches.size(); i > 0; i--) {
+		if(mSwitches[i - 1].t <= t) return mSwitches[i - 1].on && (t - mSwitches[i - 1].t >= WAKE_TIME);
+	}
+	return false;
+}
+
+// Time the amplifier was enabled within [from, to)
+Time Drv2667::onTime(Time from, Time to) const
+{
+	Time sum = 0;
+	for(size_t i = 0; i < mSwitches.size(); i++) {
+		if(!mSwitches[i].on) continue;
+		Time a = mSwitches[i].t;
+		Time b = (i + 1 < mSwitches.size()) ? mSwitches[i + 1].t : to;
+		if(a < from) a = from;
+		if(b > to) b = to;
+		if(b > a) sum += b - a;
+	}
+	return sum;
+}
+
+void Drv2667::powerLost(Board &board, Time t)
+{
+	(void)board;
+	bool was = amplifierOn();
+	reset();
+	if(was) mSwitches.push_back(Switch{ t, false });
+}
+
+bool Drv2667::i2cPresent(uint8_t addr)
+{
+	return addr == 0x59;
+}
+
+void Drv2667::drain(Time t)
+{
+	if(mFifoLevel == 0) return;
+	Time played = (t - mFifoTime) / SAMPLE_TIME;
+	if(played >= mFifoLevel) {
+		mFifoLevel = 0;
+		mFifoStarved = true;
+		mMem[0][0x00] = (mMem[0][0x00] & ~0x01) | 0x02;
+	} else if(played > 0) {
+		mFifoLevel -= (uint8_t)played;
+		mFifoTime += played * SAMPLE_TIME;
+		mMem[0][0x00] &= ~0x01;
+	}
+}
+
+void Drv2667::go(Time t)
+{
+	// analog input: nothing to play
+	if(mMem[0][0x01] & 0x04) return;
+	uint8_t hdr = mMem[1][0x00];
+	for(uint8_t r = 0x03; r <= 0x0A && mMem[0][r] != 0; r++) {
+		Play p;
+		p.t = t;
+		p.id = mMem[0][r] & 0x7F;
+		p.valid = false;
+		if((p.id * 5) <= hdr) {
+			const uint8_t *h = &mMem[1][1 + (p.id - 1) * 5];
+			uint16_t start = ((h[0] & 0x07) << 8) | h[1];
+			uint16_t stop = ((h[2] & 0x07) << 8) | h[3];
+			p.valid = (h[0] & 0x80) && (stop >= start) && (((stop - start + 1) % 4) == 0);
+		}
+		mPlays.push_back(p);
+	}
+}
+
+void Drv2667::store(uint8_t r, uint8_t v, Time t)
+{
+	uint8_t page = mMem[0][0xFF];
+	if(r == 0xFF) {
+		mMem[0][0xFF] = (v < PAGES) ? v : 0;
+		return;
+	}
+	if(page == 0) {
+		if(r == 0x02 && (v & 0x80)) {
+			reset();
+			return;
+		}
+		if(r == 0x00 || r > 0x0B) return;		// read only / illegal
+		if(r == 0x0B) {
+			drain(t);
+			if(mFifoLevel >= FIFO_SIZE) {
+				mFifoOverflows++;
+				return;
+			}
+			if(mFifoLevel == 0) {
+				if(mFifoStarved) mFifoUnderruns++;
+				mFifoStarved = false;
+				mFifoTime = t;
+			}
+			mFifoLevel++;
+			mFifoSamples++;
+			mMem[0][0x00] &= ~0x02;					// fifo no longer empty
+			if(mFifoLevel >= FIFO_SIZE) mMem[0][0x00] |= 0x01;
+			return;
+		}
+		if(r == 0x02 && (v & 0x01)) {
+			mMem[0][r] = v & ~0x01;					// GO clears itself
+			go(t);
+			return;
+		}
+		mMem[0][r] = v;
+	} else {
+		mMem[page][r] = v;
+	}
+}
+
+void Drv2667::i2cReceive(const uint8_t *data, uint8_t len, Time t)
+{
+	if(len == 0) return;
+	mPointer = data[0];
+	for(uint8_t i = 1; i < len; i++) {
+		bool was = amplifierOn();
+		store(mPointer, data[i], t);
+		if(amplifierOn() != was) mSwitches.push_back(Switch{ t, !was });
+		mWrites++;
+		// the page register and the fifo do not auto-increment
+		if(mPointer != 0xFF && !(mMem[0][0xFF] == 0 && mPointer == 0x0B)) mPointer++;
+	}
+}
+
+uint8_t Drv2667::i2cRequest(uint8_t *data, uint8_t len, Time t, Time *stretch)
+{
+	*stretch = 0;
+	drain(t);
+	uint8_t page = mMem[0][0xFF];
+	for(uint8_t i = 0; i < len; i++) {
+		data[i] = (mPointer == 0xFF) ? page : mMem[page][mPointer];
+		if(mPointer != 0xFF) mPointer++;
+	}
+	return len;
+}
+
+}
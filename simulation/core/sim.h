@@ -0,0 +1,365 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "avrTiming.h"
+
+class HardwareSerial;
+class TwoWire;
+class SPIClass;
+
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+/* | HSoundplane host simulation											| */
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+// Every firmware (master, slave1..4) is compiled into its own namespace and
+// runs on a simulated Board with its own clock. The World steps the board with
+// the smallest clock, and brings every other board up to date before a bus
+// transaction, so that i2c traffic is always delivered in causal order.
+namespace sim {
+
+class Board;
+
+// Receives level changes of the pins of a board
+class PinListener {
+public:
+	virtual ~PinListener() {}
+	virtual void pinChanged(Board &board, uint8_t pin, uint8_t level, Time t) = 0;
+};
+
+// Hardware losing its state with the power of a board
+class PowerListener {
+public:
+	virtual ~PowerListener() {}
+	virtual void powerLost(Board &board, Time t) = 0;
+};
+
+// Receives the bytes clocked out by the SPI master of a board
+class SpiDevice {
+public:
+	virtual ~SpiDevice() {}
+	virtual void spiByte(uint8_t b, Time t) = 0;
+};
+
+// Device sitting on the i2c bus (or behind a channel of an i2c switch)
+class I2CDevice {
+public:
+	virtual ~I2CDevice() {}
+	virtual bool i2cPresent(uint8_t addr) = 0;
+	// master -> device write (data does not include the address byte)
+	virtual void i2cReceive(const uint8_t *data, uint8_t len, Time t) = 0;
+	// device -> master read, returns the number of bytes provided and the
+	// time the device held SCL low while preparing them
+	virtual uint8_t i2cRequest(uint8_t *data, uint8_t len, Time t, Time *stretch) = 0;
+};
+
+// Observer of every bus transaction (benchmark, trace capture)
+class I2CMonitor {
+public:
+	virtual ~I2CMonitor() {}
+	virtual void i2cTransaction(uint8_t addr, bool read, const uint8_t *data, uint8_t len,
+								uint8_t status, Time start, Time end) = 0;
+};
+
+
+/* -------------------------------------------------------------------------- */
+/* | Board																	| */
+/* -------------------------------------------------------------------------- */
+class Board {
+public:
+	Board(const char *name, Time bootAt = 0);
+
+	const char *name(void) const { return mName; }
+	Time now(void) const { return mNow; }
+	void advance(Time dt) { advanceTo(mNow + dt); }
+	void advanceTo(Time t)
+	{
+		if(!mIrqs.empty() && !mInIsr) serviceIrqs(t);
+		else if(t > mNow) mNow = t;
+	}
+
+	bool attach(void (*setup)(void), void (*loop)(void));
+	bool booted(void) const { return mBooted; }
+	Time setupDone(void) const { return mSetupDone; }
+	void step(void);
+	// power the board off now and back on at 'on' (setup() runs again, the
+	// firmware globals keep their values as on a warm reset)
+	void powerCycle(Time on);
+	void addPowerListener(PowerListener *l) { mPowerListeners.push_back(l); }
+
+	// timed interrupts: isr runs as soon as the board clock reaches 'at' and
+	// steals 'cost' from the interrupted core call
+	void raise(Time at, void (*isr)(void), Time cost);
+	void raise(Time at, void (*isr)(void *), void *ctx, Time cost);
+	void waitInterrupt(void);
+
+	// interrupt context (i2c slave callbacks)
+	void beginIsr(Time t, uint8_t bytes);
+	void endIsr(void) { mInIsr = false; }
+	bool inIsr(void) const { return mInIsr; }
+
+	// pins
+	void pinMode(uint8_t pin, uint8_t mode);
+	void digitalWrite(uint8_t pin, uint8_t val);
+	int digitalRead(uint8_t pin);
+	void portWrite(uint8_t pin, uint8_t val);
+	uint8_t level(uint8_t pin) const { return mLevel[pin]; }
+	bool isOutput(uint8_t pin) const { return mOutput[pin]; }
+	void addPinListener(PinListener *l) { mPinListeners.push_back(l); }
+
+	// peripherals (set by the core objects declared in the firmware namespace)
+	HardwareSerial *serial;
+	TwoWire *wire;
+	SPIClass *spi;
+	SpiDevice *spiDevice;
+
+private:
+	struct Irq {
+		Time at;
+		void (*isr)(void);
+		void (*ctxIsr)(void *);
+		void *ctx;
+		Time cost;
+	};
+
+	void setLevel(uint8_t pin, uint8_t val);
+	void serviceIrqs(Time until);
+
+	static const uint8_t PIN_COUNT = 24;
+	const char *mName;
+	Time mNow;
+	bool mBooted;
+	Time mSetupDone;
+	bool mInIsr;
+	void (*mSetup)(void);
+	void (*mLoop)(void);
+	uint8_t mLevel[PIN_COUNT];
+	bool mOutput[PIN_COUNT];
+	std::vector<PinListener *> mPinListeners;
+	std::vector<PowerListener *> mPowerListeners;
+	std::vector<Irq> mIrqs;
+};
+
+
+/* -------------------------------------------------------------------------- */
+/* | I2CBus																	| */
+/* -------------------------------------------------------------------------- */
+class Pca954x;
+
+class I2CBus {
+public:
+	I2CBus();
+
+	void setClock(uint32_t hz) { if(!mForced) mClock = hz; }
+	void forceClock(uint32_t hz) { mClock = hz; mForced = true; }
+	uint32_t clock(void) const { return mClock; }
+	Time bitTime(void) const { return 1000000000LL / mClock; }
+
+	void addDevice(I2CDevice *dev) { mDevices.push_back(dev); }
+	void addSwitch(Pca954x *sw);
+	void addMonitor(I2CMonitor *m) { mMonitors.push_back(m); }
+	const std::vector<Pca954x *> &switches(void) const { return mSwitches; }
+
+	// All return the i2c status of Wire.endTransmission() (0 = success).
+	// write() and read() block the master until the end of the transaction,
+	// start() runs it from the master's current time and only returns its end.
+	uint8_t write(Board &master, uint8_t addr, const uint8_t *data, uint8_t len);
+	uint8_t read(Board &master, uint8_t addr, uint8_t *data, uint8_t len);
+	uint8_t start(Board &master, uint8_t addr, bool read, uint8_t *data, uint8_t len, Time *end);
+
+	// statistics
+	Time busyTime(void) const { return mBusy; }
+	uint32_t transactions(void) const { return mTransactions; }
+	uint32_t bytes(void) const { return mBytes; }
+	uint32_t nacks(void) const { return mNacks; }
+	void resetStats(void) { mBusy = 0; mTransactions = 0; mBytes = 0; mNacks = 0; }
+
+private:
+	void collect(uint8_t addr, std::vector<I2CDevice *> &out);
+	uint8_t transmit(Board &master, uint8_t addr, const uint8_t *data, uint8_t len, Time *end);
+	uint8_t receive(Board &master, uint8_t addr, uint8_t *data, uint8_t len, Time *end);
+	void record(uint8_t addr, bool read, const uint8_t *data, uint8_t len,
+				uint8_t status, Time start, Time end);
+
+	uint32_t mClock;
+	bool mForced;
+	std::vector<I2CDevice *> mDevices;
+	std::vector<Pca954x *> mSwitches;
+	std::vector<I2CMonitor *> mMonitors;
+	Time mBusy;
+	uint32_t mTransactions;
+	uint32_t mBytes;
+	uint32_t mNacks;
+};
+
+
+/* -------------------------------------------------------------------------- */
+/* | World																	| */
+/* -------------------------------------------------------------------------- */
+class World {
+public:
+	static World &instance(void);
+
+	void addBoard(Board *b) { mBoards.push_back(b); }
+	Board *board(const char *name);
+	const std::vector<Board *> &boards(void) const { return mBoards; }
+	I2CBus &bus(void) { return mBus; }
+
+	// run every board until its clock reaches t
+	void runUntil(Time t);
+	// bring every board except 'self' up to t
+	void sync(Time t, Board *self);
+	Time now(void) const;
+
+	// echo the serial output of the boards to stdout
+	bool echo;
+
+private:
+	World() : echo(false) {}
+	std::vector<Board *> mBoards;
+	I2CBus mBus;
+};
+
+
+/* -------------------------------------------------------------------------- */
+/* | Slave board hardware													| */
+/* -------------------------------------------------------------------------- */
+// 74HC595 chain clocked by SPI, latched on a rising edge of the load pin
+class ShiftRegisterChain : public SpiDevice, public PinListener {
+public:
+	static const uint8_t MAX_LENGTH = 16;
+	struct Latch {
+		Time t;
+		uint8_t image[MAX_LENGTH];	// image[0] = register closest to the output end
+	};
+
+	ShiftRegisterChain(Board &board, uint8_t loadPin, uint8_t clrPin, uint8_t length);
+
+	void spiByte(uint8_t b, Time t);
+	void pinChanged(Board &board, uint8_t pin, uint8_t level, Time t);
+
+	uint8_t length(void) const { return mLength; }
+	const uint8_t *outputs(void) const { return mOutput; }
+	const std::vector<Latch> &latches(void) const { return mLatches; }
+	uint32_t bytesShifted(void) const { return mBytes; }
+
+private:
+	uint8_t mLoadPin;
+	uint8_t mClrPin;
+	uint8_t mLength;
+	uint8_t mShift[MAX_LENGTH];
+	uint8_t mOutput[MAX_LENGTH];
+	uint32_t mBytes;
+	std::vector<Latch> mLatches;
+};
+
+// PCA9548 8-channel i2c switch, hardware address driven by three board pins
+class Pca954x : public I2CDevice, public PowerListener {
+public:
+	static const uint8_t CHANNELS = 8;
+
+	Pca954x(Board &board, uint8_t baseAddr, uint8_t a0, uint8_t a1, uint8_t a2);
+
+	void attach(uint8_t channel, I2CDevice *dev) { mDownstream[channel].push_back(dev); }
+	uint8_t control(void) const { return mControl; }
+	const std::vector<I2CDevice *> &downstream(uint8_t channel) const { return mDownstream[channel]; }
+
+	bool i2cPresent(uint8_t addr);
+	void i2cReceive(const uint8_t *data, uint8_t len, Time t);
+	uint8_t i2cRequest(uint8_t *data, uint8_t len, Time t, Time *stretch);
+	void powerLost(Board &board, Time t) { (void)board; (void)t; mControl = 0; }
+
+private:
+	Board &mBoard;
+	uint8_t mBase;
+	uint8_t mPins[3];
+	uint8_t mControl;
+	std::vector<I2CDevice *> mDownstream[CHANNELS];
+};
+
+// TI DRV2667 piezo driver (page 0 control registers + waveform RAM pages).
+// GO plays the sequencer (recorded, the waveform itself takes no time) and
+// the FIFO drains at 8 kHz. The amplifier is ready WAKE_TIME after it is
+// enabled out of standby (boost start-up).
+class Drv2667 : public I2CDevice, public PowerListener {
+public:
+	static const uint8_t PAGES = 9;
+	static const uint8_t FIFO_SIZE = 100;
+	static const Time SAMPLE_TIME = 125000;
+	static const Time WAKE_TIME = 2000000;
+	struct Play {
+		Time t;
+		uint8_t id;						// waveform ID (1..)
+		bool valid;						// ID within the RAM header, synthesizer entries
+	};
+	struct Switch {
+		Time t;
+		bool on;						// amplifier enabled / back to standby
+	};
+
+	Drv2667();
+
+	uint8_t reg(uint8_t page, uint8_t r) const { return mMem[page][r]; }
+	bool amplifierOn(void) const;
+	bool amplifierReady(Time t) const;
+	Time onTime(Time from, Time to) const;
+	const std::vector<Switch> &switches(void) const { return mSwitches; }
+	uint32_t writes(void) const { return mWrites; }
+	const std::vector<Play> &plays(void) const { return mPlays; }
+	uint32_t fifoSamples(void) const { return mFifoSamples; }
+	uint32_t fifoUnderruns(void) const { return mFifoUnderruns; }
+	uint32_t fifoOverflows(void) const { return mFifoOverflows; }
+
+	bool i2cPresent(uint8_t addr);
+	void i2cReceive(const uint8_t *data, uint8_t len, Time t);
+	uint8_t i2cRequest(uint8_t *data, uint8_t len, Time t, Time *stretch);
+	void powerLost(Board &board, Time t);
+
+private:
+	void reset(void);
+	void store(uint8_t r, uint8_t v, Time t);
+	void drain(Time t);
+	void go(Time t);
+
+	uint8_t mMem[PAGES][256];
+	uint8_t mPointer;
+	uint32_t mWrites;
+	std::vector<Play> mPlays;
+	std::vector<Switch> mSwitches;
+	uint8_t mFifoLevel;
+	Time mFifoTime;						// time the first sample of the FIFO started playing
+	bool mFifoStarved;					// FIFO ran empty since the last write
+	uint32_t mFifoSamples;
+	uint32_t mFifoUnderruns;
+	uint32_t mFifoOverflows;
+};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Per-board Arduino core, included INSIDE the namespace of a firmware before
+// the firmware sources (no include guard on purpose). SIM_NODE_NAME names the
+// board, SIM_NODE_BOOT_NS delays its power-on.
+
+#ifndef SIM_NODE_BOOT_NS
+#define SIM_NODE_BOOT_NS	0
+#endif
+
+static sim::Board simBoard(SIM_NODE_NAME, SIM_NODE_BOOT_NS);
+static HardwareSerial Serial(simBoard);
+static TwoWire Wire(simBoard);
+static SPIClass SPI(simBoard);
+
+static inline void pinMode(uint8_t pin, uint8_t mode) { simBoard.pinMode(pin, mode); }
+static inline void digitalWrite(uint8_t pin, uint8_t val) { simBoard.digitalWrite(pin, val); }
+static inline int digitalRead(uint8_t pin) { return simBoard.digitalRead(pin); }
+
+static inline unsigned long micros(void)
+{
+	simBoard.advance(sim::cost::micros);
+	return (unsigned long)(simBoard.now() / 1000) & ~3UL;	// 4 us resolution @ 16 MHz
+}
+// Direct port access and Timer1 at F_CPU (host side of PORTx / PINx / TCNT1)
+static inline void simPortWrite(uint8_t pin, uint8_t val) { simBoard.portWrite(pin, val); }
+static inline void simPortToggle(uint8_t pin) { simBoard.portWrite(pin, !simBoard.level(pin)); }
+static inline uint16_t simCycleCount(void)
+{
+	simBoard.advance(sim::cost::timerRead);
+	return (uint16_t)(simBoard.now() * (F_CPU / 1000000) / 1000);
+}
+
+// Back-to-back SPDR write, waiting for SPIF (no SPI.transfer() overhead)
+static inline void simSpiPut(uint8_t b)
+{
+	simBoard.advance(sim::cost::spiBurstGap + (8000000000LL / SPI.clock()));
+	if(simBoard.spiDevice) simBoard.spiDevice->spiByte(b, simBoard.now());
+}
+
+static inline unsigned long millis(void) { return (unsigned long)(simBoard.now() / 1000000); }
+static inline void delay(unsigned long ms) { simBoard.advance((sim::Time)ms * 1000000); }
+static inline void delayMicroseconds(unsigned int us) { simBoard.advance((sim::Time)us * 1000); }
+
+// Interrupt driven TWI master (used instead of Wire by the master's i2c queue):
+// the transaction runs on the simulated bus, isr is raised at its end.
+static inline void simTwiBegin(uint32_t clock) { sim::World::instance().bus().setClock(clock); }
+static inline uint8_t simTwiStart(uint8_t addr, bool read, uint8_t *data, uint8_t len, void (*isr)(void))
+{
+	sim::Time end;
+	uint8_t status = sim::World::instance().bus().start(simBoard, addr, read, data, len, &end);
+	// one TWI interrupt per START, address and data byte
+	simBoard.raise(end, isr, (2 + len) * sim::cost::twiMasterIsr);
+	return status;
+}
+static inline void simWaitInterrupt(void) { simBoard.waitInterrupt(); }
+static inline void simGeneralCall(void) { Wire.generalCall(true); }
@@ -0,0 +1,54 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Slave firmware built for the host simulation, together with the hardware of
+// the piezo-driver board: 9 x 74HC595, PCA9548 switch and 8 x DRV2667.
+// Compiled once per slave with SLAVE_ID and SIM_NODE set (see CMakeLists.txt).
+#include "Arduino.h"
+#include "Wire.h"
+#include "SPI.h"
+
+#define SIM_STR2(x)			#x
+#define SIM_STR(x)			SIM_STR2(x)
+
+namespace SIM_NODE {
+#define SIM_NODE_NAME		SIM_STR(SIM_NODE)
+#include "simGlue.h"
+#include "slaveController.ino"
+
+static const bool simAttached = simBoard.attach(setup, loop);
+
+static sim::ShiftRegisterChain simShiftRegisters(simBoard, LOAD_PIN, CLR_PIN, 9);
+static sim::Pca954x simSwitch(simBoard, I2C_SWITCH_ADDR_BASE, SW_ADDR_0, SW_ADDR_1, SW_ADDR_2);
+static sim::Drv2667 simDrv[HS_DPS];
+
+static bool simWire(void)
+{
+	for(uint8_t i = 0; i < HS_DPS; i++) {
+		simSwitch.attach(i, &simDrv[i]);
+		simBoard.addPowerListener(&simDrv[i]);	// same supply as the board
+	}
+	return true;
+}
+static const bool simWired = simWire();
+}
@@ -0,0 +1,291 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Throughput of the host client library (hostClient/hsClient.h) against the
+// simulated master. The client talks to the master's serial port through a
+// link adding LINK latency each way (USB polling) in simulated time, first
+// stop-and-wait, then with a window of frames in flight written in batches,
+// then with frames damaged on the way (a byte lost, a bad coordinate) and
+// with the host itself sending a bad coordinate, to check that the lost
+// frames are sent again, the bad ones only reported, and every frame gets
+// acknowledged.
+// --pty runs the simulated master behind a pseudo terminal instead and
+// streams to it through the client's POSIX serial port (wall clock time).
+// --capture FILE saves what the client sent in the windowed run, for
+// tools/hsReplay.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "Arduino.h"
+#include "hsClient.h"
+
+#define BOOT_NS				2000000000LL
+#define STEP_NS				20000		// simulation step while waiting for a reply
+
+struct Options {
+	uint32_t frames;
+	uint32_t latencyUs;					// link latency, each way
+	bool pty;
+	const char *capture;				// capture of the windowed run (cap_rx)
+};
+
+/* -------------------------------------------------------------------------- */
+/* | SimLink																| */
+/* -------------------------------------------------------------------------- */
+// Transport to the simulated master's serial port. Damages the n-th frame
+// written (counting the ones sent again), dropping its length byte or
+// turning its first column into a bad one (damage_host: the client sends
+// the bad column of every n-th frame itself, the link leaves it alone).
+class SimLink : public hs::Transport {
+public:
+	enum Damage { damage_none, damage_drop, damage_coord, damage_host };
+
+	SimLink(HardwareSerial &serial, sim::Time latency, Damage damage, uint32_t every)
+		: mSerial(serial), mLatency(latency), mDamage(damage), mEvery(every),
+		  mStarts(0), mCursor(serial.sent().size()) {}
+
+	bool write(const uint8_t *data, size_t len)
+	{
+		std::vector<uint8_t> out;
+		for(size_t i = 0; i < len; i++) {
+			bool damaged = false;
+			if(data[i] == hs::SCMD_START) mStarts++;
+			// damage the length byte (after SEQ seq) of every mEvery-th frame
+			if((mDamage == damage_drop || mDamage == damage_coord) && (mStarts % mEvery) == 0 && i >= 3 &&
+			   data[i - 3] == hs::SCMD_START && data[i - 2] == hs::SCMD_SEQ) {
+				damaged = true;
+				if(mDamage == damage_coord) {
+					out.push_back(data[i]);
+					if(i + 1 < len && data[i] > 0) {
+						out.push_back(99);	// column outside of the surface
+						i++;
+					}
+				}
+			}
+			if(!damaged) out.push_back(data[i]);
+		}
+		sim::World &w = sim::World::instance();
+		mSerial.inject(&out[0], out.size(), w.now() + mLatency);
+		return true;
+	}
+
+	int read(uint8_t *data, size_t len, uint32_t timeoutUs)
+	{
+		sim::World &w = sim::World::instance();
+		sim::Time deadline = w.now() + (sim::Time)timeoutUs * 1000;
+		const std::vector<HardwareSerial::Byte> &tx = mSerial.sent();
+		for(;;) {
+			size_t n = 0;
+			while((n < len) && (mCursor < tx.size()) && (tx[mCursor].t + mLatency <= w.now())) {
+				data[n++] = tx[mCursor++].b;
+			}
+			if(n > 0 || w.now() >= deadline) return (int)n;
+			w.runUntil(std::min(deadline, w.now() + STEP_NS));
+		}
+	}
+
+	uint64_t nowUs(void) { return sim::World::instance().now() / 1000; }
+
+private:
+	HardwareSerial &mSerial;
+	sim::Time mLatency;
+	Damage mDamage;
+	uint32_t mEvery;
+	uint32_t mStarts;
+	size_t mCursor;
+};
+
+/* -------------------------------------------------------------------------- */
+/* | runs																	| */
+/* -------------------------------------------------------------------------- */
+// 16 contacts moving over the surface
+static void densePairs(uint32_t k, uint8_t pairs[hs::COORD_MAX][2])
+{
+	for(uint8_t i = 0; i < hs::COORD_MAX; i++) {
+		pairs[i][0] = (i * 2 + (k % 2)) % 30;
+		pairs[i][1] = (i + k) % 5;
+	}
+}
+
+static void printStats(const hs::Client::Stats &s, double seconds)
+{
+	printf("    %.0f frames/s, acked %u/%u, %u sent again (%u naks, %u bad coordinates, %u timeouts), %u writes\n",
+		   s.acked / seconds, s.acked, s.frames, s.resent, s.naks, s.coordErrors, s.timeouts, s.writes);
+}
+
+static void runSim(const Options &o, const char *title, uint8_t window, uint8_t batch,
+				   SimLink::Damage damage, uint32_t every, const char *capture)
+{
+	sim::World &w = sim::World::instance();
+	w.runUntil(BOOT_NS);
+	HardwareSerial &serial = *w.board("master")->serial;
+	
+	SimLink link(serial, (sim::Time)o.latencyUs * 1000, damage, every);
+	hs::Client::Options co;
+	co.window = window;
+	co.batch = batch;
+	hs::Capture cap;
+	if(capture) co.capture = &cap;
+	hs::Client client(link, co);
+	client.begin();
+	
+	printf("  %s\n", title);
+	sim::Time t0 = w.now();
+	uint8_t pairs[hs::COORD_MAX][2];
+	for(uint32_t k = 0; k < o.frames; k++) {
+		densePairs(k, pairs);
+		if(damage == SimLink::damage_host && (k % every) == (every - 1)) {
+			pairs[0][0] = 99;			// column outside of the surface
+		}
+		if(!client.sendPairs(pairs, hs::COORD_MAX)) {
+			printf("    !! frame %u not sent\n", k);
+			return;
+		}
+		client.poll(0);
+	}
+	if(!client.flush()) printf("    !! frames left unacknowledged: %u\n", client.inFlight());
+	printStats(client.stats(), (w.now() - t0) / 1e9);
+	if(capture && !cap.save(capture)) printf("    !! cannot write %s\n", capture);
+	else if(capture) printf("    capture: %u writes saved to %s\n", (uint32_t)cap.records().size(), capture);
+}
+
+static void runForked(const Options &o, const char *title, uint8_t window, uint8_t batch,
+					  SimLink::Damage damage = SimLink::damage_none, uint32_t every = 0,
+					  const char *capture = NULL)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		runSim(o, title, window, batch, damage, every, capture);
+		fflush(stdout);
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("  !! run failed (status %d)\n", status);
+	}
+}
+
+// The simulated master behind a pseudo terminal: bytes from the host are
+// injected as they come, the master's output is written back, the
+// simulation advancing 1 ms per round
+static void ptyDevice(int fd)
+{
+	sim::World &w = sim::World::instance();
+	w.runUntil(BOOT_NS);
+	HardwareSerial &serial = *w.board("master")->serial;
+	size_t cursor = serial.sent().size();
+	uint8_t buf[256];
+	for(;;) {
+		struct pollfd p = { fd, POLLIN, 0 };
+		if(::poll(&p, 1, 1) > 0) {
+			ssize_t n = ::read(fd, buf, sizeof(buf));
+			if(n <= 0) return;
+			serial.inject(buf, n, w.now());
+		}
+		w.runUntil(w.now() + 1000000LL);
+		const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+		while(cursor < tx.size()) {
+			uint8_t b = tx[cursor++].b;
+			if(::write(fd, &b, 1) != 1) return;
+		}
+	}
+}
+
+static int runPty(const Options &o)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+		printf("!! no pseudo terminal\n");
+		return 1;
+	}
+	const char *path = ptsname(fd);
+	hs::SerialPort port;
+	if(!path || !port.open(path)) {
+		printf("!! cannot open %s\n", path ? path : "the pty");
+		return 1;
+	}
+	
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0) {
+		ptyDevice(fd);
+		_exit(0);
+	}
+	
+	printf("  simulated master behind %s, window 8, batch 4\n", path);
+	hs::Client::Options co;
+	co.timeoutUs = 500000;				// the simulation runs slower than real time
+	hs::Client client(port, co);
+	client.begin();
+	uint64_t t0 = port.nowUs();
+	uint8_t pairs[hs::COORD_MAX][2];
+	bool ok = true;
+	for(uint32_t k = 0; ok && k < o.frames; k++) {
+		densePairs(k, pairs);
+		ok = client.sendPairs(pairs, hs::COORD_MAX) && client.poll(0);
+	}
+	ok = ok && client.flush(10000000);
+	if(!ok) printf("    !! link error or frames left unacknowledged: %u\n", client.inFlight());
+	printStats(client.stats(), (port.nowUs() - t0) / 1e6);
+	
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	Options o = { 400, 1000, false, NULL };
+	
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--frames") && i + 1 < argc) o.frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--latency-us") && i + 1 < argc) o.latencyUs = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--pty")) o.pty = true;
+		else if(!strcmp(argv[i], "--capture") && i + 1 < argc) o.capture = argv[++i];
+		else {
+			printf("usage: %s [--frames N] [--latency-us L] [--pty] [--capture FILE]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(o.frames == 0) o.frames = 1;
+	
+	printf("HSoundplane client: %u dense frames (16 contacts)\n", o.frames);
+	if(o.pty) return runPty(o);
+	
+	printf("  link latency %u us each way\n", o.latencyUs);
+	runForked(o, "stop-and-wait", 1, 1);
+	runForked(o, "window 8, batch 4", 8, 4, SimLink::damage_none, 0, o.capture);
+	runForked(o, "window 8, batch 4, one length byte lost every 25th frame", 8, 4, SimLink::damage_drop, 25);
+	runForked(o, "window 8, batch 4, a bad coordinate every 25th frame", 8, 4, SimLink::damage_coord, 25);
+	runForked(o, "window 8, batch 4, the host sending a bad coordinate every 25th frame", 8, 4, SimLink::damage_host, 25);
+	return 0;
+}
@@ -0,0 +1,376 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Replay of a capture (hostClient/hsCapture.h) on the simulated master and
+// slaves. The bytes the host sent are fed to the master's serial port, at
+// their captured times (--speed real) or back-to-back at the serial link
+// rate (--speed max), and the piezo sets written to the slaves and the
+// images they latch are checked against the reference records of the
+// capture:
+// - real:	the same i2c payloads and images, in the same order, per slave;
+// - max:	frames are superseded while the bus is busy, so the images of
+//			each slave must be a subsequence of the reference ones, ending
+//			with the same image (the payloads are not compared).
+// --record OUT saves the capture with the records of a real time replay as
+// the new reference. Exits with 1 on a mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "Arduino.h"
+#include "hsCapture.h"
+
+#define BOOT_NS				2000000000LL
+#define SETTLE_NS			50000000LL	// run after the last byte
+#define SCMD_START			253
+#define SCMD_STOP			255
+#define SCMD_STATS			201
+#define STATS_LENGTH		24			// SCMD_STATS + 22 bytes + SERR_CRLF
+#define SLAVES				4
+#define I2C_GENERAL_CALL	0x00		// mirrors hsoundplane.h
+#define I2C_SLAVE_ADDR_BASE	0x50
+#define I2C_CMD_STAGED		0x80
+#define I2C_CMD_REGSET		0			// i2cCmd_regSet
+#define I2C_CMD_REGIMAGE	2			// i2cCmd_regImage
+#define I2C_CMD_COMMIT		0x08		// i2cCmd_commit
+
+static const char *slaveNames[SLAVES] = { "slave1", "slave2", "slave3", "slave4" };
+
+struct Options {
+	bool max;							// back-to-back instead of the captured times
+	const char *record;					// new reference capture
+	const char *path;
+};
+
+typedef std::vector<const hs::Capture::Record *> RecordList;
+
+/* -------------------------------------------------------------------------- */
+/* | PayloadWatch															| */
+/* -------------------------------------------------------------------------- */
+// Collects the piezo sets written to the slaves and the commits (the health
+// probes and the drivers depend on the time, not on the frames)
+class PayloadWatch : public sim::I2CMonitor {
+public:
+	PayloadWatch(hs::Capture &out, sim::Time t0) : on(false), mOut(out), mT0(t0) {}
+
+	void i2cTransaction(uint8_t addr, bool read, const uint8_t *data, uint8_t len,
+						uint8_t status, sim::Time start, sim::Time end)
+	{
+		(void)start;
+		if(!on || read || status != 0 || len == 0) return;
+		uint8_t cmd = data[0] & ~I2C_CMD_STAGED;
+		bool set = (addr >= I2C_SLAVE_ADDR_BASE) && (addr < I2C_SLAVE_ADDR_BASE + SLAVES) &&
+				   ((cmd == I2C_CMD_REGSET) || (cmd == I2C_CMD_REGIMAGE));
+		bool commit = (addr == I2C_GENERAL_CALL) && (data[0] == I2C_CMD_COMMIT);
+		if(!set && !commit) return;
+		std::vector<uint8_t> rec(1, addr);
+		rec.insert(rec.end(), data, data + len);
+		mOut.add(hs::cap_i2c, (uint32_t)((end - mT0) / 1000), &rec[0], rec.size());
+	}
+
+	bool on;
+
+private:
+	hs::Capture &mOut;
+	sim::Time mT0;
+};
+
+/* -------------------------------------------------------------------------- */
+/* | checks																	| */
+/* -------------------------------------------------------------------------- */
+static void printBytes(const char *what, const std::vector<uint8_t> &d, size_t from)
+{
+	printf("      %s:", what);
+	for(size_t i = from; i < d.size(); i++) printf(" %02x", d[i]);
+	printf("\n");
+}
+
+// Records grouped by their first data byte (i2c address, resp. slave)
+static std::map<uint8_t, RecordList> byKey(const RecordList &l)
+{
+	std::map<uint8_t, RecordList> m;
+	for(size_t i = 0; i < l.size(); i++) {
+		if(!l[i]->data.empty()) m[l[i]->data[0]].push_back(l[i]);
+	}
+	return m;
+}
+
+// Same records, in the same order, for every key. Returns the mismatches
+// (missing or extra records counting as one).
+static uint32_t checkExact(const char *what, const RecordList &got, const RecordList &ref)
+{
+	std::map<uint8_t, RecordList> g = byKey(got), r = byKey(ref);
+	std::map<uint8_t, bool> keys;
+	for(std::map<uint8_t, RecordList>::iterator it = g.begin(); it != g.end(); ++it) keys[it->first] = true;
+	for(std::map<uint8_t, RecordList>::iterator it = r.begin(); it != r.end(); ++it) keys[it->first] = true;
+	
+	uint32_t bad = 0;
+	for(std::map<uint8_t, bool>::iterator it = keys.begin(); it != keys.end(); ++it) {
+		const RecordList &a = g[it->first], &b = r[it->first];
+		size_t n = (a.size() < b.size()) ? a.size() : b.size();
+		size_t i = 0;
+		while((i < n) && (a[i]->data == b[i]->data)) i++;
+		if(i == n && a.size() == b.size()) continue;
+		bad++;
+		printf("    !! %s 0x%02x: %u replayed, %u captured, first difference #%u", what, it->first,
+			   (uint32_t)a.size(), (uint32_t)b.size(), (uint32_t)i);
+		if(i < n) {
+			printf(" at %.3f ms (captured %.3f ms)\n", a[i]->timeUs / 1000.0, b[i]->timeUs / 1000.0);
+			printBytes("replayed", a[i]->data, 1);
+			printBytes("captured", b[i]->data, 1);
+		} else {
+			printf("\n");
+		}
+	}
+	return bad;
+}
+
+// The records without the repeated ones (an unchanged set sent again by the
+// periodic refresh, which follows the frames dispatched)
+static RecordList changes(const RecordList &l)
+{
+	RecordList out;
+	for(size_t i = 0; i < l.size(); i++) {
+		if(out.empty() || (out.back()->data != l[i]->data)) out.push_back(l[i]);
+	}
+	return out;
+}
+
+// Images of every slave a subsequence of the reference ones, the last ones
+// equal. Returns the slaves failing.
+static uint32_t checkSubsequence(const RecordList &got, const RecordList &ref)
+{
+	std::map<uint8_t, RecordList> g = byKey(got), r = byKey(ref);
+	uint32_t bad = 0;
+	for(uint8_t s = 0; s < SLAVES; s++) {
+		RecordList a = changes(g[s]), b = changes(r[s]);
+		size_t j = 0;
+		for(size_t i = 0; i < a.size(); i++) {
+			while((j < b.size()) && (b[j]->data != a[i]->data)) j++;
+			if(j == b.size()) {
+				bad++;
+				printf("    !! slave %u: image #%u at %.3f ms never latched in the capture\n", s, (uint32_t)i,
+					   a[i]->timeUs / 1000.0);
+				printBytes("replayed", a[i]->data, 1);
+				break;
+			}
+			j++;
+		}
+		// j == b.size(): an image was missing (already counted), or the last
+		// one matched the last captured one
+		if((j < b.size()) && (a.empty() || (a.back()->data != b.back()->data))) {
+			bad++;
+			printf("    !! slave %u: last image differs\n", s);
+			if(!a.empty()) printBytes("replayed", a.back()->data, 1);
+			printBytes("captured", b.back()->data, 1);
+		}
+	}
+	return bad;
+}
+
+/* -------------------------------------------------------------------------- */
+/* | replay																	| */
+/* -------------------------------------------------------------------------- */
+static sim::ShiftRegisterChain *chainOf(const char *name)
+{
+	sim::Board *b = sim::World::instance().board(name);
+	return b ? dynamic_cast<sim::ShiftRegisterChain *>(b->spiDevice) : NULL;
+}
+
+static uint32_t le(const std::vector<HardwareSerial::Byte> &tx, size_t at, uint8_t n)
+{
+	uint32_t v = 0;
+	for(uint8_t i = 0; i < n; i++) v |= (uint32_t)tx[at + i].b << (8 * i);
+	return v;
+}
+
+static size_t requestStats(HardwareSerial &serial, bool reset)
+{
+	sim::World &w = sim::World::instance();
+	const uint8_t request[] = { SCMD_START, 1, SCMD_STATS, (uint8_t)(reset ? 1 : 0), SCMD_STOP };
+	size_t from = serial.sent().size();
+	serial.inject(request, sizeof(request), w.now());
+	w.runUntil(serial.lastArrival() + 5000000LL);
+	
+	const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+	for(size_t i = from; i + STATS_LENGTH <= tx.size(); i++) {
+		if(tx[i].b == SCMD_STATS && tx[i + STATS_LENGTH - 1].b == 255) return i;
+	}
+	return tx.size();
+}
+
+static double wallSeconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool earlier(const hs::Capture::Record &a, const hs::Capture::Record &b)
+{
+	return a.timeUs < b.timeUs;
+}
+
+static int replay(const Options &o, const hs::Capture &cap)
+{
+	RecordList rx = cap.select(hs::cap_rx);
+	RecordList refI2c = cap.select(hs::cap_i2c);
+	RecordList refLatch = cap.select(hs::cap_latch);
+	if(rx.empty()) {
+		printf("!! %s: nothing sent to the master\n", o.path);
+		return 2;
+	}
+	size_t bytes = 0;
+	for(size_t i = 0; i < rx.size(); i++) bytes += rx[i]->data.size();
+	printf("HSoundplane replay: %s, %u bytes in %u writes over %.1f ms, replayed %s\n", o.path,
+		   (uint32_t)bytes, (uint32_t)rx.size(), rx.back()->timeUs / 1000.0,
+		   o.max ? "back-to-back" : "at the captured times");
+	
+	sim::World &w = sim::World::instance();
+	w.runUntil(BOOT_NS);
+	HardwareSerial &serial = *w.board("master")->serial;
+	requestStats(serial, true);
+	
+	// the capture starts now
+	hs::Capture out;
+	sim::Time t0 = w.now() + 1000000LL;
+	PayloadWatch watch(out, t0);
+	w.bus().addMonitor(&watch);
+	w.bus().resetStats();
+	size_t latchBase[SLAVES];
+	for(uint8_t s = 0; s < SLAVES; s++) latchBase[s] = chainOf(slaveNames[s])->latches().size();
+	
+	double wall = wallSeconds();
+	watch.on = true;
+	for(size_t i = 0; i < rx.size(); i++) {
+		serial.inject(&rx[i]->data[0], rx[i]->data.size(), o.max ? t0 : t0 + (sim::Time)rx[i]->timeUs * 1000);
+	}
+	sim::Time lastIn = serial.lastArrival();
+	w.runUntil(lastIn + SETTLE_NS);
+	watch.on = false;
+	wall = wallSeconds() - wall;
+	
+	sim::Time lastLatch = t0;
+	for(uint8_t s = 0; s < SLAVES; s++) {
+		const std::vector<sim::ShiftRegisterChain::Latch> &l = chainOf(slaveNames[s])->latches();
+		for(size_t j = latchBase[s]; j < l.size(); j++) {
+			std::vector<uint8_t> rec(1, s);
+			rec.insert(rec.end(), l[j].image, l[j].image + chainOf(slaveNames[s])->length());
+			out.add(hs::cap_latch, (uint32_t)((l[j].t - t0) / 1000), &rec[0], rec.size());
+			if(l[j].t > lastLatch) lastLatch = l[j].t;
+		}
+	}
+	RecordList gotI2c = out.select(hs::cap_i2c);
+	RecordList gotLatch = out.select(hs::cap_latch);
+	
+	const std::vector<HardwareSerial::Byte> &tx = serial.sent();
+	sim::Time busy = w.bus().busyTime();
+	sim::Time elapsed = lastLatch - t0;
+	size_t at = requestStats(serial, false);
+	uint32_t frames = (at < tx.size()) ? le(tx, at + 1, 4) - 1 : 0;
+	if(at < tx.size()) {
+		printf("  master: %u frames decoded, %u resyncs, %u bytes skipped, %u superseded, rx overflows %u\n",
+			   frames, le(tx, at + 9, 2), le(tx, at + 11, 2), le(tx, at + 13, 2), serial.overflows());
+	}
+	if(elapsed > 0) {
+		printf("  %.1f ms to the last latch: %.0f frames/s, bus utilisation %.1f %%, %u piezo sets & commits, %u latches\n",
+			   elapsed / 1e6, 1e9 * frames / elapsed, 100.0 * busy / elapsed,
+			   (uint32_t)gotI2c.size(), (uint32_t)gotLatch.size());
+	}
+	printf("  %.3f s wall time: %.0f frames/s, %.1fx real time\n", wall, frames / wall,
+		   (lastIn + SETTLE_NS - t0) / 1e9 / wall);
+	
+	int ret = 0;
+	if(o.record) {
+		// the bytes sent, then the output, in time order
+		hs::Capture ref;
+		for(size_t i = 0; i < rx.size(); i++) ref.add(hs::cap_rx, rx[i]->timeUs, &rx[i]->data[0], rx[i]->data.size());
+		std::vector<hs::Capture::Record> all(ref.records());
+		all.insert(all.end(), out.records().begin(), out.records().end());
+		std::stable_sort(all.begin(), all.end(), earlier);
+		ref.clear();
+		for(size_t i = 0; i < all.size(); i++) ref.add(all[i].type, all[i].timeUs, &all[i].data[0], all[i].data.size());
+		if(!ref.save(o.record)) {
+			printf("!! cannot write %s\n", o.record);
+			return 2;
+		}
+		printf("  reference saved to %s\n", o.record);
+	} else if(refI2c.empty() && refLatch.empty()) {
+		printf("  no reference in the capture (hsReplay --record)\n");
+	} else if(o.max) {
+		uint32_t bad = checkSubsequence(gotLatch, refLatch);
+		printf("  check: images of %u/%u slaves follow the capture (payloads not compared)\n", SLAVES - bad, SLAVES);
+		ret = bad ? 1 : 0;
+	} else {
+		uint32_t bad = checkExact("i2c", gotI2c, refI2c) + checkExact("slave", gotLatch, refLatch);
+		printf("  check: %u/%u piezo sets & commits, %u/%u latches, %s\n", (uint32_t)gotI2c.size(),
+			   (uint32_t)refI2c.size(), (uint32_t)gotLatch.size(), (uint32_t)refLatch.size(),
+			   bad ? "MISMATCH" : "identical");
+		ret = bad ? 1 : 0;
+	}
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	printf("usage: %s [--speed real|max] [--record OUT] CAPTURE\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	Options o = { false, NULL, NULL };
+	
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--record") && i + 1 < argc) o.record = argv[++i];
+		else if(!strcmp(argv[i], "--speed") && i + 1 < argc) {
+			i++;
+			if(!strcmp(argv[i], "real")) o.max = false;
+			else if(!strcmp(argv[i], "max")) o.max = true;
+			else {
+				usage(argv[0]);
+				return 2;
+			}
+		}
+		else if(argv[i][0] != '-' && !o.path) o.path = argv[i];
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(!o.path || (o.record && o.max)) {
+		usage(argv[0]);
+		if(o.record && o.max) printf("the reference is recorded at the captured times (--speed real)\n");
+		return 2;
+	}
+	
+	hs::Capture cap;
+	if(!cap.load(o.path)) {
+		printf("!! cannot read %s\n", o.path);
+		return 2;
+	}
+	return replay(o, cap);
+}
@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////////
+//
+//  This file is part of the HSoundplane host simulation
+//
+//  Copyright (c) 2015, www.icst.net
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of
+//  this software and associated documentation files (the "Software"), to deal in
+//  the Software without restriction, including without limitation the rights to use,
+//  copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+//  Software, and to permit persons to whom the Software is furnished to do so,
+//  subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//  PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+//  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Decoder of the binary trace records (hsTrace.h) sent by the master or a
+// slave with SCMD_DEBUG DEBUG_TRACE / SLAVE_TRACE 2. Reads the raw serial
+// output from a file (or stdin), skips everything that is not a record (the
+// replies to the host) and prints one line per event:
+//
+//   time [us]   +delta [us]   name       description
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "hsTraceEvents.h"
+
+struct EventInfo {
+	const char *name;
+	const char *format;
+};
+
+#define HS_TRACE_INFO(id, name, fmt)	{ name, fmt },
+static const EventInfo events[] = { HS_TRACE_EVENTS(HS_TRACE_INFO) };
+#undef HS_TRACE_INFO
+
+static unsigned conversions(const char *format)
+{
+	unsigned n = 0;
+	for(const char *p = format; *p; p++) {
+		if(*p == '%') n++;
+	}
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc > 2 || (argc == 2 && !strcmp(argv[1], "--help"))) {
+		printf("usage: %s [FILE]   (raw serial output, stdin if omitted)\n", argv[0]);
+		return 1;
+	}
+	FILE *in = (argc == 2) ? fopen(argv[1], "rb") : stdin;
+	if(!in) {
+		fprintf(stderr, "cannot open %s\n", argv[1]);
+		return 1;
+	}
+	
+	uint8_t rec[HS_TRACE_RECORD];
+	unsigned fill = 0;
+	unsigned long records = 0, skipped = 0, lost = 0;
+	uint32_t last = 0;
+	int c;
+	while((c = fgetc(in)) != EOF) {
+		// hunt for the mark, then resync on it if the record is not closed
+		if(fill == 0 && c != HS_TRACE_MARK) {
+			skipped++;
+			continue;
+		}
+		rec[fill++] = (uint8_t)c;
+		if(fill < HS_TRACE_RECORD) continue;
+		fill = 0;
+		if(rec[HS_TRACE_RECORD - 1] != 255 || rec[1] >= HS_TRACE_IDS) {
+			skipped++;
+			for(unsigned i = 1; i < HS_TRACE_RECORD; i++) {
+				if(rec[i] == HS_TRACE_MARK) {
+					memmove(rec, &rec[i], HS_TRACE_RECORD - i);
+					fill = HS_TRACE_RECORD - i;
+					break;
+				}
+				skipped++;
+			}
+			continue;
+		}
+		
+		uint8_t id = rec[1];
+		unsigned a = rec[2];
+		unsigned b = rec[3] | (rec[4] << 8);
+		uint32_t t = rec[5] | (rec[6] << 8) | ((uint32_t)rec[7] << 16) | ((uint32_t)rec[8] << 24);
+		
+		printf("%10u  %+8d  %-9s ", t, records ? (int32_t)(t - last) : 0, events[id].name);
+		if(conversions(events[id].format) > 1) {
+			printf(events[id].format, a, b);
+		} else {
+			printf(events[id].format, a);
+		}
+		printf("\n");
+		if(id == trc_lost) lost += a;
+		last = t;
+		records++;
+	}
+	if(in != stdin) fclose(in);
+	
+	fprintf(stderr, "%lu events, %lu lost on the board, %lu other bytes\n", records, lost, skipped);
+	return 0;
+}
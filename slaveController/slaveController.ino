@@ -28,7 +28,7 @@
 #include <Wire.h>
 #include <SPI.h>
 #include "drv2667.h"
-#include "HSoundplane.h"
+#include "hsoundplane.h"
 #include "slaveSettings.h"
 
 /* -------------------------------------------------------------------------- */
@@ -45,8 +45,18 @@ void setup()
 	if(i2cFastMode) Wire.setClock(400000);
 	Wire.onRequest(requestEvent); // attach request event (slave transmitter) handler
 	Wire.onReceive(receiveEvent); // attach receive event (slave receiver) handler
+#if defined(__AVR__)
+	TWAR |= _BV(TWGCE);					// also answer the general call (commit)
+#else
+	simGeneralCall();
+#endif
 
 	SPI.begin(); // SPI...
+	SPI.beginTransaction(settingsA);	// the chain is the only SPI device: keep it set up
+#if defined(__AVR__)
+	TCCR1A = 0;							// Timer1 free running at F_CPU (cycle counter)
+	TCCR1B = _BV(CS10);
+#endif
 
 	// Setting up pin directions & values
 	pinMode(LED1_PIN, OUTPUT);			// LEDs...
@@ -67,7 +77,7 @@ void setup()
 	digitalWrite(LOAD_PIN, LOW);		// storage clock active on rising edge
 	digitalWrite(OE_PIN, LOW);			// enable latch outputs
   
-	switchAddress = (I2C_SWITCH_ADDRESS - I2C_SWITCH_ADDR1);
+	switchAddress = (I2C_SWITCH_ADDRESS - I2C_SWITCH_ADDR_BASE);
 	pinMode(SW_ADDR_0, OUTPUT);			// i2c switch address
 	digitalWrite(SW_ADDR_0, (switchAddress & 0x01));
 	pinMode(SW_ADDR_1, OUTPUT);
@@ -78,13 +88,26 @@ void setup()
 	pinMode(A7, OUTPUT);				// "Soundplane piezo-driver v0.95 - R002"
 	
 	
-	syncPinState = false;				// sync pin...
-	pinMode(SYNC_PIN_1, OUTPUT);
-	digitalWrite(SYNC_PIN_1, syncPinState);
+	pinMode(SYNC_PIN_1, OUTPUT);		// sync pin...
+	digitalWrite(SYNC_PIN_1, LOW);
 	
 	slaveInitFlag = false;				// slave initialization flag...
 	slaveNotifyFlag = false;			// slave notification flag...
 	slaveWriteFlag = false;				// slave writing command flag...
+	slaveNotified = false;				// not registered by the master yet...
+	slaveRxStaged = false;				// two-phase latch state...
+	slaveStaged = false;
+	slaveShifted = false;
+	slaveCommitFlag = false;
+	latchCycles = 0;
+	for(uint8_t i = 0; i < I2C_COMMIT_SLOTS; i++) {	// commit -> latch times...
+		commitDelay[i] = I2C_LATCH_NONE;
+	}
+	for(uint8_t i = 0; i < HS_SLAVE_STATS; i++) {	// latency statistics...
+		hsLatReset(&slaveStat[i]);
+	}
+	statPage = 0;
+	hsTraceEnable(SLAVE_TRACE > 0);		// debug events...
   
   	if(debug) {
 		Serial.print("\nStarting up slave controller... #"); Serial.println(SLAVE_ID, DEC);
@@ -132,25 +155,57 @@ void loop()
 	}
 	
 	if(slaveNotifyFlag) {
-		syncPinState = !syncPinState;
-		digitalWrite(SYNC_PIN_1, syncPinState);
+		SYNC_TOGGLE();
 
 		slaveNotifyFlag = false;
 
-		syncPinState = !syncPinState;
-		digitalWrite(SYNC_PIN_1, syncPinState);
+		SYNC_TOGGLE();
 	} 
 	
 	if(slaveWriteFlag) {
-		// syncPinState = !syncPinState;
-		// digitalWrite(SYNC_PIN_1, syncPinState);
+		// SYNC_TOGGLE();
 
-		// send the piezo bitmasks to the shift registers
-		piezoSend(piezoVal1, piezoVal2, piezoVal3);
+		// swap the buffers so that receiveEvent() can fill the back one while
+		// the front one is shifted out, and take the state of the set with
+		// them (a set received from now on has its own)
+		noInterrupts();
+		uint8_t *reg = piezoReg;
+		piezoReg = piezoOut;
+		piezoOut = reg;
+		uint16_t since = rxCycles;
+		bool staged = slaveRxStaged;
+		slaveRxStaged = false;
+		slaveStaged = staged;
+		if(!staged) {
+			slaveShifted = false;		// an immediate set overwrites a staged one:
+			slaveCommitFlag = false;	// a later commit has nothing to latch
+		}
 		slaveWriteFlag = false;
+		interrupts();
+
+		// send the piezo bitmasks to the shift registers, staged sets are
+		// latched by the commit (right away if it came in the meantime)
+		if(staged) {
+			piezoShift(piezoOut);
+			latchTime(since);
+			noInterrupts();
+			if(slaveCommitFlag) {
+				piezoLatch();
+			} else {
+				slaveShifted = true;
+			}
+			interrupts();
+		} else {
+			piezoSend(piezoOut);
+			latchTime(since);
+		}
 
-		// syncPinState = !syncPinState;
-		// digitalWrite(SYNC_PIN_1, syncPinState);
+		// SYNC_TOGGLE();
+	}
+	
+	// send the debug events in idle time
+	if(hsTraceBuf.on && !slaveWriteFlag) {
+		hsTraceDrain(SLAVE_TRACE == 1);
 	}
 }
 
@@ -162,17 +217,44 @@ void loop()
 /* -------------------------------------------------------------------------- */
 void requestEvent()
 {
-	// syncPinState = !syncPinState;
-	// digitalWrite(SYNC_PIN_1, syncPinState);
+	// SYNC_TOGGLE();
 	
-	if(debug) {
-		Serial.print("i2c registration request received... sending own address 0x");
-		Serial.println(I2C_SLAVE_ADDRESS, HEX);
+	// own address, then a page of the statistic selected by i2cCmd_stats (the
+	// commit -> latch times are read once)
+	if(statPage > 0) {
+		uint8_t st = statPage >> 4;
+		const uint8_t *l = (const uint8_t *)&slaveStat[st % HS_SLAVE_STATS];
+		uint8_t size = sizeof(struct hsLatency);
+		if(st == I2C_STATS_COMMITS) {
+			l = (const uint8_t *)commitDelay;
+			size = sizeof(commitDelay);
+		}
+		uint8_t off = ((statPage & 0x0F) - 1) * HS_LAT_PAGE;
+		uint8_t reply[HS_LAT_PAGE + 1];
+		reply[0] = I2C_SLAVE_ADDRESS;
+		for(uint8_t i = 0; i < HS_LAT_PAGE; i++) {
+			reply[i + 1] = ((off + i) < size) ? l[off + i] : 0;
+		}
+		Wire.write(reply, HS_LAT_PAGE + 1);
+		hsTrace(trc_request, statPage, 0);
+		if(st == I2C_STATS_COMMITS) {
+			for(uint8_t i = 0; i < I2C_COMMIT_SLOTS; i++) {
+				commitDelay[i] = I2C_LATCH_NONE;
+			}
+		}
+		statPage = 0;
+		return;
 	}
-	Wire.write(I2C_SLAVE_ADDRESS);
 
-	// syncPinState = !syncPinState;
-	// digitalWrite(SYNC_PIN_1, syncPinState);
+	hsTrace(trc_request, 0, 0);
+	// own address, then the worst receive -> latch time [cycles] since the
+	// last request, then whether the master registered us (a rebooted slave
+	// answers 0 and is set up again)
+	uint8_t reply[I2C_POLL_LENGTH] = { I2C_SLAVE_ADDRESS, (uint8_t)latchCycles, (uint8_t)(latchCycles >> 8), slaveNotified };
+	Wire.write(reply, I2C_POLL_LENGTH);
+	latchCycles = 0;
+
+	// SYNC_TOGGLE();
 }
 
 
@@ -183,81 +265,79 @@ void requestEvent()
 /* -------------------------------------------------------------------------- */
 void receiveEvent(int howmany)
 {
+	uint16_t now = CYCLE_COUNT();
 	uint8_t decount = howmany;
+	bool staged = false;
 
 	// receive the first byte and check if it's an initialization request
 	uint8_t received = Wire.read();
 	decount--;
-	if(debug) {
-		Serial.print("\nI2C message received... length: "); Serial.print(howmany, DEC);
-		Serial.print(" first byte: 0x"); Serial.println(received, HEX);
+	hsTrace(trc_rx, received, howmany);
+	
+	// staged sets wait for the commit general call before being latched
+	if((received == (i2cCmd_regSet | I2C_CMD_STAGED)) || (received == (i2cCmd_regImage | I2C_CMD_STAGED))) {
+		received &= ~I2C_CMD_STAGED;
+		staged = true;
 	}
 	
 	switch(received) {
 		case i2cCmd_regSet:
-			if(debug) {
-			Serial.println("Setting shift registers...");
-		}
-			// receive all sent bytes and set (bitwise AND) the piezo bismasks
-			piezoVal1 = 0xFFFFFFFF;
-			piezoVal2 = 0xFFFFFFFF;
-			piezoVal3 = 0xFFFFFFFF;
+			// receive all sent bytes and clear (active low) the piezo bits
+			for(uint8_t i = 0; i < HS_PIEZO_BYTES; i++) {
+				piezoReg[i] = 0xFF;
+			}
 		
-			syncPinState = !syncPinState;
-			digitalWrite(SYNC_PIN_1, syncPinState);
+			SYNC_TOGGLE();
 
 			while(decount > 0) {
 				received = Wire.read();
 				decount--;
-				if(debug) {
-					Serial.print("Received "); Serial.print(received, DEC);
-				}
-				if(received < 32) {
-					piezoVal1 &= piezoArray1[received];
-					if(debug) {
-						Serial.print("\t-> piezoVal1: 0x"); Serial.println(piezoVal1, HEX);
-					}
-				} else if(received < 64) {
-					piezoVal2 &= piezoArray2[received-32];
-					if(debug) {
-						Serial.print("\t-> piezoVal2: 0x"); Serial.println(piezoVal2, HEX);
-					}
-				} else if(received < 72) {
-					piezoVal3 &= piezoArray3[received-64];
-					if(debug) {
-						Serial.print("\t-> piezoVal3: 0x"); Serial.println(piezoVal3, HEX);
-					}
+				if(received < HS_PIEZO_MAX) {
+					piezoReg[received >> 3] &= ~pgm_read_byte(&hsBit[received & 0x07]);
 				} else {
-					if(debug) {
-						Serial.println("\t!!piezo value out of range!!");
-					}
+					hsTrace(trc_rxErr, i2cCmd_regSet, received);
 				}
 			}
-			if(debug) {
-				Serial.println("");
-			}
 
 			slaveWriteFlag = true;
+			slaveRxStaged = staged;
+			rxCycles = now;
+
+			SYNC_TOGGLE();
+			break;
+		
+		case i2cCmd_regImage:
+			SYNC_TOGGLE();
 
-			syncPinState = !syncPinState;
-			digitalWrite(SYNC_PIN_1, syncPinState);
+			// the master sends the final image: copy it as is
+			if(decount == HS_PIEZO_BYTES) {
+				for(uint8_t i = 0; i < HS_PIEZO_BYTES; i++) {
+					piezoReg[i] = Wire.read();
+				}
+				slaveWriteFlag = true;
+				slaveRxStaged = staged;
+				rxCycles = now;
+			} else {
+				hsTrace(trc_rxErr, i2cCmd_regImage, decount);
+				while(decount > 0) {
+					Wire.read();
+					decount--;
+				}
+			}
+
+			SYNC_TOGGLE();
 			break;
 		
 		case i2cCmd_notify:
-			syncPinState = !syncPinState;
-			digitalWrite(SYNC_PIN_1, syncPinState);
+			SYNC_TOGGLE();
 			
 			received = Wire.read();
 			decount--;
+			hsTrace(trc_notify, received, 0);
+			slaveNotified = true;
 			if(received == 1) {
-				if(debug) {
-					Serial.println("OK notification");
-				}
 				digitalWrite(LED2_PIN, LED_ON);
 			} else {
-				if(debug) {
-					Serial.println("NOT OK notification");
-				}
 				digitalWrite(LED2_PIN, LED_OFF);
 			}
 			while(decount > 0) {
@@ -265,8 +345,44 @@ void receiveEvent(int howmany)
 				decount--;
 			}
 			
-			syncPinState = !syncPinState;
-			digitalWrite(SYNC_PIN_1, syncPinState);
+			SYNC_TOGGLE();
+			break;
+		
+		case i2cCmd_stats:
+			// select the statistic page of the next request, or clear it
+			received = Wire.read();
+			decount--;
+			if(received & I2C_STATS_RESET) {
+				hsLatReset(&slaveStat[((received & ~I2C_STATS_RESET) >> 4) % HS_SLAVE_STATS]);
+			} else if(((received & 0x0F) > 0) && ((received & 0x0F) <= HS_LAT_PAGES)) {
+				statPage = received;
+			}
+			while(decount > 0) {
+				Wire.read();
+				decount--;
+			}
+			break;
+		
+		case i2cCmd_commit:
+			// latch now if the staged set is already shifted, else as soon as
+			// loop() is done shifting it (the set may still be in the back
+			// buffer). The latch time goes to the slot of the commit number
+			// (not latched: I2C_LATCH_NONE).
+			commitTime = micros();
+			if(decount > 0) {
+				commitSlot = Wire.read() % I2C_COMMIT_SLOTS;
+				decount--;
+			}
+			commitDelay[commitSlot] = I2C_LATCH_NONE;
+			while(decount > 0) {
+				Wire.read();
+				decount--;
+			}
+			if(slaveShifted) {
+				piezoLatch();
+			} else if(slaveStaged || slaveRxStaged) {
+				slaveCommitFlag = true;
+			}
 			break;
 		
 		default:
@@ -279,51 +395,62 @@ void receiveEvent(int howmany)
 
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-/* | piezoSend																| */
+/* | piezoSend / piezoShift / piezoLatch / latchTime						| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
-void piezoSend(uint32_t val1, uint32_t val2, uint32_t val3)
+// Shift and latch at once (immediate mode)
+void piezoSend(const uint8_t *reg)
 {
-	digitalWrite(LED3_PIN, LOW);		// notify SPI activity
-	digitalWrite(LOAD_PIN, LOW);		// prepare LOAD pin
-	digitalWrite(CLR_PIN, LOW);			// reset all shift registers
-	digitalWrite(CLR_PIN, HIGH);		// ...
-	
-	SPI.beginTransaction(settingsA);	// start the SPI transaction with saved settings
-	SPI.transfer((uint8_t)(val3));
-	SPI.transfer((uint8_t)(val2 >> 24));
-	SPI.transfer((uint8_t)(val2 >> 16));
-	SPI.transfer((uint8_t)(val2 >> 8));
-	SPI.transfer((uint8_t)(val2));
-	SPI.transfer((uint8_t)(val1 >> 24));
-	SPI.transfer((uint8_t)(val1 >> 16));
-	SPI.transfer((uint8_t)(val1 >> 8));
-	SPI.transfer((uint8_t)(val1));
-	SPI.endTransaction();
+	piezoShift(reg);
+	LOAD_HIGH();						// generate rising edge on LOAD pin
+}
+
+// Shift into the 74HC595 shift registers, the outputs keep the latched set
+void piezoShift(const uint8_t *reg)
+{
+	LED3_SET_ON();						// notify SPI activity
+	LOAD_LOW();							// prepare LOAD pin
 	
-	if(debug) {
-		Serial.print("Sending to shift registers:\nb'");
-		Serial.print((uint8_t)(val3), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val2 >> 24), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val2 >> 16), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val2 >> 8), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val2), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val1 >> 24), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val1 >> 16), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val1 >> 8), BIN); Serial.print(" ");
-		Serial.print((uint8_t)(val1), BIN); Serial.println("'");
-		
-		Serial.print("0x   "); Serial.print((uint8_t)val3, HEX);
-		Serial.print("       "); Serial.print((uint8_t)(val2 >> 24), HEX);
-		Serial.print("       "); Serial.print((uint8_t)(val2 >> 16), HEX);
-		Serial.print("       "); Serial.print((uint8_t)(val2 >> 8), HEX);
-		Serial.print("       "); Serial.print((uint8_t)(val2), HEX);
-		Serial.print("       "); Serial.print((uint8_t)(val1 >> 24), HEX);
-		Serial.print("       "); Serial.print((uint8_t)(val1 >> 16), HEX);
-		Serial.print("       "); Serial.print((uint8_t)(val1 >> 8), HEX);
-		Serial.print("       "); Serial.println((uint8_t)(val1), HEX);
+	// all 9 registers are overwritten, no need to clear them first. Bytes go
+	// out back-to-back (last register of the chain first): the next one is
+	// loaded as soon as SPIF is set, without the SPI.transfer() call overhead.
+#if defined(__AVR__)
+	SPDR = reg[HS_PIEZO_BYTES - 1];
+	for(int8_t i = (HS_PIEZO_BYTES - 2); i >= 0; i--) {
+		uint8_t b = reg[i];
+		while(!(SPSR & _BV(SPIF)));
+		SPDR = b;
 	}
+	while(!(SPSR & _BV(SPIF)));
+#else
+	for(int8_t i = (HS_PIEZO_BYTES - 1); i >= 0; i--) {
+		simSpiPut(reg[i]);
+	}
+#endif
 	
-	digitalWrite(LOAD_PIN, HIGH);		// generate rising edge on LOAD pin
-	digitalWrite(LED3_PIN, HIGH);		// stop SPI activity notification
+	LED3_SET_OFF();						// stop SPI activity notification
 }
+
+// Transfer the shifted set to the outputs (commit)
+void piezoLatch(void)
+{
+	LOAD_HIGH();						// generate rising edge on LOAD pin
+	slaveStaged = false;
+	slaveShifted = false;
+	slaveCommitFlag = false;
+	
+	unsigned long d = micros() - commitTime;
+	commitDelay[commitSlot] = (d < I2C_LATCH_NONE) ? d : (I2C_LATCH_NONE - 1);
+	hsLatAdd(&slaveStat[hsStat_commit], d);
+}
+
+// Keep the worst receive -> latch time (staged sets: until ready to latch)
+void latchTime(uint16_t since)
+{
+	uint16_t d = CYCLE_COUNT() - since;
+	noInterrupts();						// requestEvent() may be reading it
+	if(d > latchCycles) latchCycles = d;
+	hsLatAdd(&slaveStat[hsStat_latch], d);
+	interrupts();
+	hsTrace(trc_latch, slaveStaged, d);
+}
\ No newline at end of file
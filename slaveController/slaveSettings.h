@@ -28,44 +28,58 @@
 #ifndef _SLAVESETTINGS_H
 #define _SLAVESETTINGS_H
 
-#include "HSoundplane.h"
+#include "hsoundplane.h"
 
+#ifndef SLAVE_ID
 #define SLAVE_ID			4
+#endif
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 /* | MACROS																	| */
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 // TO CHANGE FOR EACH SLAVE
-// #define I2C_SLAVE_ADDRESS	I2C_SLAVE_ADDR1		// own i2c slave address to respond to
+// SLAVE_ID (above): position of the slave in HS_TOPOLOGY (1 - HS_SLAVE_NUMBER)
 
 // GENERAL SLAVE SETTINGS
 #define I2C_FAST_MODE		1			// 0 -> standad mode (100 kHz) i2c,
 										// 1 -> fast mode (400 kHz)
 #define SERIAL_SPEED		230400		// serial communication speed for debugging
-#define SPI_SPEED			2000000		// SPI communication speed for shift registers
+#define SPI_SPEED			8000000		// SPI communication speed for shift registers
+										// (F_CPU/2, the 74HC595 chain takes >20 MHz)
 
 #define INIT_WAIT_MS		100
 
 #define SYNC_PIN_1			A0			// pin used to measure time between events
 
-#if(SLAVE_ID == 1)
-#define I2C_SLAVE_ADDRESS	I2C_SLAVE_ADDR1
-#define I2C_SWITCH_ADDRESS	I2C_SWITCH_ADDR1
-#elif(SLAVE_ID == 2)
-#define I2C_SLAVE_ADDRESS	I2C_SLAVE_ADDR2
-#define I2C_SWITCH_ADDRESS	I2C_SWITCH_ADDR2
-#elif(SLAVE_ID == 3)
-#define I2C_SLAVE_ADDRESS	I2C_SLAVE_ADDR3
-#define I2C_SWITCH_ADDRESS	I2C_SWITCH_ADDR3
-#elif(SLAVE_ID == 4)
-#define I2C_SLAVE_ADDRESS	I2C_SLAVE_ADDR4
-#define I2C_SWITCH_ADDRESS	I2C_SWITCH_ADDR4
+#define SLAVE_TRACE			0			// debug events sent in idle time: 0 -> off,
+										// 1 -> text, 2 -> binary records (hsTraceDecode)
+#define HS_TRACE_SIZE		16			// trace events buffered (power of 2, <= 128)
+#include "hsTrace.h"
+
+// Direct port access for the output path (nano: LOAD_PIN = PB0, LED3_PIN = PD6,
+// SYNC_PIN_1 = PC0): 2 cycles instead of ~50 for a digitalWrite(). Timer1 runs
+// at F_CPU and times the receive -> latch path in cycles (wraps at 4.1 ms).
+#if defined(__AVR__)
+#define LOAD_HIGH()			(PORTB |= _BV(PORTB0))
+#define LOAD_LOW()			(PORTB &= ~_BV(PORTB0))
+#define LED3_SET_ON()		(PORTD &= ~_BV(PORTD6))
+#define LED3_SET_OFF()		(PORTD |= _BV(PORTD6))
+#define SYNC_TOGGLE()		(PINC = _BV(PINC0))		// writing PINx toggles the pin
+#define CYCLE_COUNT()		TCNT1
 #else
-#define I2C_SLAVE_ADDRESS	0xFF
-#define I2C_SWITCH_ADDRESS	0xFF
+#define LOAD_HIGH()			simPortWrite(LOAD_PIN, HIGH)
+#define LOAD_LOW()			simPortWrite(LOAD_PIN, LOW)
+#define LED3_SET_ON()		simPortWrite(LED3_PIN, LED_ON)
+#define LED3_SET_OFF()		simPortWrite(LED3_PIN, LED_OFF)
+#define SYNC_TOGGLE()		simPortToggle(SYNC_PIN_1)
+#define CYCLE_COUNT()		simCycleCount()
 #endif
 
+// Slave n of the topology (1 - HS_SLAVE_NUMBER): addresses of its HS_TOPOLOGY entry
+#define I2C_SLAVE_ADDRESS	hsTopoSlaveAddr(SLAVE_ID)
+#define I2C_SWITCH_ADDRESS	hsTopoSwitchAddr(SLAVE_ID)
+
 
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
@@ -73,6 +87,7 @@
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 bool debug = false;				// DEBUG FLAG!!
+struct hsTraceRing hsTraceBuf;	// debug events waiting for the serial port
 
 #if(I2C_FAST_MODE > 0)			// i2c speed flag
 	bool i2cFastMode = true;
@@ -82,15 +97,29 @@ bool debug = false;				// DEBUG FLAG!!
 
 SPISettings settingsA(SPI_SPEED, MSBFIRST, SPI_MODE0);	// SPI settings
 
-bool syncPinState;
 bool slaveInitFlag;
 bool slaveNotifyFlag;
 bool slaveWriteFlag;
+volatile bool slaveNotified;			// setup notification received since power-up
+volatile bool slaveRxStaged;			// piezo set in the back buffer waits for a commit
+volatile bool slaveStaged;				// piezo set taken by loop() waits for a commit
+volatile bool slaveShifted;				// ...and is in the shift registers
+volatile bool slaveCommitFlag;			// commit received before it was shifted
+unsigned long commitTime;				// micros() of the last commit
+uint8_t commitSlot;						// slot of the last commit (number % I2C_COMMIT_SLOTS)
+uint16_t commitDelay[I2C_COMMIT_SLOTS];	// commit -> LOAD delay of the last commits [us], by
+										// slot, until read (I2C_STATS_COMMITS)
+volatile uint16_t rxCycles;				// CYCLE_COUNT() when the last set was received
+uint16_t latchCycles;					// worst receive -> latch (or shifted) since the last poll
+struct hsLatency slaveStat[HS_SLAVE_STATS];	// latency statistics (hsSlaveStat)
+uint8_t statPage;						// reply of the next request: 0 -> address & worst
+										// latch time, else i2cCmd_stats page
 uint8_t switchAddress;
 
-uint32_t piezoVal1;
-uint32_t piezoVal2;
-uint32_t piezoVal3;
+uint8_t piezoBuf[2][HS_PIEZO_BYTES];	// shift registers images (active low),
+										// byte n -> piezos 8n..8n+7
+uint8_t *piezoReg = piezoBuf[0];		// back buffer, filled by receiveEvent()
+uint8_t *piezoOut = piezoBuf[1];		// front buffer, shifted out by loop()
 
 
 /* -------------------------------------------------------------------------- */
@@ -100,4 +129,8 @@ uint32_t piezoVal3;
 /* -------------------------------------------------------------------------- */
 void requestEvent(void);
 void receiveEvent(int);
+void piezoSend(const uint8_t *reg);
+void piezoShift(const uint8_t *reg);
+void piezoLatch(void);
+void latchTime(uint16_t since);
 #endif
\ No newline at end of file